@@ -1,12 +1,62 @@
 #include <iostream>
 #include <vector>
+#include <cerrno>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring> 
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 #include <GL/glew.h>
+#ifdef FLUIDSIM_VULKAN
+#include <vulkan/vulkan.h>
+#endif
+#ifdef FLUIDSIM_OPENCL
+#define CL_TARGET_OPENCL_VERSION 120
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+#endif
 #include <GLFW/glfw3.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FLUIDSIM_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -15,439 +65,7899 @@
 constexpr int window_width = 800;
 constexpr int window_height = 600;
 
-static float g_aspect_ratio = float(window_width) / float(window_height);
-float g_globalSimTime = 0.0f;
+double g_globalSimTime = 0.0;
+
+// autotuning options, set from the command line in main()
+static bool g_forceautotune = false;
+static bool g_skipautotune = false;
+static float g_tunetolerance = 1e-4f;
+static const char* tuneprofile_path = "fluid-sim.tune";
+
+// benchmark options, set from the command line in main()
+static std::string g_rooflinepath;
+static int g_benchgrid = 1024;
+static int g_benchripples = 0;  // steps to time each ripple solver for; 0 runs the simulation
+static bool g_benchadi = false;
+static bool g_benchadvect = false;
+static bool g_benchiwave = false;
+static bool g_benchsponge = false;
+static bool g_benchupsample = false;
+static int g_benchbodies = 0;  // small water bodies to time the batched update on; 0 skips it
+static bool g_benchuptime = false;
+static std::string g_ensemblepath;
+static int g_ensemblesteps = 3600;
+static int g_ensemblegrid = 200;
+static int g_ensemblejobs = 0;  // 0 uses every core
+
+// frame pipeline options, set from the command line in main()
+static bool g_sequential = false;
+static std::string g_backend = "gl";  // renderer for the sequential loop: gl or vulkan
+static std::string g_compute = "cpu";  // where the wave update runs: cpu, opencl, gl or feedback
+static std::string g_ripples = "off";  // the interactive ripple layer: off, cpu or gpu
+static int g_ripplegrid = 256;
+static float g_rippleviscosity = 0.0f;  // implicit diffusion number per ripple step
+static float g_ripplecurrent = 0.0f;  // fastest drift of the ripple layer's eddy in cells per step
+static std::string g_advection = "maccormack";  // first, maccormack or bfecc
+static int g_iwaverank = -1;  // separable terms of the iwave kernel, 0 for the direct convolution, -1 for no iwave
+static float g_rippleobstacle = 0.0f;  // radius of the pillar in the ripple layer, as a fraction of its side
+static int g_ripplesponge = 0;  // cells of absorbing band along the ripple layer's border
+static std::string g_rippleupsample = "linear";  // how the ripple grid is drawn onto the volume: linear or cubic
+static float g_rippledetail = 0.0f;  // wavelet noise height per unit of coarse ripple slope, cubic only
+static float g_reflectionscale = 0.0f;  // fraction of the framebuffer the reflection maps are drawn at; 0 is off
+static int g_reflectioninterval = 2;  // frames between refreshes of the reflection maps
+static bool g_cullfaces = true;  // cull back faces and draw the volume front to back; --no-cull draws every face
+static bool g_depthprepass = false;
+static bool g_overdraw = false;  // draw layer counts instead of shading and report the fragments per frame
+static int g_framesinflight = 2;
+static std::string g_exportprefix;
+static size_t g_uploadbudget = 4 << 20;  // bytes of staged mesh data uploaded per frame during a grid resize
+static int g_clipmaplevels = 0;  // 0 draws the water volume, otherwise the open-water clipmap with this many levels
+static int g_clipmapsize = 129;
+static std::string g_bathymetrypath;
+static size_t g_tilecachebudget = size_t(256) << 20;
+static std::string g_checkpointpath;
+static long g_checkpointevery = 0;  // frames between checkpoints; 0 writes none
+static std::string g_restartpath;
 
 struct vertex {
     float x, y, z;
     float nx, ny, nz;
 };
 
+// a run of indices drawn with a vertex offset, the unit every renderer draws in
+struct drawrange {
+    GLsizei count = 0;
+    size_t first = 0;
+    GLint basevertex = 0;
+
+    bool operator==(const drawrange&) const = default;
+};
+
+// bounded lock-free queue for exactly one producer thread and one consumer thread.
+// head and tail live on separate cache lines so the two sides don't false-share.
+template <typename T, size_t capacity>
+class spscqueue {
+    static_assert((capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+public:
+    bool push(const T& item) {
+        size_t tail = tailindex.load(std::memory_order_relaxed);
+        if (tail - headindex.load(std::memory_order_acquire) == capacity) return false;
+        slots[tail & (capacity - 1)] = item;
+        tailindex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t head = headindex.load(std::memory_order_relaxed);
+        if (head == tailindex.load(std::memory_order_acquire)) return false;
+        item = slots[head & (capacity - 1)];
+        headindex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array<T, capacity> slots;
+    alignas(64) std::atomic<size_t> headindex{ 0 };
+    alignas(64) std::atomic<size_t> tailindex{ 0 };
+};
+
+enum class commandtype { key, resize, scaleparameter };
+enum class waveparameter { amplitude, speed };
+
+// input, resize and parameter changes travel to the simulation as commands and are applied at step boundaries
+struct command {
+    commandtype type = commandtype::key;
+    int a = 0, b = 0;   // key code, framebuffer width and height, or the waveparameter being scaled
+    float value = 0.0f;
+    std::chrono::steady_clock::time_point enqueued;
+};
+
+static spscqueue<command, 256> g_commands;
+static long g_droppedcommands = 0;
+
+void enqueuecommand(commandtype type, int a, int b = 0, float value = 0.0f) {
+    command cmd;
+    cmd.type = type;
+    cmd.a = a;
+    cmd.b = b;
+    cmd.value = value;
+    cmd.enqueued = std::chrono::steady_clock::now();
+    if (!g_commands.push(cmd)) ++g_droppedcommands;
+}
+
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
         glfwSetWindowShouldClose(window, true);
     }
-    // updates global state based on key presses for real-time interaction (exit)
+    if (action != GLFW_PRESS && action != GLFW_REPEAT) return;
+    // arrow keys scale the wave parameters; everything else is forwarded as a raw key for the simulation to interpret
+    switch (key) {
+    case GLFW_KEY_UP:    enqueuecommand(commandtype::scaleparameter, int(waveparameter::amplitude), 0, 1.1f); break;
+    case GLFW_KEY_DOWN:  enqueuecommand(commandtype::scaleparameter, int(waveparameter::amplitude), 0, 1.0f / 1.1f); break;
+    case GLFW_KEY_RIGHT: enqueuecommand(commandtype::scaleparameter, int(waveparameter::speed), 0, 1.1f); break;
+    case GLFW_KEY_LEFT:  enqueuecommand(commandtype::scaleparameter, int(waveparameter::speed), 0, 1.0f / 1.1f); break;
+    default:             enqueuecommand(commandtype::key, key); break;
+    }
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
     if (height == 0) return;
-    glViewport(0, 0, width, height);
-    g_aspect_ratio = float(width) / float(height);
-    // updating the aspect ratio ensures the perspective matrix remains accurate.
+    // the viewport belongs to the gl context on this thread; the aspect ratio belongs to the simulation
+    if (glfwGetCurrentContext()) glViewport(0, 0, width, height);
+    enqueuecommand(commandtype::resize, width, height);
 }
 
-class watervolume {
+// a small pool of worker threads; the main thread keeps the gl context and never runs tasks itself
+class tasksystem {
 public:
-    watervolume(int gw, int gd, float w, float d, float t)
-        : gridwidth(gw), griddepth(gd), width(w), depth(d), thickness(t)
-    {
-        buildmesh();
-        // the mesh is built once upon object creation and then updated each frame.
+    struct task {
+        std::function<void()> work;
+        std::mutex mutex;
+        bool done = false;
+        std::function<void()> oncomplete;
+    };
+
+    explicit tasksystem(unsigned threadcount) {
+        for (unsigned i = 0; i < std::max(threadcount, 1u); ++i) {
+            workers.emplace_back([this] { workerloop(); });
+        }
     }
 
-    // computes water surface as sum of two sine waves; normals computed via finite differences
-    void updatewaves(float time) {
-        float amplitude1 = 0.6f;
-        float amplitude2 = 0.3f;
-        float frequency1 = 0.8f;
-        float frequency2 = 0.6f;
-        float speed1 = 0.3f;
-        float speed2 = 0.2f;
+    ~tasksystem() {
+        {
+            std::lock_guard<std::mutex> lock(queuemutex);
+            stopping = true;
+        }
+        queuecv.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
 
-        glm::vec2 dir1 = glm::normalize(glm::vec2(1.0f, 0.2f));
-        glm::vec2 dir2 = glm::normalize(glm::vec2(0.2f, 1.0f));
+    std::shared_ptr<task> submit(std::function<void()> work) {
+        auto t = std::make_shared<task>();
+        t->work = std::move(work);
+        {
+            std::lock_guard<std::mutex> lock(queuemutex);
+            queue.push_back(t);
+        }
+        queuecv.notify_one();
+        return t;
+    }
 
-        // compute wave heights on the top surface
-        for (int z = 0; z < griddepth; ++z) {
-            for (int x = 0; x < gridwidth; ++x) {
-                int idx = topstart + x + z * gridwidth;
-                float px = vertices[idx].x;
-                float pz = vertices[idx].z;
-                // using the dot product with a direction vector modulates the wave's propagation.
-                float dot1 = glm::dot(dir1, glm::vec2(px - speed1 * time, pz - speed1 * time));
-                float dot2 = glm::dot(dir2, glm::vec2(px - speed2 * time, pz - speed2 * time));
-                float wave1 = amplitude1 * sinf(frequency1 * dot1);
-                float wave2 = amplitude2 * sinf(frequency2 * dot2);
-                vertices[idx].y = wave1 + wave2;
+    // splits [0, count) into chunks of at most grain items and blocks until all of them ran.
+    // maxthreads caps how many threads share the work, counting the caller; zero means all of them.
+    void parallelfor(int count, int grain, const std::function<void(int, int)>& body, int maxthreads = 0) {
+        grain = std::max(grain, 1);
+        int chunks = (count + grain - 1) / grain;
+        int threads = maxthreads > 0 ? std::min(maxthreads, int(workers.size()) + 1) : int(workers.size()) + 1;
+        std::atomic<int> next{ 0 };
+        auto runchunks = [&] {
+            for (int c = next++; c < chunks; c = next++) {
+                body(c * grain, std::min(count, (c + 1) * grain));
             }
+        };
+        std::vector<std::shared_ptr<task>> helpers;
+        for (int i = 1; i < std::min(chunks, threads); ++i) {
+            helpers.push_back(submit(runchunks));
         }
+        // the calling thread works too, so this is safe to call from inside a task
+        runchunks();
+        for (auto& helper : helpers) wait(helper);
+    }
 
-        // update bottom surface by offsetting the top surface by water thickness
-        for (int z = 0; z < griddepth; ++z) {
-            for (int x = 0; x < gridwidth; ++x) {
-                int top_idx = topstart + x + z * gridwidth;
-                int bottom_idx = bottomstart + x + z * gridwidth;
-                vertices[bottom_idx].y = vertices[top_idx].y - thickness;
+    // waits for a task. if no worker has started it yet, the waiting thread takes it off the queue and runs it
+    // itself, so a worker waiting on its own helpers can never starve the pool. nothing else is run here: another
+    // queued task would nest on the waiter's stack, and could re-enter whatever the waiter was in the middle of.
+    void wait(const std::shared_ptr<task>& t) {
+        bool unstarted = false;
+        {
+            std::lock_guard<std::mutex> lock(queuemutex);
+            auto queued = std::find(queue.begin(), queue.end(), t);
+            if (queued != queue.end()) {
+                queue.erase(queued);
+                unstarted = true;
             }
         }
+        if (unstarted) {
+            execute(*t);
+            return;
+        }
+        // execute() takes donemutex between marking the task done and notifying, so the wakeup cannot be missed
+        std::unique_lock<std::mutex> lock(donemutex);
+        donecv.wait(lock, [&] {
+            std::lock_guard<std::mutex> tasklock(t->mutex);
+            return t->done;
+        });
+    }
 
-        // compute normals for top surface using finite differences (approximating partial derivatives)
-        for (int z = 1; z < griddepth - 1; ++z) {
-            for (int x = 1; x < gridwidth - 1; ++x) {
-                int idx = topstart + x + z * gridwidth;
-                float yl = vertices[idx - 1].y;
-                float yr = vertices[idx + 1].y;
-                float yd = vertices[idx - gridwidth].y;
-                float yu = vertices[idx + gridwidth].y;
-                float dx = (yr - yl) * 0.5f;
-                float dz = (yu - yd) * 0.5f;
-                glm::vec3 n = glm::normalize(glm::vec3(-dx, 1.0f, -dz));
-                vertices[idx].nx = n.x;
-                vertices[idx].ny = n.y;
-                vertices[idx].nz = n.z;
+    unsigned threadcount() const { return unsigned(workers.size()); }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::shared_ptr<task>> queue;
+    std::mutex queuemutex;
+    std::condition_variable queuecv;
+    std::mutex donemutex;
+    std::condition_variable donecv;
+    bool stopping = false;
+
+    void workerloop() {
+        for (;;) {
+            std::shared_ptr<task> t;
+            {
+                std::unique_lock<std::mutex> lock(queuemutex);
+                queuecv.wait(lock, [&] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                t = std::move(queue.front());
+                queue.pop_front();
             }
+            execute(*t);
         }
+    }
 
-        // compute normals for bottom surface using a similar finite difference method
-        for (int z = 1; z < griddepth - 1; ++z) {
-            for (int x = 1; x < gridwidth - 1; ++x) {
-                int idx = bottomstart + x + z * gridwidth;
-                float yl = vertices[idx - 1].y;
-                float yr = vertices[idx + 1].y;
-                float yd = vertices[idx - gridwidth].y;
-                float yu = vertices[idx + gridwidth].y;
-                float dx = (yr - yl) * 0.5f;
-                float dz = (yu - yd) * 0.5f;
-                glm::vec3 n = glm::normalize(glm::vec3(dx, -1.0f, dz));
-                vertices[idx].nx = n.x;
-                vertices[idx].ny = n.y;
-                vertices[idx].nz = n.z;
-            }
+    void execute(task& t) {
+        t.work();
+        std::function<void()> oncomplete;
+        {
+            std::lock_guard<std::mutex> lock(t.mutex);
+            t.done = true;
+            oncomplete = std::move(t.oncomplete);
         }
-        // updating normals is crucial for accurate lighting in the fragment shader.
+        {
+            std::lock_guard<std::mutex> lock(donemutex);
+        }
+        donecv.notify_all();
+        if (oncomplete) oncomplete();
     }
+};
 
-    void upload(GLuint vbo) {
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+// machine-dependent kernel choices. the defaults are the exact kernels; the autotuner may pick others.
+struct kernelconfig {
+    int tilerows = 16;  // grid rows per parallel task
+    int threads = 1;    // threads sharing one wave update, counting the calling thread
+    int simd = 0;       // 0 scalar, 1 sse2 four vertices at a time (needs an approximate sine)
+    int sinetier = 0;   // 0 sinf, 1 degree-7 polynomial (~6e-7 error), 2 degree-5 polynomial (~7e-5 error)
+    int upload = 0;     // 0 glBufferSubData, 1 orphan then glBufferSubData, 2 invalidating map
+};
+
+static kernelconfig g_kernel;
+
+// set while replaying: results must not depend on timings, so nothing may be chosen by measuring
+static bool g_deterministic = false;
+
+// odd minimax polynomials for sin on [-pi/2, pi/2], after reducing the argument by multiples of pi.
+// pi is split in two (cody-waite) so the reduction keeps its accuracy for larger arguments.
+template <int sinetier>
+inline float fastsin(float x) {
+    if (sinetier == 0) return sinf(x);
+    float q = std::nearbyint(x * 0.318309886f);
+    float r = (x - q * 3.140625f) - q * 9.67653589793e-4f;
+    float r2 = r * r;
+    float p = sinetier == 1
+        ? r * (0.999996615f + r2 * (-0.166648282f + r2 * (0.00830632322f + r2 * -0.000183635994f)))
+        : r * (0.999696728f + r2 * (-0.165672979f + r2 * 0.00751433598f));
+    return (long long)q & 1 ? -p : p;
+}
+
+#ifdef FLUIDSIM_SSE2
+template <int sinetier>
+inline __m128 fastsin4(__m128 x) {
+    __m128i qi = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.318309886f)));
+    __m128 q = _mm_cvtepi32_ps(qi);
+    __m128 r = _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(q, _mm_set1_ps(3.140625f))), _mm_mul_ps(q, _mm_set1_ps(9.67653589793e-4f)));
+    __m128 r2 = _mm_mul_ps(r, r);
+    __m128 p;
+    if (sinetier == 1) {
+        p = _mm_add_ps(_mm_set1_ps(0.00830632322f), _mm_mul_ps(r2, _mm_set1_ps(-0.000183635994f)));
+        p = _mm_add_ps(_mm_set1_ps(-0.166648282f), _mm_mul_ps(r2, p));
+        p = _mm_add_ps(_mm_set1_ps(0.999996615f), _mm_mul_ps(r2, p));
+    }
+    else {
+        p = _mm_add_ps(_mm_set1_ps(-0.165672979f), _mm_mul_ps(r2, _mm_set1_ps(0.00751433598f)));
+        p = _mm_add_ps(_mm_set1_ps(0.999696728f), _mm_mul_ps(r2, p));
+    }
+    p = _mm_mul_ps(r, p);
+    // odd multiples of pi flip the sign: move the low bit of q into the float sign bit
+    return _mm_xor_ps(p, _mm_castsi128_ps(_mm_slli_epi32(qi, 31)));
+}
+#endif
+
+struct waveparams {
+    float amplitude1 = 0.6f;
+    float amplitude2 = 0.3f;
+    float frequency1 = 0.8f;
+    float frequency2 = 0.6f;
+    float speed1 = 0.3f;
+    float speed2 = 0.2f;
+};
+
+// the part of each wave's phase that moves with time, f * speed * time * (dir.x + dir.y), so that a kernel's phase is
+// f * (dir . p) - offset. it is formed in double from the double time base and wrapped into [0, 2pi) before being
+// rounded, so the sine arguments the kernels see stay as small and as precise after days of uptime as at start-up.
+struct wavephases {
+    float offset1 = 0.0f, offset2 = 0.0f;
+};
+
+inline double wrapphase(double phase) {
+    const double twopi = 6.283185307179586;
+    phase = std::fmod(phase, twopi);
+    return phase < 0.0 ? phase + twopi : phase;
+}
+
+inline wavephases phasesat(const waveparams& waves, double time) {
+    glm::vec2 dir1 = glm::normalize(glm::vec2(1.0f, 0.2f));
+    glm::vec2 dir2 = glm::normalize(glm::vec2(0.2f, 1.0f));
+    return {
+        float(wrapphase(double(waves.frequency1) * waves.speed1 * (double(dir1.x) + dir1.y) * time)),
+        float(wrapphase(double(waves.frequency2) * waves.speed2 * (double(dir2.x) + dir2.y) * time)),
+    };
+}
+
+// copies a vertex array into a buffer using the upload path chosen by the kernel config
+void uploadvertices(GLuint vbo, const std::vector<vertex>& vertices) {
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    GLsizeiptr size = vertices.size() * sizeof(vertex);
+    switch (g_kernel.upload) {
+    case 1:
+        // orphaning hands the driver a fresh allocation instead of making it wait for pending draws
+        glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size, vertices.data());
+        break;
+    case 2:
+        if (void* mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT)) {
+            memcpy(mapped, vertices.data(), size);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            break;
+        }
+        [[fallthrough]];
+    default:
         // glBufferSubData efficiently updates the vertex buffer without reallocating memory.
-        glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(vertex), vertices.data());
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size, vertices.data());
+        break;
     }
+}
 
-    std::vector<vertex> vertices;
-    std::vector<unsigned int> indices;
+// fnv-1a over the raw vertex data; identical surfaces give identical checksums across runs and builds
+unsigned long long checksumvertices(const std::vector<vertex>& vertices) {
+    unsigned long long hash = 14695981039346656037ull;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(vertices.data());
+    for (size_t i = 0; i < vertices.size() * sizeof(vertex); ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
 
-private:
-    int gridwidth, griddepth;
-    int topstart = 0, bottomstart = 0;
-    float width, depth, thickness;
+static double secondssince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
 
-    void buildmesh() {
-        topstart = 0;
-        bottomstart = gridwidth * griddepth;
-        vertices.resize(gridwidth * griddepth * 2);
+// a disturbance dropped into the ripple layer, in grid-relative units so it means the same at any resolution
+struct rippledrop {
+    float u, v;      // centre, 0..1 across the grid
+    float radius;    // fraction of the grid side
+    float strength;  // peak height added
+};
 
-        // compute top surface vertices based on grid coordinates
-        for (int z = 0; z < griddepth; ++z) {
-            for (int x = 0; x < gridwidth; ++x) {
-                int idx = x + z * gridwidth;
-                float fx = static_cast<float>(x) / (gridwidth - 1);
-                float fz = static_cast<float>(z) / (griddepth - 1);
-                float px = fx * width - 0.5f * width;
-                float pz = fz * depth - 0.5f * depth;
-                vertices[topstart + idx] = { px, 0.0f, pz, 0, 1, 0 };
-            }
+// the height a drop adds at cell (x, z) of an n x n grid; shared by the cpu solver and the benchmark check
+inline float dropheight(const rippledrop& drop, int n, int x, int z) {
+    float cx = drop.u * (n - 1), cz = drop.v * (n - 1);
+    float r = std::max(drop.radius * (n - 1), 2.0f);
+    float d2 = ((x - cx) * (x - cx) + (z - cz) * (z - cz)) / (r * r);
+    return d2 < 1.0f ? drop.strength * (1.0f - d2) * (1.0f - d2) : 0.0f;
+}
+
+// implicit diffusion on an n x n grid by alternating directions: one half step solves (1 - r d2/dz2) u' = u down
+// every column, the other (1 - r d2/dx2) u' = u along every row, with the border held at zero. it is stable for any
+// r, so one solve replaces however many explicit substeps r would need. all lines share one constant-coefficient
+// matrix, so the thomas elimination factors are computed once and a sweep only carries the right-hand sides.
+// columns are solved side by side, with neighbouring x as the simd lanes; rows go through a blocked transpose
+// so they can use the same sweep.
+class adisolver {
+public:
+    adisolver(int size, float r) : n(size), lower(r), transposed(size_t(size) * size, 0.0f) {
+        // interior unknowns 1..n-2 with diagonal 1 + 2r and off-diagonals -r
+        inverse.assign(n, 0.0f);
+        upper.assign(n, 0.0f);
+        float cprime = 0.0f;
+        for (int i = 1; i < n - 1; ++i) {
+            float denominator = (1.0f + 2.0f * r) + r * cprime;
+            inverse[i] = 1.0f / denominator;
+            cprime = -r * inverse[i];
+            upper[i] = r * inverse[i];
         }
+        // a unit height spreads along a line as decay^distance, the smaller root of r t^2 - (1 + 2r) t + r
+        double decay = ((1.0 + 2.0 * r) - std::sqrt(1.0 + 4.0 * r)) / (2.0 * r);
+        reach = std::max(1, int(std::ceil(std::log(1e-7) / std::log(decay))));
+    }
 
-        // compute bottom surface vertices by applying a vertical offset
-        for (int z = 0; z < griddepth; ++z) {
-            for (int x = 0; x < gridwidth; ++x) {
-                int idx = x + z * gridwidth;
-                vertices[bottomstart + idx] = {
-                    vertices[topstart + idx].x,
-                    -thickness,
-                    vertices[topstart + idx].z,
-                    0, -1, 0
-                };
+    // both half steps in place, on the task system when one is given
+    void solve(std::vector<float>& field, tasksystem* tasks) { solve(field, tasks, 1, 1, n - 1, n - 1); }
+
+    // both half steps on the interior cells [x0, x1) x [z0, z1) only, as if the window's edge were the border.
+    // cells outside it are taken as zero and left alone.
+    void solve(std::vector<float>& field, tasksystem* tasks, int x0, int z0, int x1, int z1) {
+        auto run = [&](int first, int last, int grain, const std::function<void(int, int)>& body) {
+            if (tasks) {
+                tasks->parallelfor(last - first, grain, [&](int i0, int i1) { body(first + i0, first + i1); });
+            }
+            else {
+                body(first, last);
             }
+        };
+        run(x0, x1, 64, [&](int a, int b) { sweepcolumns(field.data(), a, b, z0, z1); });
+        run(z0, z1, 32, [&](int a, int b) { transpose(field.data(), transposed.data(), a, b, x0, x1); });
+        run(z0, z1, 64, [&](int a, int b) { sweepcolumns(transposed.data(), a, b, x0, x1); });
+        run(x0, x1, 32, [&](int a, int b) { transpose(transposed.data(), field.data(), a, b, z0, z1); });
+        solves += long(x1 - x0) + long(z1 - z0);
+    }
+
+    // the textbook version, one line at a time with the rows walked down their stride; the benchmark's reference
+    void solvescalar(std::vector<float>& field) {
+        for (int x = 1; x < n - 1; ++x) sweepline(field.data() + x, n);
+        for (int z = 1; z < n - 1; ++z) sweepline(field.data() + size_t(z) * n, 1);
+        solves += 2 * long(n - 2);
+    }
+
+    long solves = 0;
+    int reach = 1;  // cells a height travels along a line before falling below 1e-7 of itself
+
+private:
+    int n;
+    float lower;  // r, the off-diagonals' magnitude
+    std::vector<float> inverse, upper;
+    std::vector<float> transposed;
+
+    // forward elimination and back substitution down columns x0..x1 of an n x n grid, over the unknowns in rows
+    // z0..z1, in strips narrow enough that a strip's whole height stays in cache between the two passes
+    void sweepcolumns(float* u, int x0, int x1, int z0, int z1) {
+        const int strip = 64;
+        for (int s = std::max(x0, 1); s < std::min(x1, n - 1); s += strip) {
+            sweepstrip(u, s, std::min({ s + strip, x1, n - 1 }), z0, z1);
         }
+    }
 
-        // build indices for top surface triangles
-        for (int z = 0; z < griddepth - 1; ++z) {
-            for (int x = 0; x < gridwidth - 1; ++x) {
-                int i0 = topstart + (x + z * gridwidth);
-                int i1 = topstart + ((x + 1) + z * gridwidth);
-                int i2 = topstart + (x + (z + 1) * gridwidth);
-                int i3 = topstart + ((x + 1) + (z + 1) * gridwidth);
-                indices.push_back(i0);
-                indices.push_back(i1);
-                indices.push_back(i2);
-                indices.push_back(i1);
-                indices.push_back(i3);
-                indices.push_back(i2);
+    // all columns of the strip at once. the factors only depend on how far down the line a row is, so a line that
+    // starts lower uses the same ones from the top
+    void sweepstrip(float* u, int x0, int x1, int z0, int z1) {
+        for (int z = z0; z < z1; ++z) {
+            float* row = u + size_t(z) * n;
+            const float* above = row - n;
+            float scale = inverse[z - z0 + 1], carry = z > z0 ? lower : 0.0f;
+            int x = x0;
+#ifdef FLUIDSIM_SSE2
+            __m128 vscale = _mm_set1_ps(scale), vcarry = _mm_set1_ps(carry);
+            for (; x + 4 <= x1; x += 4) {
+                __m128 d = _mm_add_ps(_mm_loadu_ps(row + x), _mm_mul_ps(vcarry, _mm_loadu_ps(above + x)));
+                _mm_storeu_ps(row + x, _mm_mul_ps(d, vscale));
+            }
+#endif
+            for (; x < x1; ++x) row[x] = (row[x] + carry * above[x]) * scale;
+        }
+        for (int z = z1 - 2; z >= z0; --z) {
+            float* row = u + size_t(z) * n;
+            const float* below = row + n;
+            float factor = upper[z - z0 + 1];
+            int x = x0;
+#ifdef FLUIDSIM_SSE2
+            __m128 vfactor = _mm_set1_ps(factor);
+            for (; x + 4 <= x1; x += 4) {
+                _mm_storeu_ps(row + x, _mm_add_ps(_mm_loadu_ps(row + x), _mm_mul_ps(vfactor, _mm_loadu_ps(below + x))));
             }
+#endif
+            for (; x < x1; ++x) row[x] += factor * below[x];
         }
+    }
 
-        // build indices for bottom surface triangles
-        for (int z = 0; z < griddepth - 1; ++z) {
-            for (int x = 0; x < gridwidth - 1; ++x) {
-                int i0 = bottomstart + (x + z * gridwidth);
-                int i1 = bottomstart + ((x + 1) + z * gridwidth);
-                int i2 = bottomstart + (x + (z + 1) * gridwidth);
-                int i3 = bottomstart + ((x + 1) + (z + 1) * gridwidth);
-                indices.push_back(i0);
-                indices.push_back(i2);
-                indices.push_back(i1);
-                indices.push_back(i1);
-                indices.push_back(i2);
-                indices.push_back(i3);
+    // one line of interior unknowns starting at u[stride], the same arithmetic as sweepcolumns
+    void sweepline(float* u, size_t stride) {
+        for (int i = 1; i < n - 1; ++i) {
+            float carry = i > 1 ? lower : 0.0f;
+            u[i * stride] = (u[i * stride] + carry * u[(i - 1) * stride]) * inverse[i];
+        }
+        for (int i = n - 3; i >= 1; --i) u[i * stride] += upper[i] * u[(i + 1) * stride];
+    }
+
+    // columns x0..x1 of rows z0..z1 of src become rows of dst, in tiles small enough that both sides stay in cache
+    void transpose(const float* src, float* dst, int z0, int z1, int x0, int x1) {
+        const int tile = 32;
+        for (int zt = z0; zt < z1; zt += tile) {
+            int ze = std::min(zt + tile, z1);
+            for (int xt = x0; xt < x1; xt += tile) {
+                int xe = std::min(xt + tile, x1);
+                int z = zt;
+#ifdef FLUIDSIM_SSE2
+                // whole 4x4 blocks through registers, the ragged edges below one float at a time
+                for (; z + 4 <= ze; z += 4) {
+                    int x = xt;
+                    for (; x + 4 <= xe; x += 4) {
+                        const float* in = src + x + size_t(z) * n;
+                        __m128 r0 = _mm_loadu_ps(in), r1 = _mm_loadu_ps(in + n);
+                        __m128 r2 = _mm_loadu_ps(in + 2 * size_t(n)), r3 = _mm_loadu_ps(in + 3 * size_t(n));
+                        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                        float* out = dst + z + size_t(x) * n;
+                        _mm_storeu_ps(out, r0);
+                        _mm_storeu_ps(out + n, r1);
+                        _mm_storeu_ps(out + 2 * size_t(n), r2);
+                        _mm_storeu_ps(out + 3 * size_t(n), r3);
+                    }
+                    for (; x < xe; ++x) {
+                        for (int k = 0; k < 4; ++k) dst[z + k + size_t(x) * n] = src[x + size_t(z + k) * n];
+                    }
+                }
+#endif
+                for (; z < ze; ++z) {
+                    for (int x = xt; x < xe; ++x) dst[z + size_t(x) * n] = src[x + size_t(z) * n];
+                }
             }
         }
+    }
+};
 
-        auto addsidequad = [&](int topa, int topb, int bottoma, int bottomb) {
-            indices.push_back(topa);
-            indices.push_back(topb);
-            indices.push_back(bottoma);
-            indices.push_back(topb);
-            indices.push_back(bottomb);
-            indices.push_back(bottoma);
-            };
+enum class advectscheme { firstorder, maccormack, bfecc };
+static const char* advectschemenames[] = { "first", "maccormack", "bfecc" };
 
-        // build left side face indices
-        for (int z = 0; z < griddepth - 1; ++z) {
-            int topa = topstart + (0 + z * gridwidth);
-            int topb = topstart + (0 + (z + 1) * gridwidth);
-            int bottoma = bottomstart + (0 + z * gridwidth);
-            int bottomb = bottomstart + (0 + (z + 1) * gridwidth);
-            addsidequad(topa, topb, bottoma, bottomb);
+inline bool parseadvectscheme(const std::string& name, advectscheme& scheme) {
+    for (int i = 0; i < 3; ++i) {
+        if (name == advectschemenames[i]) {
+            scheme = advectscheme(i);
+            return true;
         }
+    }
+    return false;
+}
 
-        // build right side face indices
-        for (int z = 0; z < griddepth - 1; ++z) {
-            int topa = topstart + ((gridwidth - 1) + z * gridwidth);
-            int topb = topstart + ((gridwidth - 1) + (z + 1) * gridwidth);
-            int bottoma = bottomstart + ((gridwidth - 1) + z * gridwidth);
-            int bottomb = bottomstart + ((gridwidth - 1) + (z + 1) * gridwidth);
-            indices.push_back(topb);
-            indices.push_back(topa);
-            indices.push_back(bottomb);
-            indices.push_back(topa);
-            indices.push_back(bottoma);
-            indices.push_back(bottomb);
+// a steady eddy around the centre of an n x n grid in cells per step, fastest halfway out and still at the centre,
+// at the border and beyond it
+inline glm::vec2 swirlflow(int n, float speed, int x, int z) {
+    float half = 0.5f * (n - 1);
+    float dx = x - half, dz = z - half;
+    float r = std::sqrt(dx * dx + dz * dz);
+    if (r == 0.0f || r >= half) return glm::vec2(0.0f);
+    float s = speed * std::sin(3.14159265f * r / half);
+    return glm::vec2(-dz, dx) * (s / r);
+}
+
+// semi-lagrangian advection of a scalar on an n x n grid through a steady flow given in cells per step, with the
+// border held at zero. each interior cell traces back along the flow and takes the bilinear sample there. the flow
+// never changes, so the traces are worked out once: each cell's top-left source corner and its two weights, grouped
+// by destination block and sorted by source within a block, so a block's gathers walk through memory in order.
+// maccormack and bfecc also trace forward to estimate the first-order error and cancel half of it, and clamp the
+// result to the four samples the first-order step took, so the correction cannot overshoot. the last pass writes
+// a scratch field that is then swapped with the input. the flow must stay within one cell per step, which keeps
+// everything a step touches within a few cells of where the field was nonzero.
+class advector {
+public:
+    advector(int size, int block, const std::function<glm::vec2(int, int)>& flow)
+        : n(size), blocksize(block), blocks((size + block - 1) / block), written(size_t(blocks) * blocks, 0),
+          now(size_t(blocks) * blocks, 0), first(size_t(size) * size, 0.0f), second(size_t(size) * size, 0.0f),
+          out(size_t(size) * size, 0.0f) {
+        back = buildtrace(flow, 1.0f);
+        ahead = buildtrace(flow, -1.0f);
+    }
+
+    // advects the field, writing only the listed blocks. the field must be zero outside them and within a few cells
+    // of their edges, which holds when they cover every nonzero block and its neighbours. the field's storage is
+    // exchanged with a scratch one, so pointers into it do not survive the call.
+    void advect(std::vector<float>& field, advectscheme scheme, const std::vector<int>& list, tasksystem* tasks) {
+        // the scratch fields are read a little past the listed blocks, where they must be zero like the field
+        std::fill(now.begin(), now.end(), 0);
+        for (int b : list) now[b] = 1;
+        for (int b = 0; b < blocks * blocks; ++b) {
+            if (!written[b] || now[b]) continue;
+            int x0 = (b % blocks) * blocksize, z0 = (b / blocks) * blocksize;
+            int x1 = std::min(x0 + blocksize, n), z1 = std::min(z0 + blocksize, n);
+            for (int z = z0; z < z1; ++z) {
+                std::fill(first.data() + x0 + size_t(z) * n, first.data() + x1 + size_t(z) * n, 0.0f);
+                std::fill(second.data() + x0 + size_t(z) * n, second.data() + x1 + size_t(z) * n, 0.0f);
+                std::fill(out.data() + x0 + size_t(z) * n, out.data() + x1 + size_t(z) * n, 0.0f);
+            }
         }
+        written = now;
 
-        // build front side face indices
-        for (int x = 0; x < gridwidth - 1; ++x) {
-            int topa = topstart + (x + 0 * gridwidth);
-            int topb = topstart + ((x + 1) + 0 * gridwidth);
-            int bottoma = bottomstart + (x + 0 * gridwidth);
-            int bottomb = bottomstart + ((x + 1) + 0 * gridwidth);
-            indices.push_back(topb);
-            indices.push_back(topa);
-            indices.push_back(bottomb);
-            indices.push_back(topa);
-            indices.push_back(bottoma);
-            indices.push_back(bottomb);
+        auto run = [&](const std::function<void(int)>& body) {
+            auto blocksof = [&](int i0, int i1) {
+                for (int i = i0; i < i1; ++i) body(list[i]);
+            };
+            if (tasks) {
+                tasks->parallelfor(int(list.size()), 4, blocksof);
+            }
+            else {
+                blocksof(0, int(list.size()));
+            }
+        };
+        const float* u = field.data();
+        switch (scheme) {
+        case advectscheme::firstorder:
+            run([&](int b) { pass<plain>(back, u, out.data(), b); });
+            break;
+        case advectscheme::maccormack:
+            // first = forward(u), second = backward(first), out = first + (u - second) / 2 within u's range
+            run([&](int b) { pass<plain>(back, u, first.data(), b); });
+            run([&](int b) { pass<plain>(ahead, first.data(), second.data(), b); });
+            run([&](int b) { pass<corrected>(back, u, out.data(), b); });
+            break;
+        case advectscheme::bfecc:
+            // the same error estimate applied before a last forward step instead of after it
+            run([&](int b) { pass<plain>(back, u, first.data(), b); });
+            run([&](int b) { pass<plain>(ahead, first.data(), second.data(), b); });
+            run([&](int b) {
+                for (int i = back.offsets[b]; i < back.offsets[b + 1]; ++i) {
+                    int c = back.target[i];
+                    second[c] = u[c] + 0.5f * (u[c] - second[c]);
+                }
+            });
+            run([&](int b) { pass<limited>(back, second.data(), out.data(), b, u); });
+            break;
         }
+        field.swap(out);
+        cells += countcells(list);
+    }
 
-        // build back side face indices
-        for (int x = 0; x < gridwidth - 1; ++x) {
-            int topa = topstart + (x + (griddepth - 1) * gridwidth);
-            int topb = topstart + ((x + 1) + (griddepth - 1) * gridwidth);
-            int bottoma = bottomstart + (x + (griddepth - 1) * gridwidth);
-            int bottomb = bottomstart + ((x + 1) + (griddepth - 1) * gridwidth);
-            addsidequad(topa, topb, bottoma, bottomb);
+    long cells = 0;  // cells advected so far
+
+private:
+    // the back-traces of every interior cell, block by block: target is the cell written, source the top-left
+    // corner of the bilinear sample and wx, wz its weights
+    struct trace {
+        std::vector<int> offsets;  // where each block's entries start, plus one past the end
+        std::vector<int> target, source;
+        std::vector<float> wx, wz;
+    };
+
+    enum passmode { plain, corrected, limited };
+
+    int n, blocksize, blocks;
+    trace back, ahead;
+    std::vector<unsigned char> written, now;
+    std::vector<float> first, second, out;
+
+    trace buildtrace(const std::function<glm::vec2(int, int)>& flow, float direction) {
+        trace t;
+        struct entry {
+            int target, source;
+            float wx, wz;
+        };
+        std::vector<entry> entries;
+        for (int b = 0; b < blocks * blocks; ++b) {
+            t.offsets.push_back(int(t.target.size()));
+            int x0 = (b % blocks) * blocksize, z0 = (b / blocks) * blocksize;
+            int x1 = std::min(x0 + blocksize, n), z1 = std::min(z0 + blocksize, n);
+            entries.clear();
+            for (int z = std::max(z0, 1); z < std::min(z1, n - 1); ++z) {
+                for (int x = std::max(x0, 1); x < std::min(x1, n - 1); ++x) {
+                    glm::vec2 v = flow(x, z) * direction;
+                    float fx = std::clamp(x - v.x, 0.0f, float(n - 1)), fz = std::clamp(z - v.y, 0.0f, float(n - 1));
+                    int sx = std::min(int(fx), n - 2), sz = std::min(int(fz), n - 2);
+                    entries.push_back({ x + z * n, sx + sz * n, fx - sx, fz - sz });
+                }
+            }
+            std::stable_sort(entries.begin(), entries.end(), [](const entry& a, const entry& b) { return a.source < b.source; });
+            for (const entry& e : entries) {
+                t.target.push_back(e.target);
+                t.source.push_back(e.source);
+                t.wx.push_back(e.wx);
+                t.wz.push_back(e.wz);
+            }
         }
-        // building the indices correctly is essential for the gpu to draw the mesh properly.
+        t.offsets.push_back(int(t.target.size()));
+        return t;
     }
-};
 
-static const char* vertex_shader_source = R"(
-#version 330 core
-layout(location = 0) in vec3 aPos;
-layout(location = 1) in vec3 aNormal;
-uniform mat4 uModel;
+    // one bilinear gather per entry of block b, from src into dst. corrected instead writes the maccormack
+    // estimate, clamped to the range of the corners gathered from src; limited clamps the sample to the range of
+    // the same corners in limit.
+    template <passmode mode>
+    void pass(const trace& t, const float* src, float* dst, int b, const float* limit = nullptr) {
+        const float* range = mode == limited ? limit : src;
+        int i = t.offsets[b], end = t.offsets[b + 1];
+#ifdef FLUIDSIM_SSE2
+        // sse2 has no gather: the corners are loaded a lane at a time and everything after that runs four wide
+        auto corners = [&](const float* f, const int* s, __m128& c00, __m128& c10, __m128& c01, __m128& c11) {
+            c00 = _mm_setr_ps(f[s[0]], f[s[1]], f[s[2]], f[s[3]]);
+            c10 = _mm_setr_ps(f[s[0] + 1], f[s[1] + 1], f[s[2] + 1], f[s[3] + 1]);
+            c01 = _mm_setr_ps(f[s[0] + n], f[s[1] + n], f[s[2] + n], f[s[3] + n]);
+            c11 = _mm_setr_ps(f[s[0] + n + 1], f[s[1] + n + 1], f[s[2] + n + 1], f[s[3] + n + 1]);
+        };
+        for (; i + 4 <= end; i += 4) {
+            const int* s = &t.source[i];
+            const int* c = &t.target[i];
+            __m128 c00, c10, c01, c11, value;
+            corners(src, s, c00, c10, c01, c11);
+            if (mode == corrected) {
+                __m128 here = _mm_setr_ps(src[c[0]], src[c[1]], src[c[2]], src[c[3]]);
+                __m128 ahead = _mm_setr_ps(first[c[0]], first[c[1]], first[c[2]], first[c[3]]);
+                __m128 behind = _mm_setr_ps(second[c[0]], second[c[1]], second[c[2]], second[c[3]]);
+                value = _mm_add_ps(ahead, _mm_mul_ps(_mm_set1_ps(0.5f), _mm_sub_ps(here, behind)));
+            }
+            else {
+                __m128 wx = _mm_loadu_ps(&t.wx[i]), wz = _mm_loadu_ps(&t.wz[i]);
+                __m128 top = _mm_add_ps(c00, _mm_mul_ps(wx, _mm_sub_ps(c10, c00)));
+                __m128 bottom = _mm_add_ps(c01, _mm_mul_ps(wx, _mm_sub_ps(c11, c01)));
+                value = _mm_add_ps(top, _mm_mul_ps(wz, _mm_sub_ps(bottom, top)));
+            }
+            if (mode == limited) corners(range, s, c00, c10, c01, c11);
+            if (mode != plain) {
+                __m128 low = _mm_min_ps(_mm_min_ps(c00, c10), _mm_min_ps(c01, c11));
+                __m128 high = _mm_max_ps(_mm_max_ps(c00, c10), _mm_max_ps(c01, c11));
+                value = _mm_min_ps(_mm_max_ps(value, low), high);
+            }
+            alignas(16) float result[4];
+            _mm_store_ps(result, value);
+            for (int k = 0; k < 4; ++k) dst[c[k]] = result[k];
+        }
+#endif
+        for (; i < end; ++i) {
+            const float* s = src + t.source[i];
+            int c = t.target[i];
+            float value;
+            if (mode == corrected) {
+                value = first[c] + 0.5f * (src[c] - second[c]);
+            }
+            else {
+                float top = s[0] + t.wx[i] * (s[1] - s[0]);
+                float bottom = s[n] + t.wx[i] * (s[n + 1] - s[n]);
+                value = top + t.wz[i] * (bottom - top);
+            }
+            if (mode != plain) {
+                const float* r = range + t.source[i];
+                float low = std::min(std::min(r[0], r[1]), std::min(r[n], r[n + 1]));
+                float high = std::max(std::max(r[0], r[1]), std::max(r[n], r[n + 1]));
+                value = std::min(std::max(value, low), high);
+            }
+            dst[c] = value;
+        }
+    }
+
+    long countcells(const std::vector<int>& list) const {
+        long count = 0;
+        for (int b : list) count += back.offsets[b + 1] - back.offsets[b];
+        return count;
+    }
+};
+
+// iwave's vertical derivative (tessendorf, "interactive water surfaces"): a radially symmetric 13x13 kernel,
+// G(r) = sum over q of q^2 exp(-q^2) J0(q r), scaled to 1 at the centre, convolved with the heights. applied
+// directly that is 169 multiply-adds per cell. the kernel is a symmetric matrix, so its eigenvectors split it into
+// separable terms lambda v v^T, each a 13-tap pass along the rows and another down the columns, and its spectrum
+// falls off so fast that two or three terms carry all of it. the heights are copied into a zero-padded field first,
+// so neither version needs edge checks, and both run four neighbouring cells at a time in sse2.
+class iwavekernel {
+public:
+    static constexpr int radius = 6, taps = 2 * radius + 1, maxrank = 4;
+
+    // terms 0 convolves directly
+    iwavekernel(int size, int terms)
+        : n(size), m(size + 2 * radius), rank(std::clamp(terms, 0, maxrank)), padded(size_t(m) * m, 0.0f) {
+        double samples[taps][taps], vectors[taps][taps];
+        double centre = radial(0.0);
+        // by squared distance, each worked out the first time a tap needs it
+        std::vector<double> byradius(2 * radius * radius + 1, -1e30);
+        for (int i = 0; i < taps; ++i) {
+            for (int j = 0; j < taps; ++j) {
+                int d = (i - radius) * (i - radius) + (j - radius) * (j - radius);
+                if (byradius[d] == -1e30) byradius[d] = radial(std::sqrt(double(d))) / centre;
+                samples[i][j] = byradius[d];
+                kernel[i][j] = float(samples[i][j]);
+            }
+        }
+        double values[taps];
+        symmetriceigen(samples, values, vectors);
+        int order[taps];
+        for (int i = 0; i < taps; ++i) order[i] = i;
+        std::sort(order, order + taps, [&](int a, int b) { return std::abs(values[a]) > std::abs(values[b]); });
+        double total = 0.0;
+        for (int i = 0; i < taps; ++i) total += values[i] * values[i];
+        double kept = 0.0;
+        for (int k = 0; k < maxrank; ++k) {
+            eigenvalues[k] = values[order[k]];
+            kept += values[order[k]] * values[order[k]];
+            captured[k] = std::sqrt(kept / total);
+            for (int i = 0; i < taps; ++i) {
+                along[k][i] = float(vectors[i][order[k]]);
+                down[k][i] = float(values[order[k]] * vectors[i][order[k]]);
+#ifdef FLUIDSIM_SSE2
+                std::fill_n(along4[k][i], 4, along[k][i]);
+                std::fill_n(down4[k][i], 4, down[k][i]);
+#endif
+            }
+        }
+    }
+
+    // out = G * h at the configured rank
+    void apply(const std::vector<float>& h, std::vector<float>& out, tasksystem* tasks) {
+        auto start = std::chrono::steady_clock::now();
+        if (rank == 0) {
+            direct(h, out, tasks);
+        }
+        else {
+            separable(h, out, tasks, rank);
+        }
+        seconds += secondssince(start);
+        ++applications;
+    }
+
+    void direct(const std::vector<float>& h, std::vector<float>& out, tasksystem* tasks) {
+        pad(h, tasks);
+        run(tasks, n, [&](int z0, int z1) {
+            for (int z = z0; z < z1; ++z) {
+                float* o = &out[size_t(z) * n];
+                int x = 0;
+#ifdef FLUIDSIM_SSE2
+                for (; x + 4 <= n; x += 4) {
+                    __m128 sum = _mm_setzero_ps();
+                    for (int j = 0; j < taps; ++j) {
+                        const float* p = &padded[x + size_t(z + j) * m];
+                        for (int i = 0; i < taps; ++i) sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(kernel[j][i]), _mm_loadu_ps(p + i)));
+                    }
+                    _mm_storeu_ps(o + x, sum);
+                }
+#endif
+                for (; x < n; ++x) {
+                    float sum = 0.0f;
+                    for (int j = 0; j < taps; ++j) {
+                        const float* p = &padded[x + size_t(z + j) * m];
+                        for (int i = 0; i < taps; ++i) sum += kernel[j][i] * p[i];
+                    }
+                    o[x] = sum;
+                }
+            }
+        });
+    }
+
+    // in tiles of bandrows x bandcolumns outputs: the row passes of every term cover the tile's rows plus the 12
+    // around them and go into a buffer small enough to stay in cache for the column passes that follow. each worker
+    // has its own buffer and claims tiles until none are left.
+    void separable(const std::vector<float>& h, std::vector<float>& out, tasksystem* tasks, int terms) {
+        terms = std::clamp(terms, 1, maxrank);
+        pad(h, tasks);
+        int across = (n + bandcolumns - 1) / bandcolumns, tiles = across * ((n + bandrows - 1) / bandrows);
+        int workers = tasks ? int(tasks->threadcount()) + 1 : 1;
+        size_t bandfloats = maxrank * termfloats;
+        if (bands.size() < workers * bandfloats) bands.assign(workers * bandfloats, 0.0f);
+        std::atomic<int> next{ 0 };
+        auto worker = [&](int w0, int w1) {
+            for (int w = w0; w < w1; ++w) {
+                for (int t = next++; t < tiles; t = next++) {
+                    int z0 = (t / across) * bandrows, x0 = (t % across) * bandcolumns;
+                    int z1 = std::min(z0 + bandrows, n), x1 = std::min(x0 + bandcolumns, n);
+                    float* band = &bands[w * bandfloats];
+                    switch (terms) {
+                    case 1: separabletile<1>(out, band, z0, z1, x0, x1); break;
+                    case 2: separabletile<2>(out, band, z0, z1, x0, x1); break;
+                    case 3: separabletile<3>(out, band, z0, z1, x0, x1); break;
+                    default: separabletile<4>(out, band, z0, z1, x0, x1); break;
+                    }
+                }
+            }
+        };
+        if (tasks) {
+            tasks->parallelfor(workers, 1, worker);
+        }
+        else {
+            worker(0, 1);
+        }
+    }
+
+    int terms() const { return rank; }
+    double eigenvalue(int k) const { return eigenvalues[k]; }
+    // the share of the kernel's norm the first k + 1 terms hold
+    double share(int k) const { return captured[k]; }
+
+    double seconds = 0;
+    long applications = 0;
+
+private:
+    int n, m, rank;
+    float kernel[taps][taps];
+    float along[maxrank][taps], down[maxrank][taps];  // down carries the eigenvalue
+#ifdef FLUIDSIM_SSE2
+    // the same weights already broadcast, so the inner loops multiply straight from memory
+    alignas(16) float along4[maxrank][taps][4], down4[maxrank][taps][4];
+#endif
+    double eigenvalues[maxrank], captured[maxrank];
+    std::vector<float> padded, bands;
+
+    static constexpr int bandrows = 32, bandcolumns = 256;
+    // one term's rows, plus a little so the terms do not sit a multiple of 4kb apart and alias in the store buffer
+    static constexpr size_t termfloats = size_t(bandrows + 2 * radius) * bandcolumns + 64;
+
+    // band holds each term's row pass over padded rows z0..z1 + 12, columns x0..x1, bandcolumns apart
+    template <int terms>
+    void separabletile(std::vector<float>& out, float* band, int z0, int z1, int x0, int x1) {
+        auto line = [&](int k, int r) { return band + k * termfloats + size_t(r) * bandcolumns; };
+        for (int r = 0; r < z1 - z0 + 2 * radius; ++r) {
+            const float* p = &padded[size_t(z0 + r) * m];
+            int x = x0;
+#ifdef FLUIDSIM_SSE2
+            for (; x + 4 <= x1; x += 4) {
+                // a term at a time keeps one accumulator in a register; the 16 inputs stay in l1 between terms
+                for (int k = 0; k < terms; ++k) {
+                    __m128 sum = _mm_setzero_ps();
+                    for (int i = 0; i < taps; ++i) sum = _mm_add_ps(sum, _mm_mul_ps(_mm_load_ps(along4[k][i]), _mm_loadu_ps(p + x + i)));
+                    _mm_storeu_ps(line(k, r) + x - x0, sum);
+                }
+            }
+#endif
+            for (; x < x1; ++x) {
+                for (int k = 0; k < terms; ++k) {
+                    float sum = 0.0f;
+                    for (int i = 0; i < taps; ++i) sum += along[k][i] * p[x + i];
+                    line(k, r)[x - x0] = sum;
+                }
+            }
+        }
+        for (int z = z0; z < z1; ++z) {
+            float* o = &out[size_t(z) * n];
+            int x = x0;
+#ifdef FLUIDSIM_SSE2
+            for (; x + 4 <= x1; x += 4) {
+                __m128 sum = _mm_setzero_ps();
+                for (int k = 0; k < terms; ++k) {
+                    for (int j = 0; j < taps; ++j) sum = _mm_add_ps(sum, _mm_mul_ps(_mm_load_ps(down4[k][j]), _mm_loadu_ps(line(k, z - z0 + j) + x - x0)));
+                }
+                _mm_storeu_ps(o + x, sum);
+            }
+#endif
+            for (; x < x1; ++x) {
+                float sum = 0.0f;
+                for (int k = 0; k < terms; ++k) {
+                    for (int j = 0; j < taps; ++j) sum += down[k][j] * line(k, z - z0 + j)[x - x0];
+                }
+                o[x] = sum;
+            }
+        }
+    }
+
+    void pad(const std::vector<float>& h, tasksystem* tasks) {
+        run(tasks, n, [&](int z0, int z1) {
+            for (int z = z0; z < z1; ++z) std::copy_n(&h[size_t(z) * n], n, &padded[radius + size_t(z + radius) * m]);
+        });
+    }
+
+    static void run(tasksystem* tasks, int count, const std::function<void(int, int)>& body) {
+        if (tasks) {
+            tasks->parallelfor(count, 16, body);
+        }
+        else {
+            body(0, count);
+        }
+    }
+
+    // the bessel function's integral form by the midpoint rule, which converges fast on a periodic integrand;
+    // 128 points are plenty for the arguments below 60 the kernel needs
+    static double besselj0(double x) {
+        const int points = 128;
+        double sum = 0.0;
+        for (int i = 0; i < points; ++i) sum += std::cos(x * std::sin(3.14159265358979 * (i + 0.5) / points));
+        return sum / points;
+    }
+
+    static double radial(double r) {
+        const double dq = 0.005;
+        double sum = 0.0;
+        for (double q = 0.5 * dq; q < 6.0; q += dq) sum += q * q * std::exp(-q * q) * besselj0(q * r);
+        return sum * dq;
+    }
+
+    // cyclic jacobi rotations until the off-diagonal vanishes; the columns of vectors are the eigenvectors
+    static void symmetriceigen(double a[taps][taps], double values[taps], double vectors[taps][taps]) {
+        for (int i = 0; i < taps; ++i) {
+            for (int j = 0; j < taps; ++j) vectors[i][j] = i == j ? 1.0 : 0.0;
+        }
+        for (int sweep = 0; sweep < 50; ++sweep) {
+            double off = 0.0;
+            for (int p = 0; p < taps; ++p) {
+                for (int q = p + 1; q < taps; ++q) off += a[p][q] * a[p][q];
+            }
+            if (off < 1e-30) break;
+            for (int p = 0; p < taps; ++p) {
+                for (int q = p + 1; q < taps; ++q) {
+                    if (a[p][q] == 0.0) continue;
+                    double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+                    double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+                    double c = 1.0 / std::sqrt(t * t + 1.0), s = t * c;
+                    for (int k = 0; k < taps; ++k) {
+                        double kp = a[k][p], kq = a[k][q];
+                        a[k][p] = c * kp - s * kq;
+                        a[k][q] = s * kp + c * kq;
+                    }
+                    for (int k = 0; k < taps; ++k) {
+                        double pk = a[p][k], qk = a[q][k];
+                        a[p][k] = c * pk - s * qk;
+                        a[q][k] = s * pk + c * qk;
+                    }
+                    for (int k = 0; k < taps; ++k) {
+                        double kp = vectors[k][p], kq = vectors[k][q];
+                        vectors[k][p] = c * kp - s * kq;
+                        vectors[k][q] = s * kp + c * kq;
+                    }
+                }
+            }
+        }
+        for (int i = 0; i < taps; ++i) values[i] = a[i][i];
+    }
+};
+
+// the factor an absorbing border band of width cells multiplies both ripple fields by each step, d cells in from the
+// edge: cerjan's sponge, a gaussian taper so gentle that the band itself barely reflects. the gpu shader repeats it.
+constexpr float spongestrength = 0.3f;
+inline float spongefactor(int d, int width) {
+    float t = spongestrength * float(width - d) / float(width);
+    return std::exp(-t * t);
+}
+
+// the interactive ripple layer: the 2d wave equation on a square grid of heights, stepped once per simulation
+// step and added on top of the analytic waves. the border is held at zero, so ripples reflect off the edges.
+// the grid is split into square blocks and only blocks near a disturbance are stepped, so the cost follows how much
+// of the water is moving rather than the grid size. a block whose heights have all decayed below calm is cleared to
+// exact zeros and skipped until a neighbour disturbs it again; heights that small are far below anything visible.
+// with dispersion set it takes iwave's update instead, whose 13-cell kernel reaches every block, so it steps them all.
+// a sponge band along the border absorbs ripples instead, as if the water went on past the edge.
+class ripplegrid {
+public:
+    static constexpr float coupling = 0.25f;  // (c dt / dx)^2, inside the 0.5 stability limit of the explicit scheme
+    static constexpr float damping = 0.995f;
+    static constexpr int blocksize = 16;
+    static constexpr float calm = 1e-5f;      // heights below this are cleared once a whole block is this still
+    static constexpr float iwavegravity = 9.8f * 0.03f * 0.03f;  // g dt^2 for tessendorf's dt of 0.03
+    static constexpr float iwavedamping = 0.3f * 0.03f;          // alpha dt
+    static constexpr float iwaveflush = 1e-9f;  // iwave heights below this are zeroed, far below calm
+
+    explicit ripplegrid(int size)
+        : current(size_t(size) * size, 0.0f), previous(size_t(size) * size, 0.0f), n(size),
+          blocks((size + blocksize - 1) / blocksize), active(size_t(blocks) * blocks, 0), still(size_t(blocks) * blocks, 0) {}
+
+    // adds the drop to the current heights only, which gives it an initial velocity
+    void drop(const rippledrop& d) {
+        for (int z = 0; z < n; ++z) {
+            for (int x = 0; x < n; ++x) {
+                float h = dropheight(d, n, x, z);
+                if (h == 0.0f) continue;
+                current[x + z * n] += h;
+                active[x / blocksize + (z / blocksize) * blocks] = 1;
+            }
+        }
+    }
+
+    // one step of whichever update is set, timed for the exit report
+    void step() {
+        auto start = std::chrono::steady_clock::now();
+        advance();
+        steptime += secondssince(start);
+    }
+
+    // leapfrog update: the previous heights are overwritten by the next ones, then the two swap roles
+    void advance() {
+        if (dispersion) {
+            stepiwave();
+            current.swap(previous);
+            steppedblocks += long(blocks) * blocks;
+            ++steps;
+            absorb();
+            drift();
+            diffuse();
+            obstruct();
+            return;
+        }
+        if (!adaptive) {
+            auto rows = [&](int z0, int z1) { steprows<false>(z0, z1, 0, n); };
+            if (tasks) {
+                tasks->parallelfor(n, 16, rows);
+            }
+            else {
+                rows(0, n);
+            }
+            current.swap(previous);
+            steppedblocks += long(blocks) * blocks;
+            ++steps;
+            absorb();
+            drift();
+            diffuse();
+            obstruct();
+            return;
+        }
+
+        // the stencil moves energy one cell per step, so the neighbours of an active block are stepped too
+        nearblocks(stepped);
+        auto sweep = [&](int i0, int i1) {
+            for (int i = i0; i < i1; ++i) {
+                int b = stepped[i];
+                int x0 = (b % blocks) * blocksize, z0 = (b / blocks) * blocksize;
+                int x1 = std::min(x0 + blocksize, n), z1 = std::min(z0 + blocksize, n);
+                still[b] = steprows<true>(z0, z1, x0, x1) < calm;
+            }
+        };
+        if (tasks) {
+            tasks->parallelfor(int(stepped.size()), 4, sweep);
+        }
+        else {
+            sweep(0, int(stepped.size()));
+        }
+        current.swap(previous);
+
+        // cleared only now, since neighbouring blocks read this one's heights while stepping
+        for (int b : stepped) {
+            active[b] = !still[b];
+            if (active[b]) continue;
+            int x0 = (b % blocks) * blocksize, z0 = (b / blocks) * blocksize;
+            int x1 = std::min(x0 + blocksize, n), z1 = std::min(z0 + blocksize, n);
+            for (int z = z0; z < z1; ++z) {
+                std::fill(current.data() + x0 + size_t(z) * n, current.data() + x1 + size_t(z) * n, 0.0f);
+                std::fill(previous.data() + x0 + size_t(z) * n, previous.data() + x1 + size_t(z) * n, 0.0f);
+            }
+        }
+        steppedblocks += long(stepped.size());
+        ++steps;
+        absorb();
+        drift();
+        diffuse();
+        obstruct();
+    }
+
+    // r is the implicit diffusion number per step; 0 turns the viscosity off
+    void setviscosity(float r) {
+        viscosity = r;
+        diffusion = r > 0.0f ? std::make_unique<adisolver>(n, r) : nullptr;
+    }
+
+    // switches to iwave's dispersive update, with its kernel split into that many separable terms or applied
+    // directly for 0; negative keeps the plain wave equation
+    void setdispersion(int terms) {
+        dispersion = nullptr;
+        if (terms < 0) return;
+        dispersion = std::make_unique<iwavekernel>(n, terms);
+        derivative.assign(size_t(n) * n, 0.0f);
+        adaptive = false;
+    }
+
+    // damps a band of width cells along the border; 0 keeps the hard, reflecting edge
+    void setsponge(int width) {
+        sponge.clear();
+        spongeblocks.clear();
+        width = std::clamp(width, 0, n / 2 - 1);
+        for (int d = 0; d < width; ++d) sponge.push_back(spongefactor(d, width));
+        for (int b = 0; width > 0 && b < blocks * blocks; ++b) {
+            int x0 = (b % blocks) * blocksize, z0 = (b / blocks) * blocksize;
+            int x1 = std::min(x0 + blocksize, n), z1 = std::min(z0 + blocksize, n);
+            if (x0 < width || z0 < width || x1 > n - width || z1 > n - width) spongeblocks.push_back(b);
+        }
+    }
+
+    // holds a round pillar of that radius, as a fraction of the grid, at zero in the middle of the layer
+    void setobstacle(float radius) {
+        blocked.clear();
+        float r = radius * (n - 1), c = 0.5f * (n - 1);
+        for (int z = 0; z < n; ++z) {
+            for (int x = 0; x < n; ++x) {
+                if ((x - c) * (x - c) + (z - c) * (z - c) < r * r) blocked.push_back(x + z * n);
+            }
+        }
+    }
+
+    // carries the ripples around a steady eddy turning at up to speed cells per step; 0 turns the current off
+    void setcurrent(float speed, advectscheme s) {
+        currentspeed = std::clamp(speed, -1.0f, 1.0f);
+        scheme = s;
+        flow = nullptr;
+        if (currentspeed == 0.0f) return;
+        int size = n;
+        float v = currentspeed;
+        flow = std::make_unique<advector>(n, blocksize, [=](int x, int z) { return swirlflow(size, v, x, z); });
+    }
+
+    // bilinear height at (u, v) in 0..1 across the grid
+    float sample(float u, float v) const {
+        float fx = std::clamp(u, 0.0f, 1.0f) * (n - 1), fz = std::clamp(v, 0.0f, 1.0f) * (n - 1);
+        int x = std::min(int(fx), n - 2), z = std::min(int(fz), n - 2);
+        float tx = fx - x, tz = fz - z;
+        const float* c = &current[x + size_t(z) * n];
+        return (c[0] * (1.0f - tx) + c[1] * tx) * (1.0f - tz) + (c[n] * (1.0f - tx) + c[n + 1] * tx) * tz;
+    }
+
+    // true when every height sample() can read along row v is zero
+    bool calmrow(float v) const {
+        int z = std::min(int(std::clamp(v, 0.0f, 1.0f) * (n - 1)), n - 2);
+        return calmrows(z, z + 2);
+    }
+
+    // true when every height in rows [z0, z1) is zero; rows outside the grid count as calm
+    bool calmrows(int z0, int z1) const {
+        if (!adaptive) return false;
+        z0 = std::max(z0, 0);
+        z1 = std::min(z1, n);
+        for (int bz = z0 / blocksize; z0 < z1 && bz <= (z1 - 1) / blocksize; ++bz) {
+            for (int bx = 0; bx < blocks; ++bx) {
+                if (active[bx + bz * blocks]) return false;
+            }
+        }
+        return true;
+    }
+
+    // marks blocks from the heights alone, after the fields were replaced wholesale. with a threshold, blocks
+    // that stay below it are cleared and left inactive, as the step does with calm ones.
+    void refreshactivity(float threshold = 0.0f) {
+        for (int b = 0; b < blocks * blocks; ++b) refreshblock(b, threshold);
+    }
+
+    // average share of the grid stepped per step, 1 for the dense solver
+    double steppedfraction() const {
+        return steps ? double(steppedblocks) / (double(steps) * blocks * blocks) : 0.0;
+    }
+
+    void report() const {
+        printf("  ripples: %ld steps on a %dx%d grid, %.1f%% of its %dx%d blocks stepped on average, %.3f ms per step\n",
+            steps, n, n, 100.0 * steppedfraction(), blocksize, blocksize, steps ? 1000.0 * steptime / steps : 0.0);
+        if (dispersion) {
+            double perstep = dispersion->applications ? 1000.0 * dispersion->seconds / dispersion->applications : 0.0;
+            if (dispersion->terms() == 0) {
+                printf("  iwave dispersion, direct 13x13 convolution: %.3f ms per step\n", perstep);
+            }
+            else {
+                printf("  iwave dispersion, %d separable terms holding %.4f%% of the kernel: %.3f ms per step\n",
+                    dispersion->terms(), 100.0 * dispersion->share(dispersion->terms() - 1), perstep);
+            }
+        }
+        if (flow) {
+            printf("  ripple current %g cells/step, %s advection: %ld cells advected, %.0f per second\n", currentspeed,
+                advectschemenames[int(scheme)], flow->cells, drifttime > 0.0 ? flow->cells / drifttime : 0.0);
+        }
+        if (diffusion) {
+            printf("  ripple viscosity r=%g: %ld implicit line solves, %.0f per second\n", viscosity, diffusion->solves,
+                diffusiontime > 0.0 ? diffusion->solves / diffusiontime : 0.0);
+        }
+    }
+
+    int size() const { return n; }
+
+    tasksystem* tasks = nullptr;
+    bool adaptive = true;  // false steps every cell, as the reference
+    long steps = 0;
+    double steptime = 0;  // seconds spent in step(), everything it runs included
+    std::vector<float> current, previous;
+
+private:
+    int n;
+    int blocks;
+    std::vector<unsigned char> active, still;
+    std::vector<int> stepped;
+    long steppedblocks = 0;
+    float viscosity = 0.0f;
+    std::unique_ptr<adisolver> diffusion;
+    double diffusiontime = 0;
+    float currentspeed = 0.0f;
+    advectscheme scheme = advectscheme::maccormack;
+    std::unique_ptr<advector> flow;
+    std::vector<int> drifting;
+    double drifttime = 0;
+    std::unique_ptr<iwavekernel> dispersion;
+    std::vector<float> derivative, rowpeaks;
+    std::vector<int> blocked;
+    std::vector<float> sponge;      // the band's factor by distance from the edge
+    std::vector<int> spongeblocks;  // the blocks the band passes through
+
+    // only band cells of blocks with something in them are touched, so a calm border costs nothing
+    void absorb() {
+        int width = int(sponge.size());
+        for (int b : spongeblocks) {
+            if (adaptive && !active[b]) continue;
+            int x0 = (b % blocks) * blocksize, z0 = (b / blocks) * blocksize;
+            int x1 = std::min(x0 + blocksize, n), z1 = std::min(z0 + blocksize, n);
+            for (int z = z0; z < z1; ++z) {
+                int dz = std::min(z, n - 1 - z);
+                for (int x = x0; x < x1; ++x) {
+                    int d = std::min(dz, std::min(x, n - 1 - x));
+                    if (d >= width) {
+                        // the rest of the row is inside the band's inner edge until its far side
+                        x = std::max(x, n - 1 - width);
+                        continue;
+                    }
+                    size_t k = x + size_t(z) * n;
+                    current[k] *= sponge[d];
+                    previous[k] *= sponge[d];
+                }
+            }
+        }
+    }
+
+    // tessendorf's update, h' = (h (2 - alpha dt) - h_previous - g dt^2 (G * h)) / (1 + alpha dt), with the
+    // border held at zero like the wave equation's. the kernel spreads every ripple a little over the whole layer, so
+    // heights below iwaveflush are zeroed as they are written, or the far field would fill with denormals that slow
+    // every step several times over. once the whole layer has gone calm it is cleared as well.
+    void stepiwave() {
+        dispersion->apply(current, derivative, tasks);
+        const float keep = 2.0f - iwavedamping, scale = 1.0f / (1.0f + iwavedamping);
+        rowpeaks.assign(n, 0.0f);
+        auto rows = [&](int z0, int z1) {
+            for (int z = z0; z < z1; ++z) {
+                float* next = &previous[size_t(z) * n];
+                const float* c = &current[size_t(z) * n];
+                const float* d = &derivative[size_t(z) * n];
+                if (z == 0 || z == n - 1) {
+                    std::fill(next, next + n, 0.0f);
+                    continue;
+                }
+                next[0] = next[n - 1] = 0.0f;
+                float largest = 0.0f;
+                for (int x = 1; x < n - 1; ++x) {
+                    float h = (c[x] * keep - next[x] - iwavegravity * d[x]) * scale;
+                    next[x] = std::abs(h) < iwaveflush ? 0.0f : h;
+                    largest = std::max(largest, std::max(std::abs(next[x]), std::abs(c[x])));
+                }
+                rowpeaks[z] = largest;
+            }
+        };
+        if (tasks) {
+            tasks->parallelfor(n, 16, rows);
+        }
+        else {
+            rows(0, n);
+        }
+        if (*std::max_element(rowpeaks.begin(), rowpeaks.end()) < calm) {
+            std::fill(current.begin(), current.end(), 0.0f);
+            std::fill(previous.begin(), previous.end(), 0.0f);
+        }
+    }
+
+    // cells under the obstacle stay flat, so waves reflect off it; clearing them never wakes a calm block
+    void obstruct() {
+        for (int k : blocked) current[k] = previous[k] = 0.0f;
+    }
+
+    // every block that is active or next to one
+    void nearblocks(std::vector<int>& out) const {
+        out.clear();
+        for (int bz = 0; bz < blocks; ++bz) {
+            for (int bx = 0; bx < blocks; ++bx) {
+                bool near = false;
+                for (int dz = -1; dz <= 1 && !near; ++dz) {
+                    for (int dx = -1; dx <= 1 && !near; ++dx) {
+                        int x = bx + dx, z = bz + dz;
+                        near = x >= 0 && z >= 0 && x < blocks && z < blocks && active[x + z * blocks];
+                    }
+                }
+                if (near) out.push_back(bx + bz * blocks);
+            }
+        }
+    }
+
+    // marks block b active if any height reaches the threshold, or with none if any is nonzero; a block left
+    // inactive with heights in it is cleared
+    void refreshblock(int b, float threshold) {
+        int x0 = (b % blocks) * blocksize, z0 = (b / blocks) * blocksize;
+        int x1 = std::min(x0 + blocksize, n), z1 = std::min(z0 + blocksize, n);
+        float largest = 0.0f;
+        for (int z = z0; z < z1; ++z) {
+            for (int x = x0; x < x1; ++x) {
+                size_t k = x + size_t(z) * n;
+                largest = std::max(largest, std::max(std::abs(current[k]), std::abs(previous[k])));
+            }
+        }
+        active[b] = threshold > 0.0f ? largest >= threshold : largest > 0.0f;
+        if (active[b] || largest == 0.0f) return;
+        for (int z = z0; z < z1; ++z) {
+            std::fill(current.data() + x0 + size_t(z) * n, current.data() + x1 + size_t(z) * n, 0.0f);
+            std::fill(previous.data() + x0 + size_t(z) * n, previous.data() + x1 + size_t(z) * n, 0.0f);
+        }
+    }
+
+    // both fields move with the current, so the ripples keep their speed as they drift. the flow is under a cell
+    // per step, so only the active blocks and their neighbours can end up nonzero, and only those are advected.
+    void drift() {
+        if (!flow) return;
+        auto start = std::chrono::steady_clock::now();
+        if (adaptive) {
+            nearblocks(drifting);
+        }
+        else if (drifting.empty()) {
+            for (int b = 0; b < blocks * blocks; ++b) drifting.push_back(b);
+        }
+        flow->advect(current, scheme, drifting, tasks);
+        flow->advect(previous, scheme, drifting, tasks);
+        if (adaptive) {
+            for (int b : drifting) refreshblock(b, 0.0f);
+        }
+        drifttime += secondssince(start);
+    }
+
+    // viscosity acts on the heights and on the previous ones alike, so it damps the motion without adding any.
+    // the implicit solve reaches every cell of a line, but a height's share falls below 1e-7 of it within the
+    // solver's reach, so only the box around the active blocks widened by that much is solved and re-marked.
+    // everything outside it is calm and zero already.
+    void diffuse() {
+        if (!diffusion) return;
+        auto start = std::chrono::steady_clock::now();
+        int x0 = 1, z0 = 1, x1 = n - 1, z1 = n - 1;
+        if (adaptive) {
+            int bx0 = blocks, bz0 = blocks, bx1 = -1, bz1 = -1;
+            for (int b = 0; b < blocks * blocks; ++b) {
+                if (!active[b]) continue;
+                bx0 = std::min(bx0, b % blocks);
+                bx1 = std::max(bx1, b % blocks);
+                bz0 = std::min(bz0, b / blocks);
+                bz1 = std::max(bz1, b / blocks);
+            }
+            if (bx1 < 0) {
+                diffusiontime += secondssince(start);
+                return;
+            }
+            int reach = diffusion->reach;
+            x0 = std::max(1, bx0 * blocksize - reach);
+            z0 = std::max(1, bz0 * blocksize - reach);
+            x1 = std::min(n - 1, (bx1 + 1) * blocksize + reach);
+            z1 = std::min(n - 1, (bz1 + 1) * blocksize + reach);
+        }
+        diffusion->solve(current, tasks, x0, z0, x1, z1);
+        diffusion->solve(previous, tasks, x0, z0, x1, z1);
+        diffusiontime += secondssince(start);
+        if (!adaptive) return;
+        for (int bz = z0 / blocksize; bz <= (z1 - 1) / blocksize; ++bz) {
+            for (int bx = x0 / blocksize; bx <= (x1 - 1) / blocksize; ++bx) refreshblock(bx + bz * blocks, calm);
+        }
+    }
+
+    // one leapfrog update over a rectangle of cells, writing the next heights into previous. with track set it
+    // returns the largest height in the rectangle before or after the update, which decides if it has gone calm.
+    template <bool track>
+    float steprows(int z0, int z1, int x0, int x1) {
+        float largest = 0.0f;
+        for (int z = z0; z < z1; ++z) {
+            float* next = &previous[size_t(z) * n];
+            const float* c = &current[size_t(z) * n];
+            if (z == 0 || z == n - 1) {
+                std::fill(next + x0, next + x1, 0.0f);
+                continue;
+            }
+            int xa = x0, xb = x1;
+            if (xa == 0) next[xa++] = 0.0f;
+            if (xb == n) next[--xb] = 0.0f;
+            for (int x = xa; x < xb; ++x) {
+                float laplacian = c[x - 1] + c[x + 1] + c[x - n] + c[x + n] - 4.0f * c[x];
+                next[x] = (2.0f * c[x] - next[x] + coupling * laplacian) * damping;
+                if (track) largest = std::max(largest, std::max(std::abs(next[x]), std::abs(c[x])));
+            }
+        }
+        return largest;
+    }
+};
+
+// draws the ripple layer onto a render grid finer than its own, so the solver can run coarse while the surface keeps
+// the render grid's resolution. heights between the coarse cells are catmull-rom bicubic, which is smooth where
+// bilinear leaves a crease along every coarse cell edge. optional detail fills the octave the coarse grid cannot hold
+// with cook and derose's wavelet noise: white noise minus its own downsampled-then-upsampled copy, so it only has
+// energy in the top band. it is laid one texel per render vertex and scaled by the slope of the coarse ripples, so
+// flat water stays flat and only steep ripples gain texture.
+// the filter is separable, so every coarse row is first widened to the render columns, and each render row is then
+// a blend of four widened rows that streams through simd lanes. both passes are bound by memory rather than
+// arithmetic: a draw writes a full render grid of heights, which alone costs about as much as filling that many floats.
+class rippleupsampler {
+public:
+    static constexpr int tile = 128;  // side of the periodic noise tile
+
+    explicit rippleupsampler(float detail) : detail(detail) {
+        if (detail > 0.0f) buildnoise();
+    }
+
+    // fills the heights of a columns x rows render grid laid over the same square as the ripple grid
+    void upsample(const ripplegrid& ripples, int columns, int rows, tasksystem* tasks) {
+        auto start = std::chrono::steady_clock::now();
+        if (ripples.size() != n || columns != width || rows != depth) layout(ripples.size(), columns, rows);
+        auto widen = [&](int z0, int z1) { widenrows(ripples, z0, z1); };
+        auto blend = [&](int z0, int z1) { blendrows(ripples, z0, z1); };
+        if (tasks) {
+            tasks->parallelfor(n, 8, widen);
+            widenseconds += secondssince(start);
+            tasks->parallelfor(depth, 16, blend);
+        }
+        else {
+            widen(0, n);
+            widenseconds += secondssince(start);
+            blend(0, depth);
+        }
+        seconds += secondssince(start);
+        ++frames;
+    }
+
+    // the heights to add along render row z, or null when the ripples under it are all zero
+    const float* row(int z) const {
+        return calm[z] ? nullptr : &heights[size_t(z) * width];
+    }
+
+    void report() const {
+        printf("  ripple upsampling %dx%d to %dx%d, bicubic", n, n, width, depth);
+        if (detail > 0.0f) printf(" with detail %g", detail);
+        printf(": %ld frames, %.3f ms per frame\n", frames, frames ? 1000.0 * seconds / frames : 0.0);
+    }
+
+    float detail;  // noise height per unit of coarse slope, 0 for none
+    long frames = 0;
+    double seconds = 0, widenseconds = 0;  // the whole draw, and the part of it that widens the coarse rows
+
+private:
+    int n = 0, width = 0, depth = 0;
+    std::vector<int> cellx, cellz;   // the coarse cell under each render column and row
+    std::vector<float> tx, tz;       // and how far across it they are
+    std::vector<float> wide;         // every coarse row widened to the render columns
+    std::vector<float> wideslopes;   // detail times the coarse slope, widened the same way but linear
+    std::vector<float> heights;
+    std::vector<unsigned char> calm;
+    std::vector<float> noise;
+
+    void layout(int size, int columns, int rows) {
+        n = size;
+        width = columns;
+        depth = rows;
+        auto place = [&](int count, std::vector<int>& cell, std::vector<float>& t) {
+            cell.resize(count);
+            t.resize(count);
+            for (int i = 0; i < count; ++i) {
+                float f = float(i) / float(std::max(count - 1, 1)) * float(n - 1);
+                cell[i] = std::min(int(f), n - 2);
+                t[i] = f - float(cell[i]);
+            }
+        };
+        place(width, cellx, tx);
+        place(depth, cellz, tz);
+        wide.assign(size_t(n) * width, 0.0f);
+        wideslopes.assign(detail > 0.0f ? size_t(n) * width : 0, 0.0f);
+        heights.assign(size_t(width) * depth, 0.0f);
+        calm.assign(depth, 1);
+    }
+
+    // turns each coarse row into a cubic per cell, then evaluates the cubic under every render column. the cubics
+    // are stored a cell per 16 bytes, so four columns load their four cells and one transpose lines up the
+    // coefficients as lanes. calm rows are only zeroed, since the blend may still read them beside a live one.
+    void widenrows(const ripplegrid& ripples, int z0, int z1) {
+        std::vector<float> line(n + 8, 0.0f), slope(n, 0.0f), cubic(size_t(4) * n + 16, 0.0f);
+        const float* h = ripples.current.data();
+        for (int z = z0; z < z1; ++z) {
+            float* out = &wide[size_t(z) * width];
+            float* outslope = detail > 0.0f ? &wideslopes[size_t(z) * width] : nullptr;
+            if (ripples.calmrows(z - 1, z + 2)) {
+                std::fill(out, out + width, 0.0f);
+                if (outslope) std::fill(outslope, outslope + width, 0.0f);
+                continue;
+            }
+
+            // the row with its ends clamped one cell out and two past, so every cell has four samples around it
+            const float* c = h + size_t(z) * n;
+            std::copy(c, c + n, &line[1]);
+            line[0] = c[0];
+            line[n + 1] = line[n + 2] = c[n - 1];
+            int j = 0;
+#ifdef FLUIDSIM_SSE2
+            __m128 half = _mm_set1_ps(0.5f), two = _mm_set1_ps(2.0f), three = _mm_set1_ps(3.0f);
+            __m128 four = _mm_set1_ps(4.0f), five = _mm_set1_ps(5.0f);
+            for (; j + 4 <= n - 1; j += 4) {
+                __m128 p0 = _mm_loadu_ps(&line[j]), p1 = _mm_loadu_ps(&line[j + 1]);
+                __m128 p2 = _mm_loadu_ps(&line[j + 2]), p3 = _mm_loadu_ps(&line[j + 3]);
+                __m128 a = _mm_mul_ps(half, _mm_add_ps(_mm_sub_ps(p3, p0), _mm_mul_ps(three, _mm_sub_ps(p1, p2))));
+                __m128 b = _mm_mul_ps(half, _mm_sub_ps(_mm_add_ps(_mm_mul_ps(two, p0), _mm_mul_ps(four, p2)),
+                    _mm_add_ps(_mm_mul_ps(five, p1), p3)));
+                __m128 d = p1;
+                __m128 e = _mm_mul_ps(half, _mm_sub_ps(p2, p0));
+                _MM_TRANSPOSE4_PS(a, b, e, d);
+                _mm_storeu_ps(&cubic[4 * j], a);
+                _mm_storeu_ps(&cubic[4 * j + 4], b);
+                _mm_storeu_ps(&cubic[4 * j + 8], e);
+                _mm_storeu_ps(&cubic[4 * j + 12], d);
+            }
+#endif
+            for (; j < n - 1; ++j) {
+                float p0 = line[j], p1 = line[j + 1], p2 = line[j + 2], p3 = line[j + 3];
+                cubic[4 * j] = 0.5f * ((p3 - p0) + 3.0f * (p1 - p2));
+                cubic[4 * j + 1] = 0.5f * ((2.0f * p0 + 4.0f * p2) - (5.0f * p1 + p3));
+                cubic[4 * j + 2] = 0.5f * (p2 - p0);
+                cubic[4 * j + 3] = p1;
+            }
+            int x = 0;
+#ifdef FLUIDSIM_SSE2
+            for (; x + 4 <= width; x += 4) {
+                const int* cx = &cellx[x];
+                __m128 a = _mm_loadu_ps(&cubic[4 * cx[0]]), b = _mm_loadu_ps(&cubic[4 * cx[1]]);
+                __m128 e = _mm_loadu_ps(&cubic[4 * cx[2]]), d = _mm_loadu_ps(&cubic[4 * cx[3]]);
+                _MM_TRANSPOSE4_PS(a, b, e, d);
+                __m128 t = _mm_loadu_ps(&tx[x]);
+                _mm_storeu_ps(out + x, _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(a, t), b), t), e), t), d));
+            }
+#endif
+            for (; x < width; ++x) {
+                const float* q = &cubic[4 * cellx[x]];
+                float t = tx[x];
+                out[x] = ((q[0] * t + q[1]) * t + q[2]) * t + q[3];
+            }
+            if (!outslope) continue;
+
+            // central differences, zero along the border where a neighbour is missing
+            if (z == 0 || z == n - 1) {
+                std::fill(outslope, outslope + width, 0.0f);
+                continue;
+            }
+            for (int k = 1; k < n - 1; ++k) {
+                float dx = 0.5f * (c[k + 1] - c[k - 1]), dz = 0.5f * (c[k + n] - c[k - n]);
+                slope[k] = detail * std::sqrt(dx * dx + dz * dz);
+            }
+            for (x = 0; x < width; ++x) {
+                int k = cellx[x];
+                outslope[x] = slope[k] + tx[x] * (slope[k + 1] - slope[k]);
+            }
+        }
+    }
+
+    // catmull-rom weights down the column over four widened rows, with rows past the edge clamped to it
+    void blendrows(const ripplegrid& ripples, int z0, int z1) {
+        for (int z = z0; z < z1; ++z) {
+            int i = cellz[z];
+            calm[z] = ripples.calmrows(i - 1, i + 3);
+            if (calm[z]) continue;
+            float t = tz[z], t2 = t * t, t3 = t2 * t;
+            float w[4] = { 0.5f * (-t3 + 2.0f * t2 - t), 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f),
+                           0.5f * (-3.0f * t3 + 4.0f * t2 + t), 0.5f * (t3 - t2) };
+            const float* r[4];
+            for (int k = 0; k < 4; ++k) r[k] = &wide[size_t(std::clamp(i - 1 + k, 0, n - 1)) * width];
+            float* out = &heights[size_t(z) * width];
+            int x = 0;
+#ifdef FLUIDSIM_SSE2
+            __m128 w0 = _mm_set1_ps(w[0]), w1 = _mm_set1_ps(w[1]), w2 = _mm_set1_ps(w[2]), w3 = _mm_set1_ps(w[3]);
+            for (; x + 4 <= width; x += 4) {
+                __m128 sum = _mm_add_ps(_mm_mul_ps(w0, _mm_loadu_ps(r[0] + x)), _mm_mul_ps(w1, _mm_loadu_ps(r[1] + x)));
+                sum = _mm_add_ps(sum, _mm_add_ps(_mm_mul_ps(w2, _mm_loadu_ps(r[2] + x)), _mm_mul_ps(w3, _mm_loadu_ps(r[3] + x))));
+                _mm_storeu_ps(out + x, sum);
+            }
+#endif
+            for (; x < width; ++x) out[x] = (w[0] * r[0][x] + w[1] * r[1][x]) + (w[2] * r[2][x] + w[3] * r[3][x]);
+            if (detail <= 0.0f) continue;
+
+            // the envelope is linear between the two coarse rows around this one; the noise tile repeats along x
+            const float* s0 = &wideslopes[size_t(i) * width];
+            const float* s1 = s0 + width;
+            const float* texels = &noise[size_t(z & (tile - 1)) * tile];
+            x = 0;
+#ifdef FLUIDSIM_SSE2
+            __m128 across = _mm_set1_ps(t);
+            for (; x + 4 <= width; x += 4) {
+                __m128 a = _mm_loadu_ps(s0 + x), b = _mm_loadu_ps(s1 + x);
+                __m128 envelope = _mm_add_ps(a, _mm_mul_ps(across, _mm_sub_ps(b, a)));
+                __m128 sum = _mm_add_ps(_mm_loadu_ps(out + x), _mm_mul_ps(envelope, _mm_loadu_ps(&texels[x & (tile - 1)])));
+                _mm_storeu_ps(out + x, sum);
+            }
+#endif
+            for (; x < width; ++x) out[x] += (s0[x] + t * (s1[x] - s0[x])) * texels[x & (tile - 1)];
+        }
+    }
+
+    // hash noise on a periodic tile, less its own band below half the tile's nyquist frequency, at unit rms.
+    // the filters are cook and derose's quadratic b-spline analysis and refinement pair, run along x then z.
+    void buildnoise() {
+        static const float analysis[32] = {
+            0.000334f, -0.001528f, 0.000410f, 0.003545f, -0.000938f, -0.008233f, 0.002172f, 0.019120f,
+            -0.005040f, -0.044412f, 0.011655f, 0.103311f, -0.025936f, -0.243780f, 0.033979f, 0.655340f,
+            0.655340f, 0.033979f, -0.243780f, -0.025936f, 0.103311f, 0.011655f, -0.044412f, -0.005040f,
+            0.019120f, 0.002172f, -0.008233f, -0.000938f, 0.003546f, 0.000410f, -0.001528f, 0.000334f };
+        static const float refinement[4] = { 0.25f, 0.75f, 0.75f, 0.25f };
+        noise.resize(size_t(tile) * tile);
+        for (int z = 0; z < tile; ++z) {
+            for (int x = 0; x < tile; ++x) {
+                uint32_t h = uint32_t(x) * 374761393u + uint32_t(z) * 668265263u;
+                h = (h ^ (h >> 13)) * 1274126177u;
+                noise[x + size_t(z) * tile] = float((h ^ (h >> 16)) & 0xffff) / 65535.0f - 0.5f;
+            }
+        }
+        std::vector<float> smooth = noise, coarse(tile / 2);
+        auto wrap = [](int i, int m) { return ((i % m) + m) % m; };
+        for (int stride : { 1, tile }) {
+            for (int k = 0; k < tile; ++k) {
+                float* v = &smooth[stride == 1 ? size_t(k) * tile : size_t(k)];
+                for (int i = 0; i < tile / 2; ++i) {
+                    float sum = 0.0f;
+                    for (int m = -16; m < 16; ++m) sum += analysis[m + 16] * v[size_t(wrap(2 * i + m, tile)) * stride];
+                    coarse[i] = sum;
+                }
+                for (int i = 0; i < tile; ++i) {
+                    int m = i / 2;
+                    v[size_t(i) * stride] = refinement[i - 2 * m + 2] * coarse[m] +
+                        refinement[i - 2 * m] * coarse[wrap(m + 1, tile / 2)];
+                }
+            }
+        }
+        double energy = 0.0;
+        for (size_t i = 0; i < noise.size(); ++i) {
+            noise[i] -= smooth[i];
+            energy += double(noise[i]) * noise[i];
+        }
+        float scale = float(1.0 / std::sqrt(energy / double(noise.size())));
+        for (float& v : noise) v *= scale;
+    }
+};
+
+class watervolume;
+
+// an alternative implementation of the per-frame wave update, run in place of the cpu kernels when attached
+class computebackend {
+public:
+    virtual ~computebackend() = default;
+    virtual const char* name() const = 0;
+    // writes heights and normals of both surfaces into water.vertices, like watervolume::updatewaves.
+    // false when the backend could not, and the cpu kernels should run instead
+    virtual bool updatewaves(watervolume& water, const wavephases& phase) = 0;
+    virtual void report() const {}
+    // true when results stay on the gpu and water.vertices is not kept current
+    virtual bool resident() const { return false; }
+};
+
+class watervolume {
+public:
+    watervolume(int gw, int gd, float w, float d, float t)
+        : gridwidth(gw), griddepth(gd), width(w), depth(d), thickness(t)
+    {
+        buildmesh();
+        // the mesh is built once upon object creation and then updated each frame.
+    }
+
+    // computes water surface as sum of two sine waves; normals computed via finite differences.
+    // rows are processed in tiles on the task system when one is attached and the kernel config asks for threads.
+    void updatewaves(double time) {
+        wavephases phase = phasesat(waves, time);
+        // the compute backends know nothing of the ripple layer
+        if (compute && !ripples && compute->updatewaves(*this, phase)) return;
+        if (ripples && upsampler) upsampler->upsample(*ripples, gridwidth, griddepth, tasks);
+        auto heights = [&](int z0, int z1) { evaluaterows(phase, z0, z1); };
+        auto normals = [&](int z0, int z1) { normalrows(z0, z1); };
+        if (tasks && g_kernel.threads > 1) {
+            // normals read neighbouring rows, so every height must be written before the second sweep starts
+            tasks->parallelfor(griddepth, g_kernel.tilerows, heights, g_kernel.threads);
+            tasks->parallelfor(griddepth, g_kernel.tilerows, normals, g_kernel.threads);
+        }
+        else {
+            heights(0, griddepth);
+            normals(0, griddepth);
+        }
+        // updating normals is crucial for accurate lighting in the fragment shader.
+    }
+
+    void upload(GLuint vbo) {
+        uploadvertices(vbo, vertices);
+    }
+
+    unsigned long long checksum() const {
+        return checksumvertices(vertices);
+    }
+
+    // tests the volume's bounding box against the view frustum of a clip (proj * view * model) matrix
+    bool intersectsfrustum(const glm::mat4& clip) const {
+        float miny = vertices[topstart].y, maxy = miny;
+        if (compute && compute->resident()) {
+            // the heights never reach this array, but the waves cannot exceed their summed amplitudes
+            maxy = std::abs(waves.amplitude1) + std::abs(waves.amplitude2);
+            miny = -maxy;
+        }
+        else {
+            for (int i = 0; i < gridwidth * griddepth; ++i) {
+                miny = std::min(miny, vertices[topstart + i].y);
+                maxy = std::max(maxy, vertices[topstart + i].y);
+            }
+        }
+        glm::vec3 lo(-0.5f * width, miny - thickness, -0.5f * depth);
+        glm::vec3 hi(0.5f * width, maxy, 0.5f * depth);
+
+        // each frustum plane is the sum or difference of the fourth row with one of the other rows
+        for (int row = 0; row < 3; ++row) {
+            for (float sign : { 1.0f, -1.0f }) {
+                glm::vec4 plane;
+                for (int col = 0; col < 4; ++col) {
+                    plane[col] = clip[col][3] + sign * clip[col][row];
+                }
+                // only the box corner furthest along the plane normal needs testing
+                glm::vec3 corner(plane.x >= 0 ? hi.x : lo.x, plane.y >= 0 ? hi.y : lo.y, plane.z >= 0 ? hi.z : lo.z);
+                if (plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w < 0) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // the three kernels of a wave update, public so the roofline benchmark can time them one at a time
+    void evaluatetop(const wavephases& phase, int z0, int z1) {
+        for (int z = z0; z < z1; ++z) {
+            switch (g_kernel.sinetier) {
+            case 1:  evaluaterow<1>(phase, z); break;
+            case 2:  evaluaterow<2>(phase, z); break;
+            default: evaluaterow<0>(phase, z); break;
+            }
+        }
+    }
+
+    // update bottom surface by offsetting the top surface by water thickness
+    void offsetbottom(int z0, int z1) {
+        for (int z = z0; z < z1; ++z) {
+            for (int x = 0; x < gridwidth; ++x) {
+                int top_idx = topstart + x + z * gridwidth;
+                int bottom_idx = bottomstart + x + z * gridwidth;
+                vertices[bottom_idx].y = vertices[top_idx].y - thickness;
+            }
+        }
+    }
+
+    // compute normals for rows [z0, z1) of both surfaces using finite differences (approximating partial derivatives)
+    void normalrows(int z0, int z1) {
+        for (int z = std::max(z0, 1); z < std::min(z1, griddepth - 1); ++z) {
+            for (int x = 1; x < gridwidth - 1; ++x) {
+                int idx = topstart + x + z * gridwidth;
+                float yl = vertices[idx - 1].y;
+                float yr = vertices[idx + 1].y;
+                float yd = vertices[idx - gridwidth].y;
+                float yu = vertices[idx + gridwidth].y;
+                float dx = (yr - yl) * 0.5f;
+                float dz = (yu - yd) * 0.5f;
+                glm::vec3 n = glm::normalize(glm::vec3(-dx, 1.0f, -dz));
+                vertices[idx].nx = n.x;
+                vertices[idx].ny = n.y;
+                vertices[idx].nz = n.z;
+            }
+
+            // compute normals for bottom surface using a similar finite difference method
+            for (int x = 1; x < gridwidth - 1; ++x) {
+                int idx = bottomstart + x + z * gridwidth;
+                float yl = vertices[idx - 1].y;
+                float yr = vertices[idx + 1].y;
+                float yd = vertices[idx - gridwidth].y;
+                float yu = vertices[idx + gridwidth].y;
+                float dx = (yr - yl) * 0.5f;
+                float dz = (yu - yd) * 0.5f;
+                glm::vec3 n = glm::normalize(glm::vec3(dx, -1.0f, dz));
+                vertices[idx].nx = n.x;
+                vertices[idx].ny = n.y;
+                vertices[idx].nz = n.z;
+            }
+        }
+    }
+
+    int rows() const { return griddepth; }
+    int columns() const { return gridwidth; }
+    float layerthickness() const { return thickness; }
+    glm::vec2 extent() const { return glm::vec2(width, depth); }
+
+    // a volume of the same extent at another resolution with the given wave parameters. it reads no other mutable
+    // state, so a background thread can build it from a copy of the parameters while this volume keeps simulating.
+    std::shared_ptr<watervolume> resized(int gw, int gd, const waveparams& params) const {
+        auto volume = std::make_shared<watervolume>(gw, gd, width, depth, thickness);
+        volume->waves = params;
+        volume->tasks = tasks;
+        volume->compute = compute;
+        volume->ripples = ripples;
+        volume->upsampler = upsampler;
+        return volume;
+    }
+
+    // a coarse copy of the walls and bottom sheet over the same vertices, for passes that only need their outline:
+    // every stride-th row and column and the last ones, wound as in buildmesh. the walls come first; their index
+    // count is returned so a pass can draw them alone.
+    static size_t simplifiedindices(int columns, int rows, int stride, std::vector<unsigned int>& out) {
+        auto samples = [&](int count) {
+            std::vector<unsigned int> at;
+            for (int i = 0; i < count - 1; i += stride) at.push_back(unsigned(i));
+            at.push_back(unsigned(count - 1));
+            return at;
+        };
+        std::vector<unsigned int> xs = samples(columns), zs = samples(rows);
+        unsigned int w = unsigned(columns), bottom = unsigned(columns) * unsigned(rows);
+        out.clear();
+        for (size_t i = 0; i + 1 < zs.size(); ++i) {
+            unsigned int a = zs[i] * w, b = zs[i + 1] * w;
+            out.insert(out.end(), { a, b, bottom + a, b, bottom + b, bottom + a });
+            a += w - 1;
+            b += w - 1;
+            out.insert(out.end(), { b, a, bottom + b, a, bottom + a, bottom + b });
+        }
+        for (size_t i = 0; i + 1 < xs.size(); ++i) {
+            unsigned int a = xs[i], b = xs[i + 1];
+            out.insert(out.end(), { b, a, bottom + b, a, bottom + a, bottom + b });
+            a += (rows - 1) * w;
+            b += (rows - 1) * w;
+            out.insert(out.end(), { a, b, bottom + a, b, bottom + b, bottom + a });
+        }
+        size_t walls = out.size();
+        for (size_t j = 0; j + 1 < zs.size(); ++j) {
+            for (size_t i = 0; i + 1 < xs.size(); ++i) {
+                unsigned int i0 = bottom + xs[i] + zs[j] * w, i1 = bottom + xs[i + 1] + zs[j] * w;
+                unsigned int i2 = bottom + xs[i] + zs[j + 1] * w, i3 = bottom + xs[i + 1] + zs[j + 1] * w;
+                out.insert(out.end(), { i0, i2, i1, i1, i2, i3 });
+            }
+        }
+        return walls;
+    }
+
+    // the index buffer as ranges in front-to-back order from eye, in model space: the sheet on the eye's side first,
+    // in bands of bandrows quad rows nearest first, then the walls, then the far sheet. a band of whole rows is one
+    // contiguous run of buildmesh's indices, so the ranges only reorder them.
+    std::vector<drawrange> orderedranges(const glm::vec3& eye, int bandrows = 16) const {
+        GLsizei perrow = GLsizei(gridwidth - 1) * 6;
+        size_t sheet = size_t(perrow) * (griddepth - 1);
+        std::vector<std::pair<float, drawrange>> bands;
+        for (int z0 = 0; z0 < griddepth - 1; z0 += bandrows) {
+            int z1 = std::min(z0 + bandrows, griddepth - 1);
+            float near = std::clamp(eye.z, rowz(z0), rowz(z1));
+            bands.push_back({ std::abs(eye.z - near), { GLsizei(z1 - z0) * perrow, size_t(z0) * perrow, 0 } });
+        }
+        std::stable_sort(bands.begin(), bands.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        bool above = eye.y > -0.5f * thickness;
+        std::vector<drawrange> ranges;
+        for (const auto& band : bands) ranges.push_back({ band.second.count, band.second.first + (above ? 0 : sheet), 0 });
+        ranges.push_back({ GLsizei(indices.size() - 2 * sheet), 2 * sheet, 0 });
+        for (const auto& band : bands) ranges.push_back({ band.second.count, band.second.first + (above ? sheet : 0), 0 });
+        return ranges;
+    }
+
+    waveparams waves;
+    tasksystem* tasks = nullptr;
+    computebackend* compute = nullptr;  // replaces the cpu kernels when set
+    ripplegrid* ripples = nullptr;  // added to the top surface heights when set
+    rippleupsampler* upsampler = nullptr;  // draws the ripples bicubic instead of bilinear when set
+    std::vector<vertex> vertices;
+    std::vector<unsigned int> indices;
+
+private:
+    int gridwidth, griddepth;
+    int topstart = 0, bottomstart = 0;
+    float width, depth, thickness;
+
+    float rowz(int z) const {
+        return float(z) / (griddepth - 1) * depth - 0.5f * depth;
+    }
+
+    // compute wave heights on the top surface for rows [z0, z1), then offset the bottom surface below them
+    void evaluaterows(const wavephases& phase, int z0, int z1) {
+        for (int z = z0; z < z1; ++z) {
+            evaluatetop(phase, z, z + 1);
+            if (ripples) addripples(z);
+            offsetbottom(z, z + 1);
+        }
+    }
+
+    void addripples(int z) {
+        if (upsampler) {
+            const float* h = upsampler->row(z);
+            if (!h) return;
+            for (int x = 0; x < gridwidth; ++x) vertices[topstart + x + z * gridwidth].y += h[x];
+            return;
+        }
+        float v = float(z) / (griddepth - 1);
+        if (ripples->calmrow(v)) return;
+        for (int x = 0; x < gridwidth; ++x) {
+            vertices[topstart + x + z * gridwidth].y += ripples->sample(float(x) / (gridwidth - 1), v);
+        }
+    }
+
+    template <int sinetier>
+    void evaluaterow(const wavephases& phase, int z) {
+        float amplitude1 = waves.amplitude1;
+        float amplitude2 = waves.amplitude2;
+        float frequency1 = waves.frequency1;
+        float frequency2 = waves.frequency2;
+
+        glm::vec2 dir1 = glm::normalize(glm::vec2(1.0f, 0.2f));
+        glm::vec2 dir2 = glm::normalize(glm::vec2(0.2f, 1.0f));
+
+        int x = 0;
+#ifdef FLUIDSIM_SSE2
+        if (sinetier > 0 && g_kernel.simd == 1) {
+            // same phase arithmetic as the scalar loop, four vertices at a time; only the sine differs
+            float pz = vertices[topstart + z * gridwidth].z;
+            __m128 b1 = _mm_set1_ps(dir1.y * pz), b2 = _mm_set1_ps(dir2.y * pz);
+            __m128 o1 = _mm_set1_ps(phase.offset1), o2 = _mm_set1_ps(phase.offset2);
+            __m128 d1 = _mm_set1_ps(dir1.x), d2 = _mm_set1_ps(dir2.x);
+            __m128 f1 = _mm_set1_ps(frequency1), f2 = _mm_set1_ps(frequency2);
+            __m128 a1 = _mm_set1_ps(amplitude1), a2 = _mm_set1_ps(amplitude2);
+            for (; x + 4 <= gridwidth; x += 4) {
+                const vertex* v = &vertices[topstart + x + z * gridwidth];
+                __m128 px = _mm_set_ps(v[3].x, v[2].x, v[1].x, v[0].x);
+                __m128 dot1 = _mm_add_ps(_mm_mul_ps(d1, px), b1);
+                __m128 dot2 = _mm_add_ps(_mm_mul_ps(d2, px), b2);
+                __m128 y = _mm_add_ps(_mm_mul_ps(a1, fastsin4<sinetier>(_mm_sub_ps(_mm_mul_ps(f1, dot1), o1))),
+                    _mm_mul_ps(a2, fastsin4<sinetier>(_mm_sub_ps(_mm_mul_ps(f2, dot2), o2))));
+                alignas(16) float lanes[4];
+                _mm_store_ps(lanes, y);
+                for (int lane = 0; lane < 4; ++lane) {
+                    vertices[topstart + x + lane + z * gridwidth].y = lanes[lane];
+                }
+            }
+        }
+#endif
+        for (; x < gridwidth; ++x) {
+            int idx = topstart + x + z * gridwidth;
+            float px = vertices[idx].x;
+            float pz = vertices[idx].z;
+            // using the dot product with a direction vector modulates the wave's propagation.
+            float dot1 = glm::dot(dir1, glm::vec2(px, pz));
+            float dot2 = glm::dot(dir2, glm::vec2(px, pz));
+            float wave1 = amplitude1 * fastsin<sinetier>(frequency1 * dot1 - phase.offset1);
+            float wave2 = amplitude2 * fastsin<sinetier>(frequency2 * dot2 - phase.offset2);
+            vertices[idx].y = wave1 + wave2;
+        }
+    }
+
+    void buildmesh() {
+        topstart = 0;
+        bottomstart = gridwidth * griddepth;
+        vertices.resize(gridwidth * griddepth * 2);
+
+        // compute top surface vertices based on grid coordinates
+        for (int z = 0; z < griddepth; ++z) {
+            for (int x = 0; x < gridwidth; ++x) {
+                int idx = x + z * gridwidth;
+                float fx = static_cast<float>(x) / (gridwidth - 1);
+                float fz = static_cast<float>(z) / (griddepth - 1);
+                float px = fx * width - 0.5f * width;
+                float pz = fz * depth - 0.5f * depth;
+                vertices[topstart + idx] = { px, 0.0f, pz, 0, 1, 0 };
+            }
+        }
+
+        // compute bottom surface vertices by applying a vertical offset
+        for (int z = 0; z < griddepth; ++z) {
+            for (int x = 0; x < gridwidth; ++x) {
+                int idx = x + z * gridwidth;
+                vertices[bottomstart + idx] = {
+                    vertices[topstart + idx].x,
+                    -thickness,
+                    vertices[topstart + idx].z,
+                    0, -1, 0
+                };
+            }
+        }
+
+        // build indices for top surface triangles
+        for (int z = 0; z < griddepth - 1; ++z) {
+            for (int x = 0; x < gridwidth - 1; ++x) {
+                int i0 = topstart + (x + z * gridwidth);
+                int i1 = topstart + ((x + 1) + z * gridwidth);
+                int i2 = topstart + (x + (z + 1) * gridwidth);
+                int i3 = topstart + ((x + 1) + (z + 1) * gridwidth);
+                indices.push_back(i0);
+                indices.push_back(i1);
+                indices.push_back(i2);
+                indices.push_back(i1);
+                indices.push_back(i3);
+                indices.push_back(i2);
+            }
+        }
+
+        // build indices for bottom surface triangles
+        for (int z = 0; z < griddepth - 1; ++z) {
+            for (int x = 0; x < gridwidth - 1; ++x) {
+                int i0 = bottomstart + (x + z * gridwidth);
+                int i1 = bottomstart + ((x + 1) + z * gridwidth);
+                int i2 = bottomstart + (x + (z + 1) * gridwidth);
+                int i3 = bottomstart + ((x + 1) + (z + 1) * gridwidth);
+                indices.push_back(i0);
+                indices.push_back(i2);
+                indices.push_back(i1);
+                indices.push_back(i1);
+                indices.push_back(i2);
+                indices.push_back(i3);
+            }
+        }
+
+        auto addsidequad = [&](int topa, int topb, int bottoma, int bottomb) {
+            indices.push_back(topa);
+            indices.push_back(topb);
+            indices.push_back(bottoma);
+            indices.push_back(topb);
+            indices.push_back(bottomb);
+            indices.push_back(bottoma);
+            };
+
+        // build left side face indices
+        for (int z = 0; z < griddepth - 1; ++z) {
+            int topa = topstart + (0 + z * gridwidth);
+            int topb = topstart + (0 + (z + 1) * gridwidth);
+            int bottoma = bottomstart + (0 + z * gridwidth);
+            int bottomb = bottomstart + (0 + (z + 1) * gridwidth);
+            addsidequad(topa, topb, bottoma, bottomb);
+        }
+
+        // build right side face indices
+        for (int z = 0; z < griddepth - 1; ++z) {
+            int topa = topstart + ((gridwidth - 1) + z * gridwidth);
+            int topb = topstart + ((gridwidth - 1) + (z + 1) * gridwidth);
+            int bottoma = bottomstart + ((gridwidth - 1) + z * gridwidth);
+            int bottomb = bottomstart + ((gridwidth - 1) + (z + 1) * gridwidth);
+            indices.push_back(topb);
+            indices.push_back(topa);
+            indices.push_back(bottomb);
+            indices.push_back(topa);
+            indices.push_back(bottoma);
+            indices.push_back(bottomb);
+        }
+
+        // build front side face indices
+        for (int x = 0; x < gridwidth - 1; ++x) {
+            int topa = topstart + (x + 0 * gridwidth);
+            int topb = topstart + ((x + 1) + 0 * gridwidth);
+            int bottoma = bottomstart + (x + 0 * gridwidth);
+            int bottomb = bottomstart + ((x + 1) + 0 * gridwidth);
+            indices.push_back(topb);
+            indices.push_back(topa);
+            indices.push_back(bottomb);
+            indices.push_back(topa);
+            indices.push_back(bottoma);
+            indices.push_back(bottomb);
+        }
+
+        // build back side face indices
+        for (int x = 0; x < gridwidth - 1; ++x) {
+            int topa = topstart + (x + (griddepth - 1) * gridwidth);
+            int topb = topstart + ((x + 1) + (griddepth - 1) * gridwidth);
+            int bottoma = bottomstart + (x + (griddepth - 1) * gridwidth);
+            int bottomb = bottomstart + ((x + 1) + (griddepth - 1) * gridwidth);
+            addsidequad(topa, topb, bottoma, bottomb);
+        }
+        // building the indices correctly is essential for the gpu to draw the mesh properly.
+    }
+};
+
+// evaluates the waves of many small volumes in one parallel sweep. updating them one at a time pays a dispatch and
+// a row setup per body, and short rows leave much of the work to the scalar tails. here bodies of the same grid
+// shape are interleaved four to a group, one per simd lane: positions, heights and wave parameters are all stored
+// lane by lane, so each vertex of a group is one full vector and the normal stencil never has a tail. a shape whose
+// count is not a multiple of four pads its last group with copies of a real body, and their results are dropped.
+// groups are merged into tiles of at least tilevertices for the task system. every body ends up with exactly the
+// vertices its own updatewaves would give it.
+class volumebatch {
+public:
+    static constexpr int tilevertices = 16384;
+
+    volumebatch(const std::vector<watervolume*>& members, tasksystem* tasks) : bodies(members), tasks(tasks) {
+        std::vector<int> order;
+        for (int i = 0; i < int(bodies.size()); ++i) order.push_back(i);
+        auto shape = [&](int i) { return std::make_pair(bodies[i]->columns(), bodies[i]->rows()); };
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return shape(a) < shape(b); });
+
+        int tilesize = 0;
+        for (size_t i = 0; i < order.size();) {
+            group g;
+            auto [columns, rows] = shape(order[i]);
+            g.columns = columns;
+            g.rows = rows;
+            g.offset = xs.size();
+            for (int lane = 0; lane < 4; ++lane) {
+                g.members[lane] = i < order.size() && shape(order[i]) == std::make_pair(columns, rows) ? order[i++] : -1;
+            }
+            // the positions never change, so they are packed once
+            size_t cells = size_t(g.columns) * g.rows;
+            xs.resize(xs.size() + 4 * cells);
+            zs.resize(zs.size() + 4 * cells);
+            for (int lane = 0; lane < 4; ++lane) {
+                const watervolume& body = *bodies[g.members[lane] >= 0 ? g.members[lane] : g.members[0]];
+                for (size_t c = 0; c < cells; ++c) {
+                    xs[g.offset + 4 * c + lane] = body.vertices[c].x;
+                    zs[g.offset + 4 * c + lane] = body.vertices[c].z;
+                }
+            }
+            if (tilesize == 0) tiles.push_back(int(groups.size()));
+            tilesize += int(4 * cells);
+            if (tilesize >= tilevertices) tilesize = 0;
+            groups.push_back(g);
+        }
+        tiles.push_back(int(groups.size()));
+        ys.resize(xs.size());
+    }
+
+    // the same update as calling updatewaves(time) on every body, in one parallel sweep over the tiles
+    void updatewaves(double time) {
+        auto sweep = [&](int t0, int t1) {
+            for (int t = t0; t < t1; ++t) {
+                for (int g = tiles[t]; g < tiles[t + 1]; ++g) evaluate(groups[g], time);
+            }
+        };
+        if (tasks) {
+            tasks->parallelfor(int(tiles.size()) - 1, 1, sweep);
+        }
+        else {
+            sweep(0, int(tiles.size()) - 1);
+        }
+    }
+
+    // surface vertices evaluated per update, padding lanes not counted
+    size_t vertexcount() const {
+        size_t count = 0;
+        for (const watervolume* body : bodies) count += size_t(body->columns()) * body->rows();
+        return count;
+    }
+
+    int groupcount() const { return int(groups.size()); }
+    int tilecount() const { return int(tiles.size()) - 1; }
+
+private:
+    struct group {
+        int columns = 0, rows = 0;
+        size_t offset = 0;  // of the group's first lane in xs, zs and ys
+        int members[4];     // bodies in lane order, -1 for padding
+    };
+
+    std::vector<watervolume*> bodies;
+    tasksystem* tasks;
+    std::vector<group> groups;
+    std::vector<int> tiles;  // first group of each tile, then one past the last
+    std::vector<float> xs, zs, ys;
+
+    // one group: heights as in watervolume::evaluaterow, then the bottom offset and normalrows' stencil, four bodies
+    // at a time. the arithmetic is the same operation for operation, so the results are bit-identical.
+    void evaluate(const group& g, double time) {
+        alignas(16) float amplitude1[4], amplitude2[4], frequency1[4], frequency2[4], offset1[4], offset2[4], thickness[4];
+        vertex* out[4];
+        for (int lane = 0; lane < 4; ++lane) {
+            watervolume& body = *bodies[g.members[lane] >= 0 ? g.members[lane] : g.members[0]];
+            amplitude1[lane] = body.waves.amplitude1;
+            amplitude2[lane] = body.waves.amplitude2;
+            frequency1[lane] = body.waves.frequency1;
+            frequency2[lane] = body.waves.frequency2;
+            wavephases phase = phasesat(body.waves, time);
+            offset1[lane] = phase.offset1;
+            offset2[lane] = phase.offset2;
+            thickness[lane] = body.layerthickness();
+            out[lane] = g.members[lane] >= 0 ? body.vertices.data() : nullptr;
+        }
+        glm::vec2 dir1 = glm::normalize(glm::vec2(1.0f, 0.2f));
+        glm::vec2 dir2 = glm::normalize(glm::vec2(0.2f, 1.0f));
+        int columns = g.columns, rows = g.rows;
+        size_t cells = size_t(columns) * rows;
+        const float* x = &xs[g.offset];
+        const float* z = &zs[g.offset];
+        float* y = &ys[g.offset];
+
+        // heights as in watervolume::evaluaterow, a row at a time
+#ifdef FLUIDSIM_SSE2
+        __m128 a1 = _mm_load_ps(amplitude1), a2 = _mm_load_ps(amplitude2);
+        __m128 f1 = _mm_load_ps(frequency1), f2 = _mm_load_ps(frequency2);
+        __m128 o1 = _mm_load_ps(offset1), o2 = _mm_load_ps(offset2);
+        __m128 dx1 = _mm_set1_ps(dir1.x), dz1 = _mm_set1_ps(dir1.y), dx2 = _mm_set1_ps(dir2.x), dz2 = _mm_set1_ps(dir2.y);
+        int tier = g_kernel.simd == 1 ? g_kernel.sinetier : 0;
+#endif
+        auto heightrow = [&](int r) {
+            for (size_t c = size_t(r) * columns; c < size_t(r + 1) * columns; ++c) {
+#ifdef FLUIDSIM_SSE2
+                __m128 px = _mm_load_ps(x + 4 * c), pz = _mm_load_ps(z + 4 * c);
+                __m128 p1 = _mm_sub_ps(_mm_mul_ps(f1, _mm_add_ps(_mm_mul_ps(dx1, px), _mm_mul_ps(dz1, pz))), o1);
+                __m128 p2 = _mm_sub_ps(_mm_mul_ps(f2, _mm_add_ps(_mm_mul_ps(dx2, px), _mm_mul_ps(dz2, pz))), o2);
+                __m128 sin1, sin2;
+                if (tier == 1) {
+                    sin1 = fastsin4<1>(p1);
+                    sin2 = fastsin4<1>(p2);
+                }
+                else if (tier == 2) {
+                    sin1 = fastsin4<2>(p1);
+                    sin2 = fastsin4<2>(p2);
+                }
+                else {
+                    // the exact kernels and scalar polynomial ones go lane by lane, as they do in the volume
+                    alignas(16) float lanes1[4], lanes2[4];
+                    _mm_store_ps(lanes1, p1);
+                    _mm_store_ps(lanes2, p2);
+                    for (int lane = 0; lane < 4; ++lane) {
+                        lanes1[lane] = scalarsin(lanes1[lane]);
+                        lanes2[lane] = scalarsin(lanes2[lane]);
+                    }
+                    sin1 = _mm_load_ps(lanes1);
+                    sin2 = _mm_load_ps(lanes2);
+                }
+                _mm_store_ps(y + 4 * c, _mm_add_ps(_mm_mul_ps(a1, sin1), _mm_mul_ps(a2, sin2)));
+#else
+                for (int lane = 0; lane < 4; ++lane) {
+                    float px = x[4 * c + lane], pz = z[4 * c + lane];
+                    float dot1 = glm::dot(dir1, glm::vec2(px, pz));
+                    float dot2 = glm::dot(dir2, glm::vec2(px, pz));
+                    y[4 * c + lane] = amplitude1[lane] * scalarsin(frequency1[lane] * dot1 - offset1[lane]) +
+                        amplitude2[lane] * scalarsin(frequency2[lane] * dot2 - offset2[lane]);
+                }
+#endif
+            }
+        };
+
+        // then one pass over the bodies' vertices, heights staying a row ahead so the stencil's rows are still in
+        // cache: heights of every vertex, normals of the interior ones. the top normal is normalize(-dx, 1, -dz) and
+        // the bottom one comes from the offset heights, as in normalrows. negation flips the sign bit, so a zero
+        // slope gives the same -0 it does there.
+#ifdef FLUIDSIM_SSE2
+        __m128 half = _mm_set1_ps(0.5f), one = _mm_set1_ps(1.0f), sign = _mm_set1_ps(-0.0f), th = _mm_load_ps(thickness);
+#endif
+        heightrow(0);
+        for (int r = 0; r < rows; ++r) {
+            if (r + 1 < rows) heightrow(r + 1);
+            bool edgerow = r == 0 || r == rows - 1;
+            for (int col = 0; col < columns; ++col) {
+                size_t c = size_t(col) + size_t(r) * columns;
+                if (edgerow || col == 0 || col == columns - 1) {
+                    for (int lane = 0; lane < 4; ++lane) {
+                        if (!out[lane]) continue;
+                        out[lane][c].y = y[4 * c + lane];
+                        out[lane][cells + c].y = y[4 * c + lane] - thickness[lane];
+                    }
+                    continue;
+                }
+#ifdef FLUIDSIM_SSE2
+                __m128 px = _mm_load_ps(x + 4 * c), pz = _mm_load_ps(z + 4 * c), yc = _mm_load_ps(y + 4 * c);
+                __m128 yl = _mm_load_ps(y + 4 * (c - 1)), yr = _mm_load_ps(y + 4 * (c + 1));
+                __m128 yd = _mm_load_ps(y + 4 * (c - columns)), yu = _mm_load_ps(y + 4 * (c + columns));
+                __m128 dx = _mm_mul_ps(_mm_sub_ps(yr, yl), half), dz = _mm_mul_ps(_mm_sub_ps(yu, yd), half);
+                __m128 nx = _mm_xor_ps(dx, sign), nz = _mm_xor_ps(dz, sign);
+                __m128 scale = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), one), _mm_mul_ps(nz, nz))));
+                storelanes(out, c, px, yc, pz, _mm_mul_ps(nx, scale), scale, _mm_mul_ps(nz, scale));
+                dx = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(yr, th), _mm_sub_ps(yl, th)), half);
+                dz = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(yu, th), _mm_sub_ps(yd, th)), half);
+                scale = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), one), _mm_mul_ps(dz, dz))));
+                storelanes(out, cells + c, px, _mm_sub_ps(yc, th), pz, _mm_mul_ps(dx, scale), _mm_xor_ps(scale, sign),
+                    _mm_mul_ps(dz, scale));
+#else
+                for (int lane = 0; lane < 4; ++lane) {
+                    if (!out[lane]) continue;
+                    float yl = y[4 * (c - 1) + lane], yr = y[4 * (c + 1) + lane];
+                    float yd = y[4 * (c - columns) + lane], yu = y[4 * (c + columns) + lane];
+                    float t = thickness[lane];
+                    glm::vec3 n = glm::normalize(glm::vec3(-(yr - yl) * 0.5f, 1.0f, -(yu - yd) * 0.5f));
+                    glm::vec3 m = glm::normalize(glm::vec3(((yr - t) - (yl - t)) * 0.5f, -1.0f, ((yu - t) - (yd - t)) * 0.5f));
+                    out[lane][c] = { x[4 * c + lane], y[4 * c + lane], z[4 * c + lane], n.x, n.y, n.z };
+                    out[lane][cells + c] = { x[4 * c + lane], y[4 * c + lane] - t, z[4 * c + lane], m.x, m.y, m.z };
+                }
+#endif
+            }
+        }
+    }
+
+#ifdef FLUIDSIM_SSE2
+    // writes vertex i of each lane's body from six vectors of lanes: one transpose turns x, y, z and nx into four
+    // whole-vertex prefixes, and interleaving ny with nz gives the pairs that finish them
+    static void storelanes(vertex* const* out, size_t i, __m128 x, __m128 y, __m128 z, __m128 nx, __m128 ny, __m128 nz) {
+        _MM_TRANSPOSE4_PS(x, y, z, nx);
+        __m128 low = _mm_unpacklo_ps(ny, nz), high = _mm_unpackhi_ps(ny, nz);
+        __m128 prefix[4] = { x, y, z, nx };
+        for (int lane = 0; lane < 4; ++lane) {
+            if (!out[lane]) continue;
+            vertex& v = out[lane][i];
+            _mm_storeu_ps(&v.x, prefix[lane]);
+            if (lane & 1) _mm_storeh_pi((__m64*)&v.ny, lane < 2 ? low : high);
+            else _mm_storel_pi((__m64*)&v.ny, lane < 2 ? low : high);
+        }
+    }
+#endif
+
+    static float scalarsin(float x) {
+        switch (g_kernel.sinetier) {
+        case 1:  return fastsin<1>(x);
+        case 2:  return fastsin<2>(x);
+        default: return fastsin<0>(x);
+        }
+    }
+};
+
+#ifdef FLUIDSIM_OPENCL
+// the wave update as opencl kernels, one work item per grid point. vertices are six floats (position, normal).
+// heights use the built-in sin, which is not bit-identical to sinf, so replays checksum differently than on the cpu.
+static const char* wave_kernel_source = R"(
+__kernel void evaluatewaves(__global float* vertices, int gridwidth, int griddepth, float thickness, float offset1,
+    float offset2, float amplitude1, float amplitude2, float frequency1, float frequency2,
+    float dir1x, float dir1z, float dir2x, float dir2z)
+{
+    int x = get_global_id(0);
+    int z = get_global_id(1);
+    int idx = x + z * gridwidth;
+    __global float* top = vertices + 6 * idx;
+    float px = top[0];
+    float pz = top[2];
+    float dot1 = dir1x * px + dir1z * pz;
+    float dot2 = dir2x * px + dir2z * pz;
+    float y = amplitude1 * sin(frequency1 * dot1 - offset1) + amplitude2 * sin(frequency2 * dot2 - offset2);
+    top[1] = y;
+    vertices[6 * (idx + gridwidth * griddepth) + 1] = y - thickness;
+}
+
+__kernel void computenormals(__global float* vertices, int gridwidth, int griddepth)
+{
+    int x = get_global_id(0);
+    int z = get_global_id(1);
+    if (x < 1 || z < 1 || x >= gridwidth - 1 || z >= griddepth - 1) return;
+    for (int surface = 0; surface < 2; ++surface) {
+        int idx = surface * gridwidth * griddepth + x + z * gridwidth;
+        float dx = (vertices[6 * (idx + 1) + 1] - vertices[6 * (idx - 1) + 1]) * 0.5f;
+        float dz = (vertices[6 * (idx + gridwidth) + 1] - vertices[6 * (idx - gridwidth) + 1]) * 0.5f;
+        // the bottom surface faces down
+        float3 n = surface == 0 ? normalize((float3)(-dx, 1.0f, -dz)) : normalize((float3)(dx, -1.0f, dz));
+        vertices[6 * idx + 3] = n.x;
+        vertices[6 * idx + 4] = n.y;
+        vertices[6 * idx + 5] = n.z;
+    }
+}
+)";
+
+// runs the wave update on an opencl device. the device buffer wraps the volume's own vertex array
+// (CL_MEM_USE_HOST_PTR), and results come back by mapping it, which on cpu devices such as pocl is free.
+// every consumer of the surface (culling, uploads to each frame slot, replay checksums) reads that host
+// array, so results are not written straight into gl buffers.
+class openclcompute : public computebackend {
+public:
+    ~openclcompute() override {
+        if (buffer) clReleaseMemObject(buffer);
+        if (waves) clReleaseKernel(waves);
+        if (normals) clReleaseKernel(normals);
+        if (program) clReleaseProgram(program);
+        if (queue) clReleaseCommandQueue(queue);
+        if (context) clReleaseContext(context);
+    }
+
+    const char* name() const override { return "opencl"; }
+
+    // picks the first gpu, or else the first device of any kind, and builds the kernels
+    bool init(std::string& error) {
+        cl_uint platformcount = 0;
+        if (clGetPlatformIDs(0, nullptr, &platformcount) != CL_SUCCESS || platformcount == 0) {
+            error = "no opencl platform";
+            return false;
+        }
+        std::vector<cl_platform_id> platforms(platformcount);
+        clGetPlatformIDs(platformcount, platforms.data(), nullptr);
+        cl_device_id device = nullptr;
+        for (cl_device_type type : { cl_device_type(CL_DEVICE_TYPE_GPU), cl_device_type(CL_DEVICE_TYPE_ALL) }) {
+            for (cl_platform_id platform : platforms) {
+                if (!device && clGetDeviceIDs(platform, type, 1, &device, nullptr) != CL_SUCCESS) device = nullptr;
+            }
+        }
+        if (!device) {
+            error = "no opencl device";
+            return false;
+        }
+        char name[256] = {};
+        clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name) - 1, name, nullptr);
+        devicename = name;
+
+        cl_int status = CL_SUCCESS;
+        context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &status);
+        if (status == CL_SUCCESS) queue = clCreateCommandQueue(context, device, 0, &status);
+        if (status == CL_SUCCESS) program = clCreateProgramWithSource(context, 1, &wave_kernel_source, nullptr, &status);
+        if (status != CL_SUCCESS) {
+            error = "could not create an opencl context on " + devicename;
+            return false;
+        }
+        if (clBuildProgram(program, 1, &device, "-cl-mad-enable", nullptr, nullptr) != CL_SUCCESS) {
+            size_t size = 0;
+            clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &size);
+            std::string log(size, '\0');
+            clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, size, log.data(), nullptr);
+            error = "kernel build failed on " + devicename + ":\n" + log;
+            return false;
+        }
+        waves = clCreateKernel(program, "evaluatewaves", &status);
+        if (status == CL_SUCCESS) normals = clCreateKernel(program, "computenormals", &status);
+        if (status != CL_SUCCESS) {
+            error = "could not create the wave kernels";
+            return false;
+        }
+        return true;
+    }
+
+    bool updatewaves(watervolume& water, const wavephases& phase) override {
+        // the kernels and their arguments are shared by every volume using this backend
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!failure.empty()) return false;
+        auto start = std::chrono::steady_clock::now();
+        size_t bytes = water.vertices.size() * sizeof(vertex);
+        if (water.vertices.data() != bound || bytes != boundbytes) {
+            // a new volume, after a resize
+            if (buffer) clReleaseMemObject(buffer);
+            bound = nullptr;
+            cl_int status = CL_SUCCESS;
+            buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, bytes, water.vertices.data(), &status);
+            if (status != CL_SUCCESS) {
+                buffer = nullptr;
+                return fail("clCreateBuffer", status);
+            }
+            bound = water.vertices.data();
+            boundbytes = bytes;
+        }
+
+        cl_int gridwidth = water.columns(), griddepth = water.rows();
+        float thickness = water.layerthickness();
+        const waveparams& p = water.waves;
+        glm::vec2 dir1 = glm::normalize(glm::vec2(1.0f, 0.2f));
+        glm::vec2 dir2 = glm::normalize(glm::vec2(0.2f, 1.0f));
+        float values[] = { phase.offset1, phase.offset2, p.amplitude1, p.amplitude2, p.frequency1, p.frequency2, dir1.x, dir1.y, dir2.x, dir2.y };
+        // keeps the first error
+        cl_int status = CL_SUCCESS;
+        auto arg = [&](cl_kernel kernel, cl_uint index, size_t size, const void* value) {
+            if (status == CL_SUCCESS) status = clSetKernelArg(kernel, index, size, value);
+        };
+        arg(waves, 0, sizeof(cl_mem), &buffer);
+        arg(waves, 1, sizeof(cl_int), &gridwidth);
+        arg(waves, 2, sizeof(cl_int), &griddepth);
+        arg(waves, 3, sizeof(float), &thickness);
+        for (cl_uint i = 0; i < 10; ++i) arg(waves, 4 + i, sizeof(float), &values[i]);
+        arg(normals, 0, sizeof(cl_mem), &buffer);
+        arg(normals, 1, sizeof(cl_int), &gridwidth);
+        arg(normals, 2, sizeof(cl_int), &griddepth);
+        if (status != CL_SUCCESS) return fail("clSetKernelArg", status);
+
+        // the queue is in order, so the normal stencil sees every height
+        size_t global[2] = { size_t(gridwidth), size_t(griddepth) };
+        status = clEnqueueNDRangeKernel(queue, waves, 2, nullptr, global, nullptr, 0, nullptr, nullptr);
+        if (status != CL_SUCCESS) return fail("clEnqueueNDRangeKernel(evaluatewaves)", status);
+        status = clEnqueueNDRangeKernel(queue, normals, 2, nullptr, global, nullptr, 0, nullptr, nullptr);
+        if (status != CL_SUCCESS) return fail("clEnqueueNDRangeKernel(computenormals)", status);
+        void* mapped = clEnqueueMapBuffer(queue, buffer, CL_TRUE, CL_MAP_READ, 0, bytes, 0, nullptr, nullptr, &status);
+        if (status != CL_SUCCESS) return fail("clEnqueueMapBuffer", status);
+        status = clEnqueueUnmapMemObject(queue, buffer, mapped, 0, nullptr, nullptr);
+        if (status != CL_SUCCESS) return fail("clEnqueueUnmapMemObject", status);
+        status = clFinish(queue);
+        if (status != CL_SUCCESS) return fail("clFinish", status);
+        seconds += secondssince(start);
+        ++updates;
+        return true;
+    }
+
+    void report() const override {
+        printf("  opencl on %s: %ld wave updates, %.3f ms each including readback\n", devicename.c_str(), updates,
+            updates ? 1000.0 * seconds / updates : 0.0);
+        if (!failure.empty()) printf("  opencl failed and the cpu kernels took over: %s\n", failure.c_str());
+    }
+
+    std::string devicename;
+
+private:
+    cl_context context = nullptr;
+    cl_command_queue queue = nullptr;
+    cl_program program = nullptr;
+    cl_kernel waves = nullptr, normals = nullptr;
+    cl_mem buffer = nullptr;
+    const vertex* bound = nullptr;
+    size_t boundbytes = 0;
+    std::mutex mutex;
+    double seconds = 0;
+    long updates = 0;
+    std::string failure;
+
+    // gives up on the device for the rest of the run. whatever was already queued finishes first, since the
+    // buffer aliases the host vertices the cpu kernels are about to write
+    bool fail(const char* call, cl_int status) {
+        clFinish(queue);
+        if (buffer) clReleaseMemObject(buffer);
+        buffer = nullptr;
+        bound = nullptr;
+        failure = std::string(call) + " returned " + std::to_string(status);
+        std::cerr << "opencl wave update failed, " << failure << "; using the cpu kernels\n";
+        return false;
+    }
+};
+#endif
+
+// bathymetry streamed from a tiled file far larger than memory. the file is a 64 KiB header followed by
+// square tiles of raw float heights (metres relative to sea level) in row-major tile order, so a tile's offset
+// follows from its index and every tile starts on a mapping boundary. tiles are mapped one at a time and
+// kept in an lru list under a byte budget; an i/o thread maps tiles ahead of the camera and faults in their pages.
+class tilecache {
+public:
+    struct fileheader {
+        char magic[8];
+        uint32_t tilesize, tilesx, tilesz;
+        float cellsize, originx, originz;
+    };
+    static constexpr size_t headerbytes = 64 << 10;
+    static constexpr float deepwater = -1000.0f;  // outside the dataset
+
+    ~tilecache() { close(); }
+
+    bool open(const std::string& path, size_t budgetbytes, std::string& error) {
+        uint64_t filebytes = 0;
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            error = "cannot open it";
+            return false;
+        }
+        LARGE_INTEGER filesize;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        DWORD bytesread = 0;
+        if (!mapping || !GetFileSizeEx(file, &filesize) || !ReadFile(file, &header, sizeof(header), &bytesread, nullptr) ||
+            bytesread != sizeof(header)) {
+            error = "cannot read its header";
+            return false;
+        }
+        filebytes = uint64_t(filesize.QuadPart);
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = std::string("cannot open it: ") + strerror(errno);
+            return false;
+        }
+        off_t end = lseek(fd, 0, SEEK_END);
+        if (end < 0 || pread(fd, &header, sizeof(header), 0) != ssize_t(sizeof(header))) {
+            error = "cannot read its header";
+            return false;
+        }
+        filebytes = uint64_t(end);
+#endif
+        tilebytes = size_t(header.tilesize) * header.tilesize * sizeof(float);
+        // tiles are mapped individually, so each must start on the 64 KiB windows mapping granularity. a mapping
+        // past the end of the file still succeeds and faults on first touch, so the file must hold every tile.
+        uint64_t tiles = uint64_t(header.tilesx) * header.tilesz;
+        const char* bad = nullptr;
+        if (memcmp(header.magic, "FSBATHY1", 8) != 0) bad = "magic";
+        else if (header.tilesize == 0 || header.tilesize > 16384 || tilebytes % (64 << 10) != 0) bad = "tile size";
+        else if (tiles == 0 || tiles > uint64_t(std::numeric_limits<int>::max())) bad = "tile count";
+        else if (!(header.cellsize > 0.0f) || !std::isfinite(header.cellsize)) bad = "cell size";
+        else if (!std::isfinite(header.originx) || !std::isfinite(header.originz)) bad = "origin";
+        if (bad) {
+            error = std::string("header has an invalid ") + bad;
+            return false;
+        }
+        if (filebytes < headerbytes || (filebytes - headerbytes) / tilebytes < tiles) {
+            error = "file is shorter than its header says";
+            return false;
+        }
+        budget = std::max(budgetbytes, tilebytes);
+        stopping = false;
+        io = std::thread([this] { ioloop(); });
+        return true;
+    }
+
+    void close() {
+        if (io.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            requestcv.notify_all();
+            io.join();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& entry : resident) unmap(entry.second);
+        resident.clear();
+        lru.clear();
+#ifdef _WIN32
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+    }
+
+    // bilinear height at a world position. returns false, after queueing the missing tile, when a needed tile
+    // is not resident; with wait set it loads the tile on the calling thread instead and counts the stall.
+    bool sample(double x, double z, float& height, bool wait) {
+        double fx = (x - header.originx) / header.cellsize, fz = (z - header.originz) / header.cellsize;
+        double x0 = std::floor(fx), z0 = std::floor(fz);
+        // every corner is outside the dataset; tested before the casts below, which a far position would overflow
+        double size = header.tilesize;
+        if (!(x0 >= -1.0 && z0 >= -1.0 && x0 < size * header.tilesx && z0 < size * header.tilesz)) {
+            height = deepwater;
+            return true;
+        }
+        float tx = float(fx - x0), tz = float(fz - z0);
+        float corners[4];
+        // one lock for all four corners; a waiting lookup releases it only while a tile loads
+        std::unique_lock<std::mutex> lock(mutex);
+        for (int c = 0; c < 4; ++c) {
+            if (!lookup((long long)x0 + (c & 1), (long long)z0 + (c >> 1), corners[c], wait, lock)) {
+                lock.unlock();
+                requestcv.notify_one();
+                return false;
+            }
+        }
+        lock.unlock();
+        height = (corners[0] * (1 - tx) + corners[1] * tx) * (1 - tz) + (corners[2] * (1 - tx) + corners[3] * tx) * tz;
+        return true;
+    }
+
+    // queues the tiles within radius of a world position, nearest first, up to what the budget can hold
+    void prefetch(double x, double z, double radius) {
+        double tileworld = double(header.tilesize) * header.cellsize;
+        // clamped to just past the dataset, which queues the same tiles and keeps the casts in range
+        int reach = int(std::clamp(std::ceil(radius / tileworld), 0.0, double(std::max(header.tilesx, header.tilesz))));
+        long long cx = (long long)std::clamp(std::floor((x - header.originx) / tileworld), -1.0 - reach, double(header.tilesx) + reach);
+        long long cz = (long long)std::clamp(std::floor((z - header.originz) / tileworld), -1.0 - reach, double(header.tilesz) + reach);
+        std::vector<std::pair<long long, int>> wanted;
+        for (int dz = -reach; dz <= reach; ++dz) {
+            for (int dx = -reach; dx <= reach; ++dx) {
+                long long tx = cx + dx, tz = cz + dz;
+                if (tx < 0 || tz < 0 || tx >= header.tilesx || tz >= header.tilesz) continue;
+                wanted.push_back({ dx * dx + dz * dz, int(tx + tz * header.tilesx) });
+            }
+        }
+        std::sort(wanted.begin(), wanted.end());
+        wanted.resize(std::min(wanted.size(), budget / tilebytes));
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& [distance, index] : wanted) {
+                if (!resident.count(index)) request(index);
+            }
+        }
+        requestcv.notify_one();
+    }
+
+    // bumped whenever a tile becomes resident, so callers know when deferred samples can be retried
+    unsigned generation() const { return loadedgeneration.load(std::memory_order_acquire); }
+
+    void report() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        long long lookups = hits + misses;
+        printf("  bathymetry tiles: hit rate %.2f%% (%lld lookups, %lld misses), %lld loaded, %lld evicted, %zu resident (%.1f MB)\n",
+            lookups ? 100.0 * hits / lookups : 100.0, lookups, misses, loads, evictions, resident.size(), resident.size() * tilebytes / 1048576.0);
+        printf("  i/o thread busy %.3f s, simulation stalled on tiles %.3f s\n", iotime, stalltime);
+        if (!failed.empty()) printf("  %zu tiles could not be mapped and read as open sea: %s\n", failed.size(), failure.c_str());
+    }
+
+private:
+    struct tile {
+        const float* data = nullptr;
+        std::list<int>::iterator position;
+    };
+
+    fileheader header{};
+    size_t tilebytes = 0, budget = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE, mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+    mutable std::mutex mutex;
+    std::condition_variable requestcv;
+    std::unordered_map<int, tile> resident;
+    std::list<int> lru;  // most recently used first
+    std::deque<int> requests;
+    std::vector<int> requested;  // tile indices already queued, kept small by the budget
+    std::unordered_set<int> failed;  // tiles whose mapping failed; they are not requested again
+    std::string failure;  // the first mapping error
+    std::thread io;
+    bool stopping = false;
+    std::atomic<unsigned> loadedgeneration{ 0 };
+    long long hits = 0, misses = 0, loads = 0, evictions = 0;
+    double iotime = 0, stalltime = 0;
+
+    // callers hold the lock. a miss without wait queues the tile and returns false for the caller to notify the
+    // i/o thread once it has unlocked.
+    bool lookup(long long sx, long long sz, float& height, bool wait, std::unique_lock<std::mutex>& lock) {
+        long long size = header.tilesize;
+        if (sx < 0 || sz < 0 || sx >= size * header.tilesx || sz >= size * header.tilesz) {
+            height = deepwater;
+            return true;
+        }
+        int index = int(sx / size + sz / size * header.tilesx);
+        auto found = resident.find(index);
+        if (found == resident.end()) {
+            ++misses;
+            if (failed.count(index)) {
+                height = deepwater;
+                return true;
+            }
+            if (!wait) {
+                request(index);
+                return false;
+            }
+            lock.unlock();
+            auto start = std::chrono::steady_clock::now();
+            load(index);
+            lock.lock();
+            stalltime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            found = resident.find(index);
+            if (found == resident.end()) {
+                // the mapping failed or the tile was evicted again right away; treat it as open sea
+                height = deepwater;
+                return true;
+            }
+        }
+        else {
+            ++hits;
+        }
+        lru.splice(lru.begin(), lru, found->second.position);
+        height = found->second.data[(sx % size) + (sz % size) * size];
+        return true;
+    }
+
+    // callers hold the mutex
+    void request(int index) {
+        if (failed.count(index)) return;
+        if (std::find(requested.begin(), requested.end(), index) != requested.end()) return;
+        requested.push_back(index);
+        requests.push_back(index);
+    }
+
+    void ioloop() {
+        for (;;) {
+            int index;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                requestcv.wait(lock, [&] { return stopping || !requests.empty(); });
+                if (stopping) return;
+                index = requests.front();
+                requests.pop_front();
+            }
+            auto start = std::chrono::steady_clock::now();
+            load(index);
+            std::lock_guard<std::mutex> lock(mutex);
+            iotime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    // maps a tile and faults its pages in before publishing it, so lookups never touch the disk
+    void load(int index) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (resident.count(index)) return;
+        }
+        size_t offset = headerbytes + size_t(index) * tilebytes;
+#ifdef _WIN32
+        const void* view = MapViewOfFile(mapping, FILE_MAP_READ, DWORD(uint64_t(offset) >> 32), DWORD(offset), tilebytes);
+        if (!view) {
+            fail(index, "MapViewOfFile error " + std::to_string(GetLastError()));
+            return;
+        }
+#else
+        void* view = mmap(nullptr, tilebytes, PROT_READ, MAP_PRIVATE, fd, off_t(offset));
+        if (view == MAP_FAILED) {
+            fail(index, std::string("mmap: ") + strerror(errno));
+            return;
+        }
+        madvise(view, tilebytes, MADV_WILLNEED);
+#endif
+        const float* data = static_cast<const float*>(view);
+        volatile float touch = 0;
+        for (size_t i = 0; i < tilebytes / sizeof(float); i += 1024) touch = touch + data[i];
+
+        std::lock_guard<std::mutex> lock(mutex);
+        requested.erase(std::remove(requested.begin(), requested.end(), index), requested.end());
+        if (resident.count(index)) {
+            unmap(data);  // loaded on both threads at once; keep the first
+            return;
+        }
+        lru.push_front(index);
+        resident[index] = { data, lru.begin() };
+        ++loads;
+        while (resident.size() * tilebytes > budget) {
+            auto victim = resident.find(lru.back());
+            unmap(victim->second.data);
+            resident.erase(victim);
+            lru.pop_back();
+            ++evictions;
+        }
+        loadedgeneration.fetch_add(1, std::memory_order_release);
+    }
+
+    // takes a tile that could not be mapped out of the queue for good, so lookups read it as open sea instead of
+    // waiting on it forever
+    void fail(int index, const std::string& error) {
+        std::lock_guard<std::mutex> lock(mutex);
+        requested.erase(std::remove(requested.begin(), requested.end(), index), requested.end());
+        if (failed.empty()) failure = "tile " + std::to_string(index) + ", " + error;
+        failed.insert(index);
+        loadedgeneration.fetch_add(1, std::memory_order_release);
+    }
+
+    void unmap(const tile& t) { unmap(t.data); }
+    void unmap(const float* data) {
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap(const_cast<float*>(data), tilebytes);
+#endif
+    }
+};
+
+// writes a procedural test dataset of samples x samples heights one tile row at a time, so its size is not
+// limited by memory. the terrain is a few octaves of value noise: deep basins, shelves and some islands.
+bool writebathymetry(const std::string& path, int samples, float cellsize) {
+    const uint32_t tilesize = 256;
+    uint32_t tiles = (uint32_t(samples) + tilesize - 1) / tilesize;
+    FILE* out = fopen(path.c_str(), "wb");
+    if (!out) return false;
+    std::vector<char> headerblock(tilecache::headerbytes, 0);
+    tilecache::fileheader header{ { 'F', 'S', 'B', 'A', 'T', 'H', 'Y', '1' }, tilesize, tiles, tiles,
+        cellsize, -0.5f * tiles * tilesize * cellsize, -0.5f * tiles * tilesize * cellsize };
+    memcpy(headerblock.data(), &header, sizeof(header));
+    fwrite(headerblock.data(), 1, headerblock.size(), out);
+
+    auto lattice = [](int x, int z) {
+        uint32_t h = uint32_t(x) * 374761393u + uint32_t(z) * 668265263u;
+        h = (h ^ (h >> 13)) * 1274126177u;
+        return float((h ^ (h >> 16)) & 0xffff) / 65535.0f;
+    };
+    auto noise = [&](float x, float z) {
+        int x0 = int(std::floor(x)), z0 = int(std::floor(z));
+        float tx = x - x0, tz = z - z0;
+        tx = tx * tx * (3 - 2 * tx);
+        tz = tz * tz * (3 - 2 * tz);
+        float a = lattice(x0, z0) + (lattice(x0 + 1, z0) - lattice(x0, z0)) * tx;
+        float b = lattice(x0, z0 + 1) + (lattice(x0 + 1, z0 + 1) - lattice(x0, z0 + 1)) * tx;
+        return a + (b - a) * tz;
+    };
+    std::vector<float> tile(size_t(tilesize) * tilesize);
+    for (uint32_t tz = 0; tz < tiles; ++tz) {
+        for (uint32_t tx = 0; tx < tiles; ++tx) {
+            for (uint32_t z = 0; z < tilesize; ++z) {
+                for (uint32_t x = 0; x < tilesize; ++x) {
+                    float wx = float(tx * tilesize + x) / 600.0f, wz = float(tz * tilesize + z) / 600.0f;
+                    float h = 0, amplitude = 1;
+                    for (int octave = 0; octave < 5; ++octave) {
+                        h += amplitude * noise(wx, wz);
+                        wx *= 2.0f;
+                        wz *= 2.0f;
+                        amplitude *= 0.5f;
+                    }
+                    tile[x + z * tilesize] = (h / 1.9375f - 0.62f) * 160.0f;
+                }
+            }
+            if (fwrite(tile.data(), sizeof(float), tile.size(), out) != tile.size()) {
+                fclose(out);
+                return false;
+            }
+        }
+    }
+    return fclose(out) == 0;
+}
+
+// open water as geometry clipmaps: nested square grids of the same vertex count centred on the camera,
+// each level twice as coarse as the one inside it. the outer levels leave a hole where the next finer
+// level sits, so vertex count and per-frame cost stay fixed however far the camera travels.
+// the spatial part of each wave's phase never changes, so its sine and cosine are cached per vertex in a
+// toroidal (wrap-around) array; a moving camera only recomputes the strips that newly came into view and
+// every frame combines the cache with the time phase using the angle difference identities.
+// with bathymetry attached the cache also holds each vertex's sea floor height and shoaling factor; samples
+// whose tiles are not resident yet are retried once the tile cache reports new arrivals.
+class clipmap {
+public:
+    clipmap(int levelcount, int size, float finestspacing)
+        : levels(levelcount), n(size), spacing0(finestspacing)
+    {
+        // the grid origin snaps to twice the level spacing and sits half a grid behind the camera,
+        // so (n - 1) must be a multiple of four for the hole edges to land on coarse vertices
+        n = std::max(9, (size - 1) / 4 * 4 + 1);
+        vertices.resize(size_t(levels) * n * n);
+        cache.resize(levels);
+        for (auto& level : cache) level.points.resize(size_t(n) * n);
+        buildindices();
+    }
+
+    // recomputes the surface around the camera for the given time; only the levels' new strips touch the trig cache
+    void update(float camerax, float cameraz, double time, const waveparams& waves) {
+        glm::vec2 dir1 = glm::normalize(glm::vec2(1.0f, 0.2f));
+        glm::vec2 dir2 = glm::normalize(glm::vec2(0.2f, 1.0f));
+        for (int l = 0; l < levels; ++l) {
+            double spacing = spacing0 * double(1 << l);
+            int half = (n - 1) / 2;
+            int ox = 2 * int(std::floor(camerax / (2.0 * spacing))) - half;
+            int oz = 2 * int(std::floor(cameraz / (2.0 * spacing))) - half;
+            refreshcache(cache[l], ox, oz, spacing, waves, dir1, dir2);
+            if (terrain && terraingeneration != terrain->generation()) retrystale(cache[l], spacing, waves, dir1, dir2);
+            // the finer level snaps to this level's spacing, so the hole sits one of two cells in along each axis
+            cache[l].holevariant = (int(std::floor(camerax / spacing)) & 1) + 2 * (int(std::floor(cameraz / spacing)) & 1);
+        }
+
+        // the same phase as watervolume::evaluaterow, f * (dir . p) less the wrapped offset
+        wavephases phase = phasesat(waves, time);
+        timephase = { std::sin(phase.offset1), std::cos(phase.offset1), std::sin(phase.offset2), std::cos(phase.offset2) };
+        auto rows = [&](int r0, int r1) {
+            for (int r = r0; r < r1; ++r) combinerow(r / n, r % n, waves, dir1, dir2);
+        };
+        if (tasks && g_kernel.threads > 1) {
+            tasks->parallelfor(levels * n, g_kernel.tilerows, rows, g_kernel.threads);
+        }
+        else {
+            rows(0, levels * n);
+        }
+        for (int l = 0; l + 1 < levels; ++l) stitchedges(l);
+        if (terrain) terraingeneration = terrain->generation();
+        ++updates;
+    }
+
+    void upload(GLuint vbo) const {
+        uploadvertices(vbo, vertices);
+    }
+
+    unsigned long long checksum() const {
+        return checksumvertices(vertices);
+    }
+
+    // one draw per level: the finest as a full grid, the rest with the hole variant matching the finer level's offset
+    std::vector<drawrange> ranges() const {
+        std::vector<drawrange> draws;
+        for (int l = 0; l < levels; ++l) {
+            const indexrange& range = l == 0 ? full : holes[cache[l].holevariant];
+            draws.push_back({ range.count, range.first, l * n * n });
+        }
+        return draws;
+    }
+
+    int levelcount() const { return levels; }
+    int size() const { return n; }
+    float extent() const { return spacing0 * float(1 << (levels - 1)) * float(n - 1); }
+
+    std::vector<vertex> vertices;
+    std::vector<unsigned int> indices;
+    tasksystem* tasks = nullptr;
+    glm::vec2 eye{ 0.0f };  // where the rings centre relative to the camera's travel offset
+    tilecache* terrain = nullptr;
+    long updates = 0;
+    long long recomputed = 0;  // trig cache entries refreshed, summed over all updates
+
+private:
+    struct indexrange { size_t first = 0; GLsizei count = 0; };
+    // everything about a vertex that does not change with time
+    struct cachedpoint {
+        float sin1, cos1, sin2, cos2;  // both spatial phases
+        float shoal, floor;            // wave amplitude scale from the depth, and the sea floor height
+    };
+    struct levelcache {
+        std::vector<cachedpoint> points;  // indexed by world grid coordinate mod n
+        std::vector<std::pair<int, int>> stale;  // grid coordinates sampled before their bathymetry tile arrived
+        int ox = 0, oz = 0;
+        bool valid = false;
+        int holevariant = 0;  // which of the four hole placements the finer level currently needs
+    };
+
+    int levels, n;
+    float spacing0;
+    std::vector<levelcache> cache;
+    indexrange full;
+    std::array<indexrange, 4> holes;
+    std::array<float, 4> timephase{};
+    unsigned terraingeneration = 0;
+
+    static constexpr float shoaldepth = 50.0f;  // depth below which waves start to steepen
+
+    static int wrap(int v, int n) { return ((v % n) + n) % n; }
+
+    void fill(levelcache& level, int gx, int gz, double spacing, const waveparams& waves, glm::vec2 dir1, glm::vec2 dir2) {
+        // the phases are taken in double so the cache stays accurate far from the origin
+        double x = gx * spacing, z = gz * spacing;
+        double p1 = waves.frequency1 * (dir1.x * x + dir1.y * z);
+        double p2 = waves.frequency2 * (dir2.x * x + dir2.y * z);
+        float floor = -std::numeric_limits<float>::infinity();
+        float shoal = 1.0f;
+        if (terrain) {
+            // replays wait for tiles so the surface does not depend on i/o timing
+            if (!terrain->sample(x, z, floor, g_deterministic)) {
+                floor = tilecache::deepwater;
+                level.stale.push_back({ gx, gz });
+            }
+            // green's law: amplitude grows as the fourth root of the inverse depth once waves feel the bottom
+            float depth = -floor;
+            if (depth < shoaldepth) shoal = std::min(std::pow(shoaldepth / std::max(depth, 1.0f), 0.25f), 3.0f);
+        }
+        level.points[wrap(gx, n) + wrap(gz, n) * size_t(n)] = {
+            float(std::sin(p1)), float(std::cos(p1)), float(std::sin(p2)), float(std::cos(p2)), shoal, floor };
+        ++recomputed;
+    }
+
+    // resamples the points whose tiles were missing, dropping the ones that have left the window
+    void retrystale(levelcache& level, double spacing, const waveparams& waves, glm::vec2 dir1, glm::vec2 dir2) {
+        std::vector<std::pair<int, int>> retry;
+        retry.swap(level.stale);
+        for (auto [gx, gz] : retry) {
+            if (gx >= level.ox && gx < level.ox + n && gz >= level.oz && gz < level.oz + n) fill(level, gx, gz, spacing, waves, dir1, dir2);
+        }
+    }
+
+    void refreshcache(levelcache& level, int ox, int oz, double spacing, const waveparams& waves, glm::vec2 dir1, glm::vec2 dir2) {
+        auto fill = [&](int gx, int gz) { this->fill(level, gx, gz, spacing, waves, dir1, dir2); };
+        int dx = ox - level.ox, dz = oz - level.oz;
+        if (!level.valid || std::abs(dx) >= n || std::abs(dz) >= n) {
+            level.stale.clear();
+            for (int gz = oz; gz < oz + n; ++gz) {
+                for (int gx = ox; gx < ox + n; ++gx) fill(gx, gz);
+            }
+        }
+        else {
+            // columns that entered the window, then rows that entered it outside those columns
+            int cx0 = dx > 0 ? level.ox + n : ox, cx1 = dx > 0 ? ox + n : level.ox;
+            for (int gz = oz; gz < oz + n; ++gz) {
+                for (int gx = cx0; gx < cx1; ++gx) fill(gx, gz);
+            }
+            int rz0 = dz > 0 ? level.oz + n : oz, rz1 = dz > 0 ? oz + n : level.oz;
+            for (int gz = rz0; gz < rz1; ++gz) {
+                for (int gx = ox; gx < ox + n; ++gx) {
+                    if (gx < cx0 || gx >= cx1) fill(gx, gz);
+                }
+            }
+        }
+        level.ox = ox;
+        level.oz = oz;
+        level.valid = true;
+    }
+
+    void combinerow(int l, int row, const waveparams& waves, glm::vec2 dir1, glm::vec2 dir2) {
+        const levelcache& level = cache[l];
+        float spacing = spacing0 * float(1 << l);
+        float s1 = timephase[0], c1 = timephase[1], s2 = timephase[2], c2 = timephase[3];
+        int gz = level.oz + row;
+        vertex* out = &vertices[size_t(l) * n * n + size_t(row) * n];
+        const cachedpoint* pointrow = &level.points[wrap(gz, n) * size_t(n)];
+        for (int x = 0; x < n; ++x) {
+            int gx = level.ox + x;
+            const cachedpoint& p = pointrow[wrap(gx, n)];
+            // sin(p - t) and cos(p - t) from the cached spatial terms and this frame's time terms
+            float sin1 = p.sin1 * c1 - p.cos1 * s1, cos1 = p.cos1 * c1 + p.sin1 * s1;
+            float sin2 = p.sin2 * c2 - p.cos2 * s2, cos2 = p.cos2 * c2 + p.sin2 * s2;
+            float slope1 = p.shoal * waves.amplitude1 * waves.frequency1 * cos1;
+            float slope2 = p.shoal * waves.amplitude2 * waves.frequency2 * cos2;
+            float height = p.shoal * (waves.amplitude1 * sin1 + waves.amplitude2 * sin2);
+            if (p.floor > height) {
+                // dry land: the vertex follows the terrain instead of the water
+                out[x] = { gx * spacing, p.floor, gz * spacing, 0.0f, 1.0f, 0.0f };
+                continue;
+            }
+            glm::vec3 normal = glm::normalize(glm::vec3(-(slope1 * dir1.x + slope2 * dir2.x), 1.0f, -(slope1 * dir1.y + slope2 * dir2.y)));
+            out[x] = { gx * spacing, height, gz * spacing, normal.x, normal.y, normal.z };
+        }
+    }
+
+    // the border of a finer level has a vertex halfway along each coarse edge; pulling it onto the
+    // coarse edge's straight line closes the t-junction cracks between levels
+    void stitchedges(int l) {
+        vertex* base = &vertices[size_t(l) * n * n];
+        auto stitch = [&](int i, int a, int b) {
+            base[i].y = 0.5f * (base[a].y + base[b].y);
+            glm::vec3 normal = glm::normalize(glm::vec3(base[a].nx + base[b].nx, base[a].ny + base[b].ny, base[a].nz + base[b].nz));
+            base[i].nx = normal.x;
+            base[i].ny = normal.y;
+            base[i].nz = normal.z;
+        };
+        for (int k = 1; k < n - 1; k += 2) {
+            stitch(k, k - 1, k + 1);
+            stitch(k + (n - 1) * n, k - 1 + (n - 1) * n, k + 1 + (n - 1) * n);
+            stitch(k * n, (k - 1) * n, (k + 1) * n);
+            stitch(n - 1 + k * n, n - 1 + (k - 1) * n, n - 1 + (k + 1) * n);
+        }
+    }
+
+    // one full grid for the finest level plus the four possible hole placements for the rest;
+    // every level has the same layout, so they share these ranges through a base vertex offset
+    void buildindices() {
+        auto addgrid = [&](int hx, int hz) {
+            indexrange range;
+            range.first = indices.size();
+            int quarter = (n - 1) / 4, holecells = (n - 1) / 2;
+            for (int z = 0; z < n - 1; ++z) {
+                for (int x = 0; x < n - 1; ++x) {
+                    bool inhole = hx >= 0 &&
+                        x >= quarter + hx && x < quarter + hx + holecells &&
+                        z >= quarter + hz && z < quarter + hz + holecells;
+                    if (inhole) continue;
+                    unsigned int i0 = x + z * n, i1 = i0 + 1, i2 = i0 + n, i3 = i2 + 1;
+                    indices.insert(indices.end(), { i0, i1, i2, i1, i3, i2 });
+                }
+            }
+            range.count = GLsizei(indices.size() - range.first);
+            return range;
+        };
+        full = addgrid(-1, -1);
+        for (int variant = 0; variant < 4; ++variant) holes[variant] = addgrid(variant & 1, variant >> 1);
+    }
+};
+
+static const char* vertex_shader_source = R"(
+#version 330 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+uniform mat4 uModel;
 uniform mat4 uView;
 uniform mat4 uProj;
+uniform sampler2D uRipples;
+uniform vec4 uRippleMap;    // xz scale and offset from model space to ripple texture coordinates; zero scale disables
+uniform vec4 uRippleStep;   // one texel in texture coordinates, and 1 / (2 * texel size) in model space
+uniform vec4 uClipPlane;    // world-space plane for passes that enable GL_CLIP_DISTANCE0
 out vec3 vWorldPos;
 out vec3 vNormal;
+out float vTop;             // 1 on the top surface, 0 on the bottom, in between across the walls
+invariant gl_Position;      // the depth prepass links this shader again and must land on the same depths
+void main() {
+    vec3 pos = aPos;
+    vec3 normal = aNormal;
+    if (uRippleMap.x != 0.0 && abs(normal.y) > 1e-4) {
+        vec2 uv = aPos.xz * uRippleMap.xy + uRippleMap.zw;
+        float dx = (texture(uRipples, uv + vec2(uRippleStep.x, 0.0)).r - texture(uRipples, uv - vec2(uRippleStep.x, 0.0)).r) * uRippleStep.z;
+        float dz = (texture(uRipples, uv + vec2(0.0, uRippleStep.y)).r - texture(uRipples, uv - vec2(0.0, uRippleStep.y)).r) * uRippleStep.w;
+        pos.y += texture(uRipples, uv).r;
+        // tilt the surface normal by the ripple slope; the bottom surface faces down, so its tilt is mirrored
+        vec3 slope = normal / abs(normal.y);
+        slope.xz -= sign(normal.y) * vec2(dx, dz);
+        normal = normalize(slope);
+    }
+    vec4 worldPos = uModel * vec4(pos, 1.0);
+    vWorldPos = worldPos.xyz;
+    vNormal = mat3(uModel) * normal;
+    vTop = aNormal.y > 0.0 ? 1.0 : 0.0;
+    gl_ClipDistance[0] = dot(worldPos, uClipPlane);
+    gl_Position = uProj * uView * worldPos;
+}
+)";
+// this vertex shader transforms vertices from model space to clip space and passes world position and normals to the fragment shader.
+
+static const char* fragment_shader_source = R"(
+#version 330 core
+in vec3 vWorldPos;
+in vec3 vNormal;
+in float vTop;
+out vec4 fragColor;
+uniform vec3 uCamPos;
+uniform vec3 uLightPos;
+uniform int uSteps;
+uniform vec3 uDarkColor;
+uniform vec3 uLightColor;
+uniform int uSurfaceMaps;          // 1 when the reflection and refraction maps are bound
+uniform sampler2D uReflection;
+uniform sampler2D uRefraction;
+uniform mat4 uReflectionViewProj;  // the matrices the maps were rendered with, so older maps are reprojected
+uniform mat4 uRefractionViewProj;
+uniform float uDistortion;         // texture offset per unit of surface slope
+void main() {
+    vec3 normal = normalize(vNormal);
+    vec3 lightDir = normalize(uLightPos - vWorldPos);
+    float lambert = max(dot(normal, lightDir), 0.0);
+    float toonLevel = floor(lambert * float(uSteps)) / float(uSteps);
+    vec3 color = mix(uDarkColor, uLightColor, toonLevel);
+    if (uSurfaceMaps != 0 && vTop > 0.999) {
+        // look the top surface up in the maps where they saw it, pushed along the normal; fresnel weighs the two
+        vec4 reflection = uReflectionViewProj * vec4(vWorldPos, 1.0);
+        vec4 refraction = uRefractionViewProj * vec4(vWorldPos, 1.0);
+        vec2 offset = normal.xz * uDistortion;
+        vec3 reflected = texture(uReflection, reflection.xy / reflection.w * 0.5 + 0.5 + offset).rgb;
+        vec3 refracted = texture(uRefraction, refraction.xy / refraction.w * 0.5 + 0.5 - offset).rgb;
+        float facing = max(dot(normal, normalize(uCamPos - vWorldPos)), 0.0);
+        float fresnel = 0.02 + 0.98 * pow(1.0 - facing, 5.0);
+        color = mix(color, mix(refracted, reflected, fresnel), 0.5);
+    }
+    fragColor = vec4(color, 1.0);
+}
+)";
+// the fragment shader implements toon shading by quantizing the light intensity into discrete steps.
+
+// the depth prepass runs the water vertex shader with this, so the toon shader later runs once per covered pixel
+static const char* depth_fragment_source = R"(
+#version 330 core
+void main() {
+}
+)";
+
+// --overdraw: every fragment that passes the depth test adds one step of heat, so a pixel's brightness counts layers
+static const char* overdraw_fragment_source = R"(
+#version 330 core
+out vec4 fragColor;
+void main() {
+    fragColor = vec4(0.25, 0.1, 0.04, 1.0);
+}
+)";
+
+GLuint compileshader(GLenum shadertype, const char* shadersource) {
+    GLuint shader = glCreateShader(shadertype);
+    glShaderSource(shader, 1, &shadersource, nullptr);
+    glCompileShader(shader);
+    GLint success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        char infolog[512];
+        glGetShaderInfoLog(shader, 512, nullptr, infolog);
+        std::cerr << "error shader compilation failed\n" << infolog << "\n";
+    }
+    // proper error checking ensures shader compilation issues are caught early.
+    return shader;
+}
+
+GLuint createshaderprogram(const char* vertexsource, const char* fragmentsource) {
+    GLuint vertexshader = compileshader(GL_VERTEX_SHADER, vertexsource);
+    GLuint fragmentshader = compileshader(GL_FRAGMENT_SHADER, fragmentsource);
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertexshader);
+    glAttachShader(program, fragmentshader);
+    glLinkProgram(program);
+    GLint success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        char infolog[512];
+        glGetProgramInfoLog(program, 512, nullptr, infolog);
+        std::cerr << "error program linking failed\n" << infolog << "\n";
+    }
+    glDeleteShader(vertexshader);
+    glDeleteShader(fragmentshader);
+    // linking combines the shaders into a complete shader program for the gpu.
+    return program;
+}
+
+// one step of the ripple layer per fullscreen pass: a single triangle covering the viewport, no vertex buffer
+static const char* ripple_vertex_source = R"(
+#version 330 core
+void main() {
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+// the same leapfrog update as ripplegrid::step, reading exact texels. r holds the current height, g the previous
+static const char* ripple_fragment_source = R"(
+#version 330 core
+uniform sampler2D uState;
+uniform vec4 uDrop;        // centre in texels, radius in texels, strength; zero strength for no drop
+uniform float uCoupling;
+uniform float uDamping;
+uniform vec2 uSponge;      // band width in texels and strength; zero width for a hard edge
+out vec2 fragState;
+float current(ivec2 p) {
+    vec2 d = (vec2(p) - uDrop.xy) / uDrop.z;
+    float d2 = dot(d, d);
+    float drop = d2 < 1.0 ? uDrop.w * (1.0 - d2) * (1.0 - d2) : 0.0;
+    return texelFetch(uState, p, 0).r + drop;
+}
+void main() {
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(uState, 0);
+    float c = current(p);
+    if (p.x == 0 || p.y == 0 || p.x == size.x - 1 || p.y == size.y - 1) {
+        fragState = vec2(0.0, c);
+        return;
+    }
+    float laplacian = current(p - ivec2(1, 0)) + current(p + ivec2(1, 0)) + current(p - ivec2(0, 1)) + current(p + ivec2(0, 1)) - 4.0 * c;
+    float previous = texelFetch(uState, p, 0).g;
+    fragState = vec2((2.0 * c - previous + uCoupling * laplacian) * uDamping, c);
+    float d = float(min(min(p.x, p.y), min(size.x - 1 - p.x, size.y - 1 - p.y)));
+    if (d < uSponge.x) {
+        float t = uSponge.y * (uSponge.x - d) / uSponge.x;
+        fragState *= exp(-t * t);
+    }
+}
+)";
+
+// the ripple layer on the gpu using only gl 3.3: the state lives in two rg32f textures that are rendered into
+// alternately, one fullscreen pass per step. the water vertex shader samples the newest one through vertex texture
+// fetch to displace the surface, so nothing is read back and the cpu vertex data never sees the ripples.
+class gpuripples {
+public:
+    // width and depth are the model-space extent of the volume the ripples are laid over
+    gpuripples(int size, float width, float depth) : n(size), width(width), depth(depth) {
+        std::vector<float> zeros(size_t(n) * n * 2, 0.0f);
+        glGenTextures(2, textures);
+        glGenFramebuffers(2, framebuffers);
+        for (int i = 0; i < 2; ++i) {
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, n, n, 0, GL_RG, GL_FLOAT, zeros.data());
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                std::cerr << "error ripple framebuffer incomplete\n";
+            }
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        program = createshaderprogram(ripple_vertex_source, ripple_fragment_source);
+        glGenVertexArrays(1, &emptyvao);
+    }
+
+    ~gpuripples() {
+        glDeleteTextures(2, textures);
+        glDeleteFramebuffers(2, framebuffers);
+        glDeleteProgram(program);
+        glDeleteVertexArrays(1, &emptyvao);
+    }
+
+    gpuripples(const gpuripples&) = delete;
+    gpuripples& operator=(const gpuripples&) = delete;
+
+    // runs the passes needed to reach the simulation's step count; drops go into the first of them
+    void advance(long targetsteps, const std::vector<rippledrop>& drops) {
+        pending.insert(pending.end(), drops.begin(), drops.end());
+        if (steps >= targetsteps) return;
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glViewport(0, 0, n, n);
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "uState"), 0);
+        glUniform1f(glGetUniformLocation(program, "uCoupling"), ripplegrid::coupling);
+        glUniform1f(glGetUniformLocation(program, "uDamping"), ripplegrid::damping);
+        glUniform2f(glGetUniformLocation(program, "uSponge"), float(spongewidth), spongestrength);
+        GLint droplocation = glGetUniformLocation(program, "uDrop");
+        glBindVertexArray(emptyvao);
+        glActiveTexture(GL_TEXTURE0);
+        for (; steps < targetsteps; ++steps) {
+            // several drops in one step are rare; each extra one gets a step of its own
+            glm::vec4 drop(0.0f, 0.0f, 1.0f, 0.0f);
+            if (!pending.empty()) {
+                const rippledrop& d = pending.front();
+                drop = glm::vec4(d.u * (n - 1), d.v * (n - 1), std::max(d.radius * (n - 1), 2.0f), d.strength);
+                pending.erase(pending.begin());
+            }
+            glUniform4fv(droplocation, 1, glm::value_ptr(drop));
+            glBindTexture(GL_TEXTURE_2D, textures[current]);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[1 - current]);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            current = 1 - current;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+
+    // points the water shader, already in use, at the newest state
+    void bind(GLuint shaderprogram) const {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, textures[current]);
+        // texel centres line up with the volume's corners, as in ripplegrid::sample
+        float scale = float(n - 1) / n;
+        glm::vec4 map(scale / width, scale / depth, 0.5f, 0.5f);
+        glm::vec4 step(1.0f / n, 1.0f / n, 0.5f * (n - 1) / width, 0.5f * (n - 1) / depth);
+        glUniform1i(glGetUniformLocation(shaderprogram, "uRipples"), 0);
+        glUniform4fv(glGetUniformLocation(shaderprogram, "uRippleMap"), 1, glm::value_ptr(map));
+        glUniform4fv(glGetUniformLocation(shaderprogram, "uRippleStep"), 1, glm::value_ptr(step));
+    }
+
+    // the current heights, for checking against the cpu solver; stalls the pipeline
+    std::vector<float> readback() const {
+        std::vector<float> state(size_t(n) * n * 2);
+        glBindTexture(GL_TEXTURE_2D, textures[current]);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_FLOAT, state.data());
+        std::vector<float> heights(size_t(n) * n);
+        for (size_t i = 0; i < heights.size(); ++i) heights[i] = state[2 * i];
+        return heights;
+    }
+
+    int size() const { return n; }
+
+    long steps = 0;
+    int spongewidth = 0;  // cells of absorbing band along the border, as ripplegrid::setsponge
+
+private:
+    int n;
+    float width, depth;
+    GLuint textures[2] = {}, framebuffers[2] = {};
+    GLuint program = 0, emptyvao = 0;
+    int current = 0;
+    std::vector<rippledrop> pending;
+};
+
+// the wave update as a gl 4.3 compute shader, writing positions, heights and normals of both surfaces straight into
+// the vertex buffer the vao draws from, bound as a shader storage buffer. the first pass does positions and heights,
+// the second the normal stencil once every height is visible.
+static const char* wave_compute_source = R"(
+#version 430 core
+layout(local_size_x = 16, local_size_y = 16) in;
+struct vertexdata { float px, py, pz, nx, ny, nz; };
+layout(std430, binding = 0) buffer surface { vertexdata vertices[]; };
+uniform ivec2 uGrid;
+uniform vec3 uExtent;       // width, depth, thickness
+uniform vec2 uPhase;        // each wave's wrapped time offset
+uniform vec2 uAmplitude;
+uniform vec2 uFrequency;
+uniform vec4 uDirections;   // first wave direction in xy, second in zw
+uniform int uPass;          // 0 positions and heights, 1 normals
+void main() {
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    if (p.x >= uGrid.x || p.y >= uGrid.y) return;
+    int top = p.x + p.y * uGrid.x;
+    int bottom = top + uGrid.x * uGrid.y;
+    if (uPass == 0) {
+        vec2 pos = vec2(p) / vec2(uGrid - 1) * uExtent.xy - 0.5 * uExtent.xy;
+        float dot1 = dot(uDirections.xy, pos);
+        float dot2 = dot(uDirections.zw, pos);
+        float y = uAmplitude.x * sin(uFrequency.x * dot1 - uPhase.x) + uAmplitude.y * sin(uFrequency.y * dot2 - uPhase.y);
+        vertices[top].px = pos.x;
+        vertices[top].py = y;
+        vertices[top].pz = pos.y;
+        vertices[bottom].px = pos.x;
+        vertices[bottom].py = y - uExtent.z;
+        vertices[bottom].pz = pos.y;
+        return;
+    }
+    // the border keeps flat normals, as on the cpu
+    vec3 up = vec3(0.0, 1.0, 0.0);
+    vec3 down = vec3(0.0, -1.0, 0.0);
+    if (p.x > 0 && p.y > 0 && p.x < uGrid.x - 1 && p.y < uGrid.y - 1) {
+        float dx = (vertices[top + 1].py - vertices[top - 1].py) * 0.5;
+        float dz = (vertices[top + uGrid.x].py - vertices[top - uGrid.x].py) * 0.5;
+        up = normalize(vec3(-dx, 1.0, -dz));
+        dx = (vertices[bottom + 1].py - vertices[bottom - 1].py) * 0.5;
+        dz = (vertices[bottom + uGrid.x].py - vertices[bottom - uGrid.x].py) * 0.5;
+        down = normalize(vec3(dx, -1.0, dz));
+    }
+    vertices[top].nx = up.x;
+    vertices[top].ny = up.y;
+    vertices[top].nz = up.z;
+    vertices[bottom].nx = down.x;
+    vertices[bottom].ny = down.y;
+    vertices[bottom].nz = down.z;
+}
+)";
+
+GLuint createcomputeprogram(const char* source) {
+    GLuint shader = compileshader(GL_COMPUTE_SHADER, source);
+    GLuint program = glCreateProgram();
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    GLint success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        char infolog[512];
+        glGetProgramInfoLog(program, 512, nullptr, infolog);
+        std::cerr << "error compute program linking failed\n" << infolog << "\n";
+    }
+    glDeleteShader(shader);
+    return program;
+}
+
+// keeps the surface on the gpu: the simulation step only records what to compute, and the render loop has it
+// written into the frame's vertex buffer in place of an upload. watervolume::vertices becomes a mirror that is only
+// refreshed on request. each write is timed with a timer query that is read back frames later.
+class glresidentwaves : public computebackend {
+public:
+    glresidentwaves() { glGenQueries(GLsizei(queries.size()), queries.data()); }
+    ~glresidentwaves() override { glDeleteQueries(GLsizei(queries.size()), queries.data()); }
+
+    bool resident() const override { return true; }
+
+    // runs on the simulation thread, so it only takes a snapshot for the next dispatch
+    bool updatewaves(watervolume& water, const wavephases& phase) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.columns = water.columns();
+        pending.rows = water.rows();
+        pending.extent = glm::vec3(water.extent(), water.layerthickness());
+        pending.phase = phase;
+        pending.waves = water.waves;
+        return true;
+    }
+
+    // computes the latest snapshot into a vertex buffer; the pipelined loop calls this from the upload stage,
+    // which finishes before the next frame's simulation step can replace the snapshot
+    void dispatch(GLuint vbo) {
+        auto start = std::chrono::steady_clock::now();
+        snapshot s;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            s = pending;
+        }
+        // a buffer from before or after a grid resize would be overrun or left partly stale
+        GLint64 size = 0;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+        glGetBufferParameteri64v(GL_COPY_WRITE_BUFFER, GL_BUFFER_SIZE, &size);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        if (s.columns == 0 || size != GLint64(s.columns) * s.rows * 2 * GLint64(sizeof(vertex))) return;
+
+        collectqueries();
+        bool timed = inflight < int(queries.size());
+        GLuint query = queries[(first + inflight) % queries.size()];
+        if (timed) glBeginQuery(GL_TIME_ELAPSED, query);
+        write(s, vbo);
+        if (timed) {
+            glEndQuery(GL_TIME_ELAPSED);
+            ++inflight;
+        }
+        lastbuffer = vbo;
+        ++dispatches;
+        issueseconds += secondssince(start);
+    }
+
+    // a culled frame is not written anywhere, so no buffer holds the surface it stepped to
+    void skip() { lastbuffer = 0; }
+    bool current() const { return lastbuffer != 0; }
+
+    // copies the most recently computed surface back into the cpu mirror; stalls until the gpu is done with it
+    void mirror(watervolume& water) const {
+        if (!lastbuffer) return;
+        GLint64 size = 0;
+        glBindBuffer(GL_COPY_READ_BUFFER, lastbuffer);
+        glGetBufferParameteri64v(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+        if (size == GLint64(water.vertices.size() * sizeof(vertex))) {
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, size, water.vertices.data());
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+
+    void report() const override {
+        printf("  %s: %ld dispatches, cpu issue %.3f ms each, gpu %.3f ms each over %ld timed, 0 bytes uploaded\n",
+            name(), dispatches, dispatches ? 1000.0 * issueseconds / dispatches : 0.0,
+            timeddispatches ? 1e-6 * double(gpunanoseconds) / timeddispatches : 0.0, timeddispatches);
+    }
+
+protected:
+    struct snapshot {
+        int columns = 0, rows = 0;
+        glm::vec3 extent{ 0.0f };
+        wavephases phase;
+        waveparams waves;
+    };
+
+    // fills every vertex of both surfaces in vbo from the snapshot
+    virtual void write(const snapshot& s, GLuint vbo) = 0;
+
+    // the wave uniforms both shaders share
+    static void setwaveuniforms(GLuint program, const snapshot& s) {
+        glm::vec2 dir1 = glm::normalize(glm::vec2(1.0f, 0.2f));
+        glm::vec2 dir2 = glm::normalize(glm::vec2(0.2f, 1.0f));
+        glUniform2i(glGetUniformLocation(program, "uGrid"), s.columns, s.rows);
+        glUniform3fv(glGetUniformLocation(program, "uExtent"), 1, glm::value_ptr(s.extent));
+        glUniform2f(glGetUniformLocation(program, "uPhase"), s.phase.offset1, s.phase.offset2);
+        glUniform2f(glGetUniformLocation(program, "uAmplitude"), s.waves.amplitude1, s.waves.amplitude2);
+        glUniform2f(glGetUniformLocation(program, "uFrequency"), s.waves.frequency1, s.waves.frequency2);
+        glUniform4f(glGetUniformLocation(program, "uDirections"), dir1.x, dir1.y, dir2.x, dir2.y);
+    }
+
+private:
+    std::array<GLuint, 4> queries{};
+    int first = 0, inflight = 0;  // ring of timer queries still waiting for their results
+    GLuint lastbuffer = 0;
+    snapshot pending;
+    std::mutex mutex;
+    long dispatches = 0, timeddispatches = 0;
+    bool warmedup = false;
+    double issueseconds = 0;
+    GLuint64 gpunanoseconds = 0;
+
+    void collectqueries() {
+        while (inflight > 0) {
+            GLuint query = queries[first];
+            GLint available = 0;
+            glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) break;
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+            // the first dispatch can include shader compilation and driver warm-up, so it is left out
+            if (std::exchange(warmedup, true)) {
+                gpunanoseconds += elapsed;
+                ++timeddispatches;
+            }
+            first = (first + 1) % int(queries.size());
+            --inflight;
+        }
+    }
+};
+
+// needs gl 4.3: the vertex buffer is bound as a shader storage buffer
+class glcomputewaves : public glresidentwaves {
+public:
+    glcomputewaves() { program = createcomputeprogram(wave_compute_source); }
+    ~glcomputewaves() override { glDeleteProgram(program); }
+
+    const char* name() const override { return "gl compute"; }
+
+protected:
+    void write(const snapshot& s, GLuint vbo) override {
+        glUseProgram(program);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vbo);
+        setwaveuniforms(program, s);
+        GLint passlocation = glGetUniformLocation(program, "uPass");
+        GLuint groupsx = GLuint(s.columns + 15) / 16, groupsz = GLuint(s.rows + 15) / 16;
+        glUniform1i(passlocation, 0);
+        glDispatchCompute(groupsx, groupsz, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glUniform1i(passlocation, 1);
+        glDispatchCompute(groupsx, groupsz, 1);
+        // the draw reads the same buffer as vertex attributes
+        glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    }
+
+private:
+    GLuint program = 0;
+};
+
+// the gl 3.3 way to the same result: a vertex shader run once per output vertex with rasterization off, its
+// position and normal captured by transform feedback into the vertex buffer. the grid coordinates come from
+// gl_VertexID, so there is no input buffer. a vertex cannot read its neighbours, so normals come from the analytic
+// derivative of the waves, scaled to the per-cell slope the cpu stencil measures.
+static const char* wave_feedback_source = R"(
+#version 330 core
+uniform ivec2 uGrid;
+uniform vec3 uExtent;       // width, depth, thickness
+uniform vec2 uPhase;        // each wave's wrapped time offset
+uniform vec2 uAmplitude;
+uniform vec2 uFrequency;
+uniform vec4 uDirections;   // first wave direction in xy, second in zw
+out vec3 outPosition;
+out vec3 outNormal;
+void main() {
+    int cells = uGrid.x * uGrid.y;
+    int index = gl_VertexID % cells;
+    bool bottom = gl_VertexID >= cells;
+    ivec2 p = ivec2(index % uGrid.x, index / uGrid.x);
+    vec2 spacing = uExtent.xy / vec2(uGrid - 1);
+    vec2 pos = vec2(p) * spacing - 0.5 * uExtent.xy;
+    float phase1 = uFrequency.x * dot(uDirections.xy, pos) - uPhase.x;
+    float phase2 = uFrequency.y * dot(uDirections.zw, pos) - uPhase.y;
+    float y = uAmplitude.x * sin(phase1) + uAmplitude.y * sin(phase2);
+    vec2 slope = uAmplitude.x * uFrequency.x * cos(phase1) * uDirections.xy
+               + uAmplitude.y * uFrequency.y * cos(phase2) * uDirections.zw;
+    slope *= spacing;
+    // the border keeps flat normals, as on the cpu
+    if (p.x == 0 || p.y == 0 || p.x == uGrid.x - 1 || p.y == uGrid.y - 1) slope = vec2(0.0);
+    if (bottom) {
+        outPosition = vec3(pos.x, y - uExtent.z, pos.y);
+        outNormal = normalize(vec3(slope.x, -1.0, slope.y));
+    } else {
+        outPosition = vec3(pos.x, y, pos.y);
+        outNormal = normalize(vec3(-slope.x, 1.0, -slope.y));
+    }
+}
+)";
+
+// evaluates the surface once per frame into the buffer every pass draws from, so extra passes reuse it rather than
+// repeating the wave evaluation in their own vertex shaders
+class glfeedbackwaves : public glresidentwaves {
+public:
+    glfeedbackwaves() {
+        GLuint shader = compileshader(GL_VERTEX_SHADER, wave_feedback_source);
+        program = glCreateProgram();
+        glAttachShader(program, shader);
+        // interleaved in the same order as struct vertex
+        const char* varyings[] = { "outPosition", "outNormal" };
+        glTransformFeedbackVaryings(program, 2, varyings, GL_INTERLEAVED_ATTRIBS);
+        glLinkProgram(program);
+        GLint success;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            char infolog[512];
+            glGetProgramInfoLog(program, 512, nullptr, infolog);
+            std::cerr << "error feedback program linking failed\n" << infolog << "\n";
+        }
+        glDeleteShader(shader);
+        // core profile draws need a vao bound even without attributes
+        glGenVertexArrays(1, &emptyvao);
+    }
+
+    ~glfeedbackwaves() override {
+        glDeleteProgram(program);
+        glDeleteVertexArrays(1, &emptyvao);
+    }
+
+    const char* name() const override { return "transform feedback"; }
+
+protected:
+    void write(const snapshot& s, GLuint vbo) override {
+        glUseProgram(program);
+        setwaveuniforms(program, s);
+        glBindVertexArray(emptyvao);
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vbo);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, GLsizei(s.columns) * s.rows * 2);
+        glEndTransformFeedback();
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glDisable(GL_RASTERIZER_DISCARD);
+        glBindVertexArray(0);
+    }
+
+private:
+    GLuint program = 0, emptyvao = 0;
+};
+
+// resumes frame coroutines on the main thread once the tasks or gl fences they wait on have completed
+class framescheduler {
+public:
+    // may be called from any thread
+    void post(std::coroutine_handle<> handle) {
+        {
+            std::lock_guard<std::mutex> lock(readymutex);
+            ready.push_back(handle);
+        }
+        readycv.notify_one();
+    }
+
+    void waitfence(GLsync fence, std::coroutine_handle<> handle) {
+        fences.push_back({ fence, handle });
+    }
+
+    void waitnextframe(std::coroutine_handle<> handle) {
+        framewaiters.push_back(handle);
+    }
+
+    // called by the frame loop whenever a new frame starts
+    void startframe() {
+        for (auto handle : framewaiters) post(handle);
+        framewaiters.clear();
+    }
+
+    // returns true if any coroutine was resumed
+    bool runready() {
+        bool progressed = false;
+        for (size_t i = 0; i < fences.size();) {
+            GLenum status = glClientWaitSync(fences[i].first, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+                post(fences[i].second);
+                fences.erase(fences.begin() + i);
+            }
+            else {
+                ++i;
+            }
+        }
+        std::deque<std::coroutine_handle<>> batch;
+        {
+            std::lock_guard<std::mutex> lock(readymutex);
+            batch.swap(ready);
+        }
+        for (auto handle : batch) {
+            handle.resume();
+            progressed = true;
+        }
+        return progressed;
+    }
+
+    // sleeps until a task completes; gpu fences cannot wake us, so the wait is kept short while any are pending
+    void idle() {
+        std::unique_lock<std::mutex> lock(readymutex);
+        readycv.wait_for(lock, std::chrono::microseconds(fences.empty() ? 5000 : 200), [&] { return !ready.empty(); });
+    }
+
+private:
+    std::mutex readymutex;
+    std::condition_variable readycv;
+    std::deque<std::coroutine_handle<>> ready;
+    std::vector<std::pair<GLsync, std::coroutine_handle<>>> fences;
+    std::vector<std::coroutine_handle<>> framewaiters;
+};
+
+// a fire-and-forget coroutine; the frame loop polls done() and destroys finished frames
+class frametask {
+public:
+    struct promise_type {
+        frametask get_return_object() { return frametask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    explicit frametask(std::coroutine_handle<promise_type> h) : handle(h) {}
+    frametask(frametask&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    frametask& operator=(frametask&& other) noexcept {
+        if (handle) handle.destroy();
+        handle = std::exchange(other.handle, nullptr);
+        return *this;
+    }
+    ~frametask() { if (handle) handle.destroy(); }
+
+    bool done() const { return handle.done(); }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+// suspends until a task submitted to the task system has run.
+// the caller keeps the task alive; awaiters stay trivially destructible to sidestep compiler bugs around co_await temporaries
+struct taskawaiter {
+    framescheduler& scheduler;
+    tasksystem::task& t;
+
+    bool await_ready() {
+        std::lock_guard<std::mutex> lock(t.mutex);
+        return t.done;
+    }
+    bool await_suspend(std::coroutine_handle<> handle) {
+        std::lock_guard<std::mutex> lock(t.mutex);
+        if (t.done) return false;
+        t.oncomplete = [s = &scheduler, handle] { s->post(handle); };
+        return true;
+    }
+    void await_resume() {}
+};
+
+// suspends until the gpu has passed a fence; a null fence counts as already signalled
+struct fenceawaiter {
+    framescheduler& scheduler;
+    GLsync& fence;
+
+    bool await_ready() { return fence == nullptr; }
+    void await_suspend(std::coroutine_handle<> handle) { scheduler.waitfence(fence, handle); }
+    void await_resume() {
+        if (fence) glDeleteSync(fence);
+        fence = nullptr;
+    }
+};
+
+// suspends until the next frame starts; used to spread background work over several frames
+struct nextframeawaiter {
+    framescheduler& scheduler;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> handle) { scheduler.waitnextframe(handle); }
+    void await_resume() {}
+};
+
+// a one-shot dependency between stages of different frames; only touched from the main thread
+class stageevent {
+public:
+    void signal(framescheduler& scheduler) {
+        signalled = true;
+        for (auto handle : waiters) scheduler.post(handle);
+        waiters.clear();
+    }
+
+    bool await_ready() const { return signalled; }
+    void await_suspend(std::coroutine_handle<> handle) { waiters.push_back(handle); }
+    void await_resume() {}
+
+private:
+    bool signalled = false;
+    std::vector<std::coroutine_handle<>> waiters;
+};
+
+struct framerecord {
+    stageevent uploaded;   // the next frame may overwrite the shared vertex array from here on
+    stageevent presented;  // frames are presented in order
+};
+
+// each frame in flight draws from its own vertex buffer so uploads never wait on earlier draws
+struct frameslot {
+    GLuint vao = 0, vbo = 0, pbo = 0;
+    GLsync fence = nullptr;
+};
+
+// the gpu side of one watervolume: a static index buffer plus a slot per frame in flight.
+// frames hold it by shared_ptr, so a mesh replaced by a resize lives until the last frame drawing it is done.
+struct gpumesh {
+    GLuint ebo = 0;
+    GLsizei indexcount = 0;
+    std::vector<frameslot> slots;
+
+    gpumesh() = default;
+    gpumesh(const gpumesh&) = delete;
+    gpumesh& operator=(const gpumesh&) = delete;
+    ~gpumesh() {
+        for (auto& slot : slots) {
+            if (slot.fence) glDeleteSync(slot.fence);
+            glDeleteBuffers(1, &slot.vbo);
+            glDeleteBuffers(1, &slot.pbo);
+            glDeleteVertexArrays(1, &slot.vao);
+        }
+        glDeleteBuffers(1, &ebo);
+    }
+};
+
+struct stagetimings {
+    double simulate = 0, cull = 0, upload = 0, draw = 0, exportframe = 0;
+    long frames = 0, culled = 0, exported = 0;
+    double worstframe = 0, worstresizeframe = 0;  // present-to-present intervals
+    double submit = 0;  // renderer api time, when the loop goes through a renderer
+    long resizes = 0;
+};
+
+// records every applied command and the per-frame dt, or feeds a previous recording back in.
+// only the thread running the simulation step touches it.
+class inputlog {
+public:
+    bool record(const std::string& path) {
+        recordfile = fopen(path.c_str(), "w");
+        if (!recordfile) return false;
+        fprintf(recordfile, "# fluid-sim input log v1\n");
+        return true;
+    }
+
+    // frames past this are taken for a corrupt log rather than allocated; at 60 fps it is over three days
+    static constexpr long maxframes = 1L << 24;
+
+    bool load(const std::string& path, std::string& error) {
+        FILE* file = fopen(path.c_str(), "r");
+        if (!file) {
+            error = "cannot open it";
+            return false;
+        }
+        char line[256];
+        int lineno = 0;
+        while (fgets(line, sizeof(line), file)) {
+            ++lineno;
+            long frame;
+            float value;
+            int type, a, b;
+            bool isframe = sscanf(line, "f %ld %f", &frame, &value) == 2;
+            bool iscommand = !isframe && sscanf(line, "c %ld %d %d %d %f", &frame, &type, &a, &b, &value) == 5;
+            if ((isframe || iscommand) && (frame < 0 || frame >= maxframes)) {
+                error = "frame " + std::to_string(frame) + " on line " + std::to_string(lineno) + " is out of range";
+                fclose(file);
+                return false;
+            }
+            // replay only ever looks at the next command, so one recorded out of order would hide every later one
+            const char* bad = nullptr;
+            if (iscommand && !commands.empty() && frame < commands.back().first) bad = "is earlier than the one before it";
+            else if (iscommand && (type < int(commandtype::key) || type > int(commandtype::scaleparameter))) bad = "has an unknown type";
+            else if (iscommand && commandtype(type) == commandtype::resize && (a <= 0 || b <= 0)) bad = "resizes to an empty window";
+            else if (iscommand && commandtype(type) == commandtype::scaleparameter &&
+                (a < int(waveparameter::amplitude) || a > int(waveparameter::speed) || !(value > 0.0f) || !std::isfinite(value))) {
+                bad = "scales an unknown parameter or by an invalid factor";
+            }
+            if (bad) {
+                error = "the command on line " + std::to_string(lineno) + " " + bad;
+                fclose(file);
+                return false;
+            }
+            if (isframe) {
+                frametimes.resize(std::max<size_t>(frametimes.size(), size_t(frame) + 1), 0.0f);
+                frametimes[frame] = value;
+            }
+            else if (iscommand) {
+                command cmd;
+                cmd.type = commandtype(type);
+                cmd.a = a;
+                cmd.b = b;
+                cmd.value = value;
+                commands.push_back({ frame, cmd });
+            }
+        }
+        fclose(file);
+        if (frametimes.empty()) {
+            error = "it records no frames";
+            return false;
+        }
+        replaying = true;
+        return true;
+    }
+
+    void close() {
+        if (recordfile) fclose(recordfile);
+        recordfile = nullptr;
+    }
+
+    void writecommand(long frame, const command& cmd) {
+        // %.9g round-trips a float exactly, so a replay sees bit-identical parameters
+        if (recordfile) fprintf(recordfile, "c %ld %d %d %d %.9g\n", frame, int(cmd.type), cmd.a, cmd.b, cmd.value);
+    }
+
+    void writeframe(long frame, float dt) {
+        if (recordfile) fprintf(recordfile, "f %ld %.9g\n", frame, dt);
+    }
+
+    // skips the commands of frames before this one, for a run restarted from a checkpoint
+    void seek(long frame) {
+        while (nextindex < commands.size() && commands[nextindex].first < frame) ++nextindex;
+    }
+
+    // pops the next recorded command belonging to this frame, if any
+    bool nextcommand(long frame, command& cmd) {
+        if (nextindex >= commands.size() || commands[nextindex].first != frame) return false;
+        cmd = commands[nextindex++].second;
+        return true;
+    }
+
+    bool replaying = false;
+    std::vector<float> frametimes;
+
+private:
+    FILE* recordfile = nullptr;
+    std::vector<std::pair<long, command>> commands;
+    size_t nextindex = 0;
+};
+
+static inputlog g_inputlog;
+
+// state owned by whichever thread runs the simulation step; other threads only change it through commands
+struct simstate {
+    long frame = 0;
+    double timeaccumulator = 0.0;  // in double, so adding a frame's dt still counts after days of uptime
+    float aspectratio = float(window_width) / float(window_height);
+    bool paused = false;
+    bool replayfinished = false;
+    int requestedgrid = 0;  // set when input asks for another grid resolution, cleared once the resize starts
+    glm::vec2 cameraoffset{ 0.0f }, cameravelocity{ 0.0f };  // ground-plane travel, moved by the simulation step
+    long ripplesteps = 0;  // steps the ripple layer should have taken; the gpu solver catches up to it when drawing
+    std::vector<rippledrop> rippledrops;  // dropped since the ripple layer last stepped
+    unsigned long long replaychecksum = 0;
+    long commandsapplied = 0;
+    double latencytotal = 0.0, latencymax = 0.0;
+};
+
+void applycommand(simstate& sim, watervolume& water, const command& cmd) {
+    switch (cmd.type) {
+    case commandtype::key:
+        if (cmd.a == GLFW_KEY_SPACE) sim.paused = !sim.paused;
+        if (cmd.a == GLFW_KEY_R) sim.timeaccumulator = 0.0;
+        if (cmd.a == GLFW_KEY_LEFT_BRACKET || cmd.a == GLFW_KEY_RIGHT_BRACKET) {
+            int current = sim.requestedgrid > 0 ? sim.requestedgrid : water.columns();
+            sim.requestedgrid = cmd.a == GLFW_KEY_RIGHT_BRACKET ? std::min(current * 2, 1600) : std::max(current / 2, 25);
+        }
+        // w/s and a/d change the camera's drift speed forward and sideways
+        if (cmd.a == GLFW_KEY_W) sim.cameravelocity.y -= 5.0f;
+        if (cmd.a == GLFW_KEY_S) sim.cameravelocity.y += 5.0f;
+        if (cmd.a == GLFW_KEY_A) sim.cameravelocity.x -= 5.0f;
+        if (cmd.a == GLFW_KEY_D) sim.cameravelocity.x += 5.0f;
+        // without a ripple layer nothing would ever consume the drop
+        if (cmd.a == GLFW_KEY_P && g_ripples != "off") {
+            // somewhere in the middle of the volume, pseudo-randomly by frame so replays drop in the same place
+            unsigned int hash = unsigned(sim.frame) * 2654435761u;
+            float u = 0.2f + 0.6f * float(hash >> 22) / 1023.0f;
+            float v = 0.2f + 0.6f * float((hash >> 12) & 1023) / 1023.0f;
+            sim.rippledrops.push_back({ u, v, 0.03f, 1.5f });
+        }
+        break;
+    case commandtype::resize:
+        sim.aspectratio = float(cmd.a) / float(cmd.b);
+        break;
+    case commandtype::scaleparameter:
+        if (waveparameter(cmd.a) == waveparameter::amplitude) {
+            water.waves.amplitude1 *= cmd.value;
+            water.waves.amplitude2 *= cmd.value;
+        }
+        else {
+            water.waves.speed1 *= cmd.value;
+            water.waves.speed2 *= cmd.value;
+        }
+        break;
+    }
+    g_inputlog.writecommand(sim.frame, cmd);
+}
+
+// drains the command queue; only ever called at the start of a simulation step
+void applycommands(simstate& sim, watervolume& water) {
+    command cmd;
+    while (g_commands.pop(cmd)) {
+        // while replaying, live input is drained but ignored so it cannot perturb the recorded stream
+        if (g_inputlog.replaying) continue;
+        applycommand(sim, water, cmd);
+        double latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - cmd.enqueued).count();
+        sim.latencytotal += latency;
+        sim.latencymax = std::max(sim.latencymax, latency);
+        ++sim.commandsapplied;
+    }
+    while (g_inputlog.nextcommand(sim.frame, cmd)) {
+        applycommand(sim, water, cmd);
+    }
+}
+
+// one simulation step: commands first, so a step always sees a consistent set of inputs.
+// with an open-water clipmap attached, it replaces the volume as the surface being evaluated.
+void stepsimulation(simstate& sim, watervolume& water, clipmap* ocean = nullptr) {
+    if (sim.replayfinished) return;
+    auto finishreplay = [&] {
+        sim.replayfinished = true;
+        sim.replaychecksum = ocean ? ocean->checksum() : water.checksum();
+    };
+    // a restart can land at or past the end of the log, so the frame is checked before it is read
+    if (g_inputlog.replaying && (sim.frame < 0 || sim.frame >= long(g_inputlog.frametimes.size()))) {
+        finishreplay();
+        return;
+    }
+    applycommands(sim, water);
+    float dt = 0.05f;
+    if (g_inputlog.replaying) {
+        dt = g_inputlog.frametimes[size_t(sim.frame)];
+    }
+    g_inputlog.writeframe(sim.frame, dt);
+    if (!sim.paused) sim.timeaccumulator += dt;
+    g_globalSimTime = sim.timeaccumulator;
+    sim.cameraoffset = sim.cameraoffset + sim.cameravelocity * dt;
+    if (ocean && ocean->terrain) {
+        // ask for the tiles around where the camera will be in a couple of seconds
+        glm::vec2 ahead = sim.cameraoffset + ocean->eye + sim.cameravelocity * 2.0f;
+        ocean->terrain->prefetch(ahead.x, ahead.y, 0.5 * ocean->extent());
+    }
+    if (ocean) {
+        ocean->update(sim.cameraoffset.x + ocean->eye.x, sim.cameraoffset.y + ocean->eye.y, sim.timeaccumulator, water.waves);
+    }
+    else {
+        if (g_ripples != "off" && !sim.paused) {
+            // the cpu layer steps here; the gpu one keeps the drops for the draw stage
+            if (water.ripples) {
+                for (const rippledrop& drop : sim.rippledrops) water.ripples->drop(drop);
+                sim.rippledrops.clear();
+                water.ripples->step();
+            }
+            ++sim.ripplesteps;
+        }
+        water.updatewaves(sim.timeaccumulator);
+    }
+    ++sim.frame;
+    if (g_inputlog.replaying && sim.frame >= long(g_inputlog.frametimes.size())) finishreplay();
+}
+
+void reportcommandlatency(const simstate& sim) {
+    if (sim.commandsapplied > 0 || g_droppedcommands > 0) {
+        printf("  commands: %ld applied, enqueue-to-apply ms avg %.3f max %.3f, %ld dropped\n", sim.commandsapplied,
+            1000.0 * sim.latencytotal / std::max(sim.commandsapplied, 1L), 1000.0 * sim.latencymax, g_droppedcommands);
+    }
+    if (sim.replayfinished) {
+        printf("  replay: %ld frames, surface checksum %016llx\n", sim.frame, sim.replaychecksum);
+    }
+}
+
+// a checkpoint is everything a run needs to continue bit-identically from a step boundary: the simulation state,
+// the configuration that changes results, and the ripple layer's fields. the volume's surface is not stored since
+// it is a function of time, waves and grid, and there is no random state to keep: drops are placed by hashing the frame.
+struct checkpointheader {
+    char magic[8];           // FSCHECK1
+    uint32_t headerbytes;    // sizeof(checkpointheader), so a file from another layout is rejected
+    uint32_t dropcount;      // ripple drops not yet stepped
+    int64_t frame, ripplesteps, ripplegridsteps;
+    double timeaccumulator;
+    float aspectratio;
+    float cameraoffset[2], cameravelocity[2];
+    waveparams waves;
+    float width, depth, thickness;
+    int32_t columns, rows, paused;
+    int32_t ripples;         // 0 off, 1 cpu; followed by both ripple fields when set
+    int32_t ripplegrid, clipmaplevels, clipmapsize;
+    float rippleviscosity, ripplecurrent, rippleobstacle, rippledetail;
+    int32_t rippleadvection, iwaverank, ripplesponge, rippleupsample;
+    int32_t simd, sinetier;  // the kernel choices that change results
+};
+
+struct checkpoint {
+    checkpointheader header{};
+    std::vector<rippledrop> drops;
+    std::vector<float> current, previous;
+
+    size_t bytes() const {
+        return sizeof(header) + drops.size() * sizeof(rippledrop) + (current.size() + previous.size()) * sizeof(float);
+    }
+};
+
+// copies the state out on the simulation thread, right after a step. a grid resize that was requested but not yet
+// swapped in is recorded as done, since it takes effect before the next step either way.
+checkpoint capturecheckpoint(const simstate& sim, const watervolume& water, const ripplegrid* ripples) {
+    checkpoint c;
+    checkpointheader& h = c.header;
+    memcpy(h.magic, "FSCHECK1", 8);
+    h.headerbytes = sizeof(checkpointheader);
+    h.frame = sim.frame;
+    h.ripplesteps = sim.ripplesteps;
+    h.timeaccumulator = sim.timeaccumulator;
+    h.aspectratio = sim.aspectratio;
+    h.cameraoffset[0] = sim.cameraoffset.x;
+    h.cameraoffset[1] = sim.cameraoffset.y;
+    h.cameravelocity[0] = sim.cameravelocity.x;
+    h.cameravelocity[1] = sim.cameravelocity.y;
+    h.paused = sim.paused;
+    h.waves = water.waves;
+    h.width = water.extent().x;
+    h.depth = water.extent().y;
+    h.thickness = water.layerthickness();
+    h.columns = sim.requestedgrid > 0 ? sim.requestedgrid : water.columns();
+    h.rows = sim.requestedgrid > 0 ? sim.requestedgrid : water.rows();
+    h.ripples = ripples ? 1 : 0;
+    h.ripplegrid = g_ripplegrid;
+    h.rippleviscosity = g_rippleviscosity;
+    h.ripplecurrent = g_ripplecurrent;
+    advectscheme scheme = advectscheme::maccormack;
+    parseadvectscheme(g_advection, scheme);
+    h.rippleadvection = int32_t(scheme);
+    h.iwaverank = g_iwaverank;
+    h.rippleobstacle = g_rippleobstacle;
+    h.ripplesponge = g_ripplesponge;
+    h.rippleupsample = g_rippleupsample == "cubic" ? 1 : 0;
+    h.rippledetail = g_rippledetail;
+    h.clipmaplevels = g_clipmaplevels;
+    h.clipmapsize = g_clipmapsize;
+    h.simd = g_kernel.simd;
+    h.sinetier = g_kernel.sinetier;
+    c.drops = sim.rippledrops;
+    h.dropcount = uint32_t(c.drops.size());
+    if (ripples) {
+        h.ripplegridsteps = ripples->steps;
+        c.current = ripples->current;
+        c.previous = ripples->previous;
+    }
+    return c;
+}
+
+// a read-only view of a whole file
+class mappedfile {
+public:
+    ~mappedfile() { close(); }
+
+    bool open(const std::string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER filesize;
+        if (!GetFileSizeEx(file, &filesize) || filesize.QuadPart == 0) return false;
+        size = size_t(filesize.QuadPart);
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) return false;
+        view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+        return view != nullptr;
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        off_t end = lseek(fd, 0, SEEK_END);
+        if (end <= 0) return false;
+        size = size_t(end);
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) return false;
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        view = mapped;
+        return true;
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (view) UnmapViewOfFile(view);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (view) munmap(const_cast<void*>(view), size);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        view = nullptr;
+        size = 0;
+    }
+
+    const char* data() const { return static_cast<const char*>(view); }
+    size_t bytes() const { return size; }
+
+private:
+    const void* view = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE, mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+bool loadcheckpoint(const std::string& path, checkpoint& c, std::string& error) {
+    mappedfile file;
+    if (!file.open(path)) {
+        error = "cannot map " + path;
+        return false;
+    }
+    if (file.bytes() < sizeof(checkpointheader)) {
+        error = "truncated header";
+        return false;
+    }
+    memcpy(&c.header, file.data(), sizeof(checkpointheader));
+    const checkpointheader& h = c.header;
+    if (memcmp(h.magic, "FSCHECK1", 8) != 0 || h.headerbytes != sizeof(checkpointheader)) {
+        error = "not a checkpoint from this build";
+        return false;
+    }
+    // the restart takes its configuration from here, so every field must be one the command line could have set
+    const char* bad = nullptr;
+    auto finite = [](std::initializer_list<float> values) {
+        return std::all_of(values.begin(), values.end(), [](float v) { return std::isfinite(v); });
+    };
+    const waveparams& w = h.waves;
+    if (h.frame < 0 || h.ripplesteps < 0 || h.ripplegridsteps < 0 || !std::isfinite(h.timeaccumulator)) bad = "step counters";
+    else if (!finite({ h.cameraoffset[0], h.cameraoffset[1], h.cameravelocity[0], h.cameravelocity[1] })) bad = "camera";
+    else if (!finite({ w.amplitude1, w.amplitude2, w.frequency1, w.frequency2, w.speed1, w.speed2 })) bad = "wave parameters";
+    else if (!(h.aspectratio > 0.0f) || !std::isfinite(h.aspectratio)) bad = "aspect ratio";
+    else if (!(h.width > 0.0f && h.depth > 0.0f && h.thickness > 0.0f) || !finite({ h.width, h.depth, h.thickness })) bad = "volume extent";
+    else if (h.columns < 3 || h.columns > 1600 || h.rows < 3 || h.rows > 1600) bad = "grid size";
+    else if ((h.paused != 0 && h.paused != 1) || (h.ripples != 0 && h.ripples != 1)) bad = "flags";
+    else if (h.ripplegrid < 8 || h.ripplegrid > 4096) bad = "ripple grid size";
+    else if (!(h.rippleviscosity >= 0.0f) || !std::isfinite(h.rippleviscosity)) bad = "ripple viscosity";
+    else if (!(h.ripplecurrent >= -1.0f && h.ripplecurrent <= 1.0f)) bad = "ripple current";
+    else if (h.rippleadvection < 0 || h.rippleadvection > 2) bad = "advection scheme";
+    else if (h.iwaverank < -1 || h.iwaverank > iwavekernel::maxrank) bad = "iwave rank";
+    else if (!(h.rippleobstacle >= 0.0f && h.rippleobstacle <= 0.5f)) bad = "ripple obstacle";
+    else if (h.ripplesponge < 0 || h.ripplesponge > h.ripplegrid) bad = "ripple sponge";
+    else if ((h.rippleupsample != 0 && h.rippleupsample != 1) || !(h.rippledetail >= 0.0f) || !std::isfinite(h.rippledetail)) bad = "ripple upsampling";
+    else if (h.clipmaplevels < 0 || h.clipmaplevels > 12 || h.clipmapsize < 9 || h.clipmapsize > 4097) bad = "clipmap";
+    else if ((h.simd != 0 && h.simd != 1) || h.sinetier < 0 || h.sinetier > 2) bad = "kernel choice";
+    if (bad) {
+        error = std::string("header has an invalid ") + bad;
+        return false;
+    }
+
+    // sized from the header only once the file is known to hold that much, so a corrupt count cannot allocate
+    size_t cells = h.ripples ? size_t(h.ripplegrid) * h.ripplegrid : 0;
+    size_t payload = file.bytes() - sizeof(checkpointheader);
+    if (size_t(h.dropcount) * sizeof(rippledrop) + 2 * cells * sizeof(float) != payload) {
+        error = "size does not match its header";
+        return false;
+    }
+    c.drops.resize(h.dropcount);
+    c.current.resize(cells);
+    c.previous.resize(cells);
+    const char* p = file.data() + sizeof(checkpointheader);
+    memcpy(c.drops.data(), p, c.drops.size() * sizeof(rippledrop));
+    p += c.drops.size() * sizeof(rippledrop);
+    for (const rippledrop& d : c.drops) {
+        if (!finite({ d.u, d.v, d.radius, d.strength })) {
+            error = "a ripple drop is not finite";
+            return false;
+        }
+    }
+    memcpy(c.current.data(), p, cells * sizeof(float));
+    p += cells * sizeof(float);
+    memcpy(c.previous.data(), p, cells * sizeof(float));
+    return true;
+}
+
+// written next to the target and renamed over it, so a crash mid-write leaves the previous checkpoint intact
+bool writecheckpoint(const std::string& path, const checkpoint& c) {
+    std::string temporary = path + ".tmp";
+    FILE* out = fopen(temporary.c_str(), "wb");
+    if (!out) return false;
+    fwrite(&c.header, sizeof(c.header), 1, out);
+    fwrite(c.drops.data(), sizeof(rippledrop), c.drops.size(), out);
+    fwrite(c.current.data(), sizeof(float), c.current.size(), out);
+    fwrite(c.previous.data(), sizeof(float), c.previous.size(), out);
+    bool ok = !ferror(out);
+    ok = fclose(out) == 0 && ok;
+#ifdef _WIN32
+    // rename does not replace an existing file on windows
+    if (ok) remove(path.c_str());
+#endif
+    return ok && rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+void restorecheckpoint(const checkpoint& c, simstate& sim, ripplegrid* ripples) {
+    const checkpointheader& h = c.header;
+    sim.frame = long(h.frame);
+    sim.ripplesteps = long(h.ripplesteps);
+    sim.timeaccumulator = h.timeaccumulator;
+    sim.aspectratio = h.aspectratio;
+    sim.cameraoffset = glm::vec2(h.cameraoffset[0], h.cameraoffset[1]);
+    sim.cameravelocity = glm::vec2(h.cameravelocity[0], h.cameravelocity[1]);
+    sim.paused = h.paused != 0;
+    sim.rippledrops = c.drops;
+    g_globalSimTime = sim.timeaccumulator;
+    if (ripples) {
+        ripples->steps = long(h.ripplegridsteps);
+        ripples->current = c.current;
+        ripples->previous = c.previous;
+        ripples->refreshactivity();
+    }
+}
+
+// takes a snapshot every few frames on the simulation thread and writes it on the background thread, so the
+// simulation only pays for the copy. a snapshot due while the last one is still being written is skipped.
+class checkpointwriter {
+public:
+    checkpointwriter(tasksystem& b, std::string p, long e) : background(b), path(std::move(p)), every(e) {}
+
+    void afterstep(const simstate& sim, const watervolume& water, const ripplegrid* ripples) {
+        if (sim.frame % every != 0 || sim.frame == lastframe) return;
+        lastframe = sim.frame;
+        if (pending) {
+            std::lock_guard<std::mutex> lock(pending->mutex);
+            if (!pending->done) {
+                ++skipped;
+                return;
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        auto snapshot = std::make_shared<checkpoint>(capturecheckpoint(sim, water, ripples));
+        capturetime += secondssince(start);
+        ++captures;
+        pending = background.submit([this, snapshot] {
+            auto writestart = std::chrono::steady_clock::now();
+            bool ok = writecheckpoint(path, *snapshot);
+            double seconds = secondssince(writestart);
+            std::lock_guard<std::mutex> lock(statsmutex);
+            if (!ok) {
+                ++failed;
+                return;
+            }
+            ++written;
+            writetime += seconds;
+            writtenbytes = snapshot->bytes();
+            writtenframe = long(snapshot->header.frame);
+        });
+    }
+
+    // blocks until the last write is on disk
+    void finish() {
+        if (pending) background.wait(pending);
+    }
+
+    void report() const {
+        std::lock_guard<std::mutex> lock(statsmutex);
+        printf("  checkpoints: %ld written to %s (last at frame %ld, %.2f MB), copy %.3f ms each on the simulation thread, "
+            "write %.3f ms each in the background, %ld skipped while writing, %ld failed\n",
+            written, path.c_str(), writtenframe, writtenbytes / 1048576.0, captures ? 1000.0 * capturetime / captures : 0.0,
+            written ? 1000.0 * writetime / written : 0.0, skipped, failed);
+    }
+
+private:
+    tasksystem& background;
+    std::string path;
+    long every;
+    long lastframe = -1;
+    std::shared_ptr<tasksystem::task> pending;
+    long captures = 0, skipped = 0;
+    double capturetime = 0;
+    mutable std::mutex statsmutex;
+    long written = 0, failed = 0, writtenframe = -1;
+    size_t writtenbytes = 0;
+    double writetime = 0;
+};
+
+// everything a renderer needs to place the camera and light for one frame
+struct frameview {
+    glm::mat4 model, view, projection;
+    glm::vec3 camerapos, lightpos;
+};
+
+// the interface the sequential loop renders through, so backends can be swapped and compared.
+// the pipelined loop stays on gl directly since it interleaves fences and readbacks with the frame stages.
+class renderer {
+public:
+    virtual ~renderer() = default;
+    virtual const char* name() const = 0;
+    // replaces the mesh, at startup and after a grid resize
+    virtual void setmesh(const std::vector<vertex>& vertices, const std::vector<unsigned int>& indices) = 0;
+    virtual void upload(const std::vector<vertex>& vertices) = 0;
+    // draws the ranges and presents the frame
+    virtual void draw(const frameview& view, const std::vector<drawrange>& ranges) = 0;
+
+    // cpu time spent issuing api calls for uploads and draws, excluding waits on the gpu and presentation
+    double submittime = 0;
+};
+
+class surfacemaps;
+class volumedrawer;
+
+struct framecontext {
+    framecontext(tasksystem& t, tasksystem& b, framescheduler& s, GLFWwindow* w, GLuint program)
+        : tasks(t), background(b), scheduler(s), window(w), shaderprogram(program) {}
+
+    tasksystem& tasks;
+    tasksystem& background;  // long jobs such as mesh rebuilds, kept off the per-frame task queue
+    framescheduler& scheduler;
+    GLFWwindow* window;
+    GLuint shaderprogram;
+    std::shared_ptr<watervolume> water;
+    std::shared_ptr<gpumesh> mesh;
+    std::unique_ptr<clipmap> ocean;  // open-water mode: drawn instead of the volume, through the same mesh slots
+    std::unique_ptr<tilecache> bathymetry;
+    std::unique_ptr<renderer> backend;  // used by the sequential loop
+    std::unique_ptr<ripplegrid> ripples;  // --ripples cpu
+    std::unique_ptr<rippleupsampler> upsampler;  // --ripple-upsample cubic
+    std::unique_ptr<gpuripples> ripplepasses;  // --ripples gpu
+    std::unique_ptr<surfacemaps> maps;  // --reflections
+    std::unique_ptr<volumedrawer> drawer;  // gl only: culling, draw order, depth prepass and --overdraw
+    glresidentwaves* gpuwaves = nullptr;  // --compute gl or feedback: dispatched in place of vertex uploads
+    std::unique_ptr<checkpointwriter> checkpoints;
+    float farplane = 500.0f;
+    glm::vec3 camerapos, lightpos;
+    glm::mat4 model;
+    simstate sim;
+    stagetimings timings;
+
+    // a finished resize waits here until the next step boundary swaps it in
+    std::shared_ptr<watervolume> pendingwater;
+    std::shared_ptr<gpumesh> pendingmesh;
+    std::vector<frametask> resizes;
+    bool resizing = false;
+    bool resizeframe = false;  // the sequential loop resized in place this frame
+    int queuedgrid = 0;
+    std::chrono::steady_clock::time_point lastpresent = std::chrono::steady_clock::now();
+};
+
+static glm::mat4 viewmatrix(const glm::vec3& camerapos, const glm::vec3& target = glm::vec3(0, 0, 0)) {
+    return glm::lookAt(
+        camerapos,
+        target,
+        glm::vec3(0, 1, 0)
+    );
+}
+
+static glm::mat4 projectionmatrix(float aspectratio, float farplane = 500.0f) {
+    // the perspective matrix creates a realistic depth effect using field-of-view.
+    return glm::perspective(
+        glm::radians(45.0f),
+        aspectratio,
+        0.1f,
+        farplane
+    );
+}
+
+static void usewatershader(GLuint shaderprogram, const glm::mat4& model, const glm::mat4& view,
+    const glm::mat4& projection, const glm::vec3& camerapos, const glm::vec3& lightpos) {
+    glUseProgram(shaderprogram);
+    glUniformMatrix4fv(glGetUniformLocation(shaderprogram, "uModel"), 1, GL_FALSE, glm::value_ptr(model));
+    glUniformMatrix4fv(glGetUniformLocation(shaderprogram, "uView"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(shaderprogram, "uProj"), 1, GL_FALSE, glm::value_ptr(projection));
+
+    glUniform3fv(glGetUniformLocation(shaderprogram, "uCamPos"), 1, glm::value_ptr(camerapos));
+    glUniform3fv(glGetUniformLocation(shaderprogram, "uLightPos"), 1, glm::value_ptr(lightpos));
+    glUniform1i(glGetUniformLocation(shaderprogram, "uSteps"), 3);
+
+    glm::vec3 darkcolor(0.0f, 0.0f, 0.5f);
+    glm::vec3 lightcolor(0.3f, 0.6f, 1.0f);
+    glUniform3fv(glGetUniformLocation(shaderprogram, "uDarkColor"), 1, glm::value_ptr(darkcolor));
+    glUniform3fv(glGetUniformLocation(shaderprogram, "uLightColor"), 1, glm::value_ptr(lightcolor));
+}
+
+// the sky behind the mirrored geometry of the reflection pass, on the fullscreen triangle of ripple_vertex_source.
+// each fragment's view ray comes from the inverse of the pass's view-projection.
+static const char* sky_fragment_source = R"(
+#version 330 core
+uniform mat4 uInverseViewProj;
+uniform vec3 uEye;
+uniform vec2 uSize;
+uniform vec3 uSunDir;
+uniform vec3 uZenith;
+uniform vec3 uHorizon;
+out vec4 fragColor;
 void main() {
-    vec4 worldPos = uModel * vec4(aPos, 1.0);
-    vWorldPos = worldPos.xyz;
-    vNormal = mat3(uModel) * aNormal;
-    gl_Position = uProj * uView * worldPos;
+    vec4 far = uInverseViewProj * vec4(gl_FragCoord.xy / uSize * 2.0 - 1.0, 1.0, 1.0);
+    vec3 ray = normalize(far.xyz / far.w - uEye);
+    vec3 color = mix(uHorizon, uZenith, sqrt(clamp(ray.y, 0.0, 1.0)));
+    color += vec3(1.0, 0.9, 0.7) * pow(max(dot(ray, uSunDir), 0.0), 256.0);
+    fragColor = vec4(color, 1.0);
+}
+)";
+
+// planar reflection and refraction of the volume, rendered into textures at a fraction of the framebuffer size and
+// refreshed every few frames. the reflection is the sky and the walls above the mean surface, seen by the camera
+// mirrored below it; the refraction is the walls and bottom sheet under it. both draw a simplified copy of the mesh
+// without ripples. the water shader projects each fragment with the matrices the maps were rendered with, so between
+// refreshes the maps are reprojected to where the camera has moved, and it pushes the lookups along the normal.
+class surfacemaps {
+public:
+    static constexpr int stride = 4;  // grid rows and columns per simplified cell
+
+    surfacemaps(float fraction, int every, GLuint program) : scale(fraction), interval(every), waterprogram(program) {
+        glGenTextures(2, textures);
+        glGenRenderbuffers(2, depthbuffers);
+        glGenFramebuffers(2, framebuffers);
+        glGenVertexArrays(1, &vao);
+        glGenVertexArrays(1, &emptyvao);
+        glGenBuffers(1, &ebo);
+        glGenQueries(GLsizei(queries.size()), queries.data());
+        skyprogram = createshaderprogram(ripple_vertex_source, sky_fragment_source);
+    }
+
+    ~surfacemaps() {
+        glDeleteTextures(2, textures);
+        glDeleteRenderbuffers(2, depthbuffers);
+        glDeleteFramebuffers(2, framebuffers);
+        glDeleteVertexArrays(1, &vao);
+        glDeleteVertexArrays(1, &emptyvao);
+        glDeleteBuffers(1, &ebo);
+        glDeleteQueries(GLsizei(queries.size()), queries.data());
+        glDeleteProgram(skyprogram);
+    }
+
+    surfacemaps(const surfacemaps&) = delete;
+    surfacemaps& operator=(const surfacemaps&) = delete;
+
+    // the grid of the volume being drawn; the simplified mesh is rebuilt at the next refresh when it changes
+    void setgrid(int columns, int rows) {
+        gridcolumns = columns;
+        gridrows = rows;
+    }
+
+    // refreshes the maps when they are due, from the frame's vertices in vbo. runs before the frame clears, and
+    // leaves the framebuffer and viewport as it found them.
+    void render(GLuint vbo, const frameview& view) {
+        ++frames;
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        int width = std::max(1, int(viewport[2] * scale)), height = std::max(1, int(viewport[3] * scale));
+        bool resized = width != mapwidth || height != mapheight;
+        if (!resized && frames - lastrefresh < interval) return;
+        auto start = std::chrono::steady_clock::now();
+        collectqueries();
+        if (resized) allocate(width, height);
+        if (gridcolumns != builtcolumns || gridrows != builtrows) buildmesh();
+        bool timed = inflight < int(queries.size());
+        if (timed) glBeginQuery(GL_TIME_ELAPSED, queries[(first + inflight) % queries.size()]);
+
+        glViewport(0, 0, width, height);
+        glEnable(GL_CLIP_DISTANCE0);
+        float level = view.model[3][1];
+        glm::mat4 mirror = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, level, 0.0f)) *
+            glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, -1.0f, 1.0f)) *
+            glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -level, 0.0f));
+        glm::mat4 reflectionview = view.view * mirror;
+        reflectionviewproj = view.projection * reflectionview;
+        refractionviewproj = view.projection * view.view;
+
+        // reflection: the sky, then the walls above the surface
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[0]);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glDisable(GL_DEPTH_TEST);
+        glUseProgram(skyprogram);
+        glm::vec3 eye(view.camerapos.x, 2.0f * level - view.camerapos.y, view.camerapos.z);
+        glm::vec3 sun = glm::normalize(view.lightpos - view.camerapos);
+        glUniformMatrix4fv(glGetUniformLocation(skyprogram, "uInverseViewProj"), 1, GL_FALSE,
+            glm::value_ptr(glm::inverse(reflectionviewproj)));
+        glUniform3fv(glGetUniformLocation(skyprogram, "uEye"), 1, glm::value_ptr(eye));
+        glUniform2f(glGetUniformLocation(skyprogram, "uSize"), float(width), float(height));
+        glUniform3fv(glGetUniformLocation(skyprogram, "uSunDir"), 1, glm::value_ptr(sun));
+        glUniform3f(glGetUniformLocation(skyprogram, "uZenith"), 0.3f, 0.5f, 1.0f);
+        glUniform3f(glGetUniformLocation(skyprogram, "uHorizon"), 0.75f, 0.85f, 1.0f);
+        glBindVertexArray(emptyvao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glEnable(GL_DEPTH_TEST);
+        drawpass(vbo, view, reflectionview, glm::vec4(0.0f, 1.0f, 0.0f, -level), wallcount);
+
+        // refraction: the walls and bottom sheet below it, against deep water
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[1]);
+        glClearColor(0.0f, 0.1f, 0.3f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        drawpass(vbo, view, view.view, glm::vec4(0.0f, -1.0f, 0.0f, level), indexcount);
+
+        glDisable(GL_CLIP_DISTANCE0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindVertexArray(0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        if (timed) {
+            glEndQuery(GL_TIME_ELAPSED);
+            ++inflight;
+        }
+        lastrefresh = frames;
+        ++refreshes;
+        issueseconds += secondssince(start);
+    }
+
+    // points the water shader, already in use, at the newest maps
+    void bind(GLuint program) const {
+        if (refreshes == 0) return;
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, textures[0]);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, textures[1]);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(glGetUniformLocation(program, "uReflection"), 1);
+        glUniform1i(glGetUniformLocation(program, "uRefraction"), 2);
+        glUniformMatrix4fv(glGetUniformLocation(program, "uReflectionViewProj"), 1, GL_FALSE, glm::value_ptr(reflectionviewproj));
+        glUniformMatrix4fv(glGetUniformLocation(program, "uRefractionViewProj"), 1, GL_FALSE, glm::value_ptr(refractionviewproj));
+        glUniform1f(glGetUniformLocation(program, "uDistortion"), 0.05f);
+        glUniform1i(glGetUniformLocation(program, "uSurfaceMaps"), 1);
+    }
+
+    void report() const {
+        double perframe = frames ? 1.0 / double(frames) : 0.0;
+        double gpu = timedrefreshes ? 1e-6 * double(gpunanoseconds) / timedrefreshes : 0.0;
+        printf("  reflection maps: %dx%d (%.2f of the framebuffer), %ld refreshes over %ld frames, every %d\n",
+            mapwidth, mapheight, scale, refreshes, frames, interval);
+        printf("  per frame: gpu %.3f ms (%.3f ms per refresh over %ld timed), cpu issue %.3f ms\n",
+            gpu * refreshes * perframe, gpu, timedrefreshes, 1000.0 * issueseconds * perframe);
+    }
+
+private:
+    float scale;
+    int interval;
+    GLuint waterprogram;
+    GLuint textures[2] = {}, depthbuffers[2] = {}, framebuffers[2] = {};
+    GLuint vao = 0, emptyvao = 0, ebo = 0, skyprogram = 0;
+    int mapwidth = 0, mapheight = 0;
+    int gridcolumns = 0, gridrows = 0, builtcolumns = 0, builtrows = 0;
+    GLsizei wallcount = 0, indexcount = 0;
+    glm::mat4 reflectionviewproj{ 1.0f }, refractionviewproj{ 1.0f };
+    long frames = 0, lastrefresh = 0, refreshes = 0;
+    double issueseconds = 0.0;
+    std::array<GLuint, 4> queries{};
+    int first = 0, inflight = 0;  // ring of timer queries still waiting for their results, as in glresidentwaves
+    bool warmedup = false;
+    GLuint64 gpunanoseconds = 0;
+    long timedrefreshes = 0;
+
+    // one color texture and depth buffer per map, at the new size
+    void allocate(int width, int height) {
+        mapwidth = width;
+        mapheight = height;
+        for (int i = 0; i < 2; ++i) {
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindRenderbuffer(GL_RENDERBUFFER, depthbuffers[i]);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthbuffers[i]);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                std::cerr << "error reflection framebuffer incomplete\n";
+            }
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void buildmesh() {
+        std::vector<unsigned int> indices;
+        wallcount = GLsizei(watervolume::simplifiedindices(gridcolumns, gridrows, stride, indices));
+        indexcount = GLsizei(indices.size());
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+        glBindVertexArray(0);
+        builtcolumns = gridcolumns;
+        builtrows = gridrows;
+    }
+
+    // the first count simplified indices with the toon shader, clipped to one side of the surface
+    void drawpass(GLuint vbo, const frameview& view, const glm::mat4& passview, const glm::vec4& plane, GLsizei count) {
+        usewatershader(waterprogram, view.model, passview, view.projection, view.camerapos, view.lightpos);
+        glUniform4fv(glGetUniformLocation(waterprogram, "uClipPlane"), 1, glm::value_ptr(plane));
+        glUniform4f(glGetUniformLocation(waterprogram, "uRippleMap"), 0.0f, 0.0f, 0.0f, 0.0f);
+        glUniform1i(glGetUniformLocation(waterprogram, "uSurfaceMaps"), 0);
+        glBindVertexArray(vao);
+        // the frame's vertex buffer changes with the slot, so the attributes are pointed at it every refresh
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)(3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+        glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, 0);
+    }
+
+    void collectqueries() {
+        while (inflight > 0) {
+            GLuint query = queries[first];
+            GLint available = 0;
+            glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) break;
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+            // the first refresh allocates the maps and compiles the sky shader on first use, so it is left out
+            if (std::exchange(warmedup, true)) {
+                gpunanoseconds += elapsed;
+                ++timedrefreshes;
+            }
+            first = (first + 1) % int(queries.size());
+            --inflight;
+        }
+    }
+};
+
+// draws the volume after the clear. buildmesh winds every face clockwise seen from outside, so with culling on only
+// the faces towards the camera reach the rasterizer, drawn front to back in orderedranges' bands so the depth test
+// rejects what they hide before it is shaded. --depth-prepass lays down depth first with a shader that writes
+// nothing, and the toon shader then runs once per pixel. --no-cull keeps the single draw of every face in buildmesh
+// order. --overdraw draws both ways each frame with additive heat instead of shading and counts the fragments that
+// pass the depth test with a stencil increment, and the fragment shader invocations where the driver has
+// ARB_pipeline_statistics_query. reading them back every frame stalls the pipeline, so it is only for measuring.
+class volumedrawer {
+public:
+    volumedrawer(GLuint program, bool culling, bool depthprepass, bool overdraw)
+        : waterprogram(program), cull(culling), prepass(depthprepass), measure(overdraw) {
+        if (prepass) depthprogram = createshaderprogram(vertex_shader_source, depth_fragment_source);
+        if (measure) {
+            heatprogram = createshaderprogram(vertex_shader_source, overdraw_fragment_source);
+            if (GLEW_ARB_pipeline_statistics_query) glGenQueries(1, &query);
+        }
+    }
+
+    ~volumedrawer() {
+        if (depthprogram) glDeleteProgram(depthprogram);
+        if (heatprogram) glDeleteProgram(heatprogram);
+        if (query) glDeleteQueries(1, &query);
+    }
+
+    volumedrawer(const volumedrawer&) = delete;
+    volumedrawer& operator=(const volumedrawer&) = delete;
+
+    // front to back from the camera when culling, else the whole index buffer in buildmesh order
+    std::vector<drawrange> ranges(const watervolume& water, const glm::mat4& model, const glm::vec3& camerapos) const {
+        if (!cull) return { { GLsizei(water.indices.size()), 0, 0 } };
+        glm::vec4 eye = glm::inverse(model) * glm::vec4(camerapos, 1.0f);
+        return water.orderedranges(glm::vec3(eye.x, eye.y, eye.z));
+    }
+
+    // setup puts the given program in use with the frame's uniforms and textures
+    void draw(GLuint vao, const std::vector<drawrange>& ranges, const std::function<void(GLuint)>& setup) {
+        glBindVertexArray(vao);
+        if (!measure) {
+            submit(ranges, cull, prepass, waterprogram, setup);
+            return;
+        }
+        GLsizei total = 0;
+        for (const drawrange& range : ranges) total += range.count;
+        // before: every face in buildmesh order. after: this run's settings, whose heat stays in the frame
+        count(before, { { total, 0, 0 } }, false, false, setup);
+        count(after, ranges, cull, prepass, setup);
+        ++frames;
+    }
+
+    void report() const {
+        if (!measure || frames == 0) return;
+        std::string current = cull ? "culled front to back" : "every face in buildmesh order";
+        if (prepass) current += " after a depth prepass";
+        printf("  overdraw over %ld frames, %.0f pixels covered per frame:\n", frames, after.covered / frames);
+        reporttally("every face in buildmesh order", before);
+        reporttally(current.c_str(), after);
+    }
+
+private:
+    struct tally {
+        double covered = 0, shaded = 0, invocations = 0;
+    };
+
+    void submit(const std::vector<drawrange>& ranges, bool culled, bool depthfirst, GLuint program,
+        const std::function<void(GLuint)>& setup) {
+        if (culled) {
+            glEnable(GL_CULL_FACE);
+            glFrontFace(GL_CW);
+        }
+        if (depthfirst) {
+            setup(depthprogram);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            drawranges(ranges);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthFunc(GL_LEQUAL);
+            glDepthMask(GL_FALSE);
+        }
+        if (measure) {
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE);
+            glEnable(GL_STENCIL_TEST);
+            glStencilFunc(GL_ALWAYS, 0, 0xff);
+            glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+        }
+        setup(program);
+        drawranges(ranges);
+        glDisable(GL_STENCIL_TEST);
+        glDisable(GL_BLEND);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glFrontFace(GL_CCW);
+        glDisable(GL_CULL_FACE);
+    }
+
+    static void drawranges(const std::vector<drawrange>& ranges) {
+        for (const drawrange& range : ranges) {
+            glDrawElementsBaseVertex(GL_TRIANGLES, range.count, GL_UNSIGNED_INT,
+                reinterpret_cast<void*>(range.first * sizeof(unsigned int)), range.basevertex);
+        }
+    }
+
+    // one measured draw from a black, empty frame; the stencil holds how many fragments each pixel shaded
+    void count(tally& into, const std::vector<drawrange>& ranges, bool culled, bool depthfirst,
+        const std::function<void(GLuint)>& setup) {
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClearStencil(0);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+        if (query) glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, query);
+        submit(ranges, culled, depthfirst, heatprogram, setup);
+        if (query) {
+            glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+            GLuint64 invocations = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &invocations);
+            into.invocations += double(invocations);
+        }
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        stencil.resize(size_t(viewport[2]) * viewport[3]);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(viewport[0], viewport[1], viewport[2], viewport[3], GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, stencil.data());
+        for (unsigned char layers : stencil) {
+            into.shaded += layers;
+            into.covered += layers > 0;
+        }
+    }
+
+    void reporttally(const char* label, const tally& t) const {
+        printf("    %s: %.0f fragments shaded per frame, %.2f per covered pixel", label, t.shaded / frames,
+            t.covered > 0 ? t.shaded / t.covered : 0.0);
+        if (query) printf(", %.0f fragment shader invocations", t.invocations / frames);
+        printf("\n");
+    }
+
+    GLuint waterprogram, depthprogram = 0, heatprogram = 0, query = 0;
+    bool cull, prepass, measure;
+    std::vector<unsigned char> stencil;
+    tally before, after;
+    long frames = 0;
+};
+
+void drawwater(volumedrawer& drawer, GLuint shaderprogram, GLuint vao, const std::vector<drawrange>& ranges,
+    const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& camerapos,
+    const glm::vec3& lightpos, const gpuripples* ripples = nullptr, const surfacemaps* maps = nullptr) {
+    glClearColor(0.3f, 0.5f, 1.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    drawer.draw(vao, ranges, [&](GLuint program) {
+        usewatershader(program, model, view, projection, camerapos, lightpos);
+        if (ripples) ripples->bind(program);
+        if (maps && program == shaderprogram) maps->bind(program);
+    });
+}
+
+// the clipmap's levels as given, with no culling or reordering
+void drawclipmap(GLuint shaderprogram, GLuint vao, const std::vector<drawrange>& ranges, const glm::mat4& model,
+    const glm::mat4& view, const glm::mat4& projection, const glm::vec3& camerapos, const glm::vec3& lightpos,
+    const gpuripples* ripples = nullptr) {
+    glClearColor(0.3f, 0.5f, 1.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    usewatershader(shaderprogram, model, view, projection, camerapos, lightpos);
+    if (ripples) ripples->bind(shaderprogram);
+    glBindVertexArray(vao);
+    for (const drawrange& range : ranges) {
+        glDrawElementsBaseVertex(GL_TRIANGLES, range.count, GL_UNSIGNED_INT,
+            reinterpret_cast<void*>(range.first * sizeof(unsigned int)), range.basevertex);
+    }
+}
+
+// builds a vao around a fresh dynamic vertex buffer and the shared index buffer
+void createvertexarray(const std::vector<vertex>& vertices, GLuint ebo, GLuint& vao, GLuint& vbo) {
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    // GL_DYNAMIC_DRAW is used since the vertex data is updated every frame.
+    // the buffer starts empty; every frame uploads the full vertex array before drawing.
+    glBufferData(GL_ARRAY_BUFFER,
+        vertices.size() * sizeof(vertex),
+        nullptr,
+        GL_DYNAMIC_DRAW);
+
+    // setup vertex attribute pointers
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)0);
+    glEnableVertexAttribArray(0);
+    // the normal attribute is located after the position in the vertex structure.
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBindVertexArray(0);
+}
+
+// copies part of the volume's index data into the mesh's index buffer.
+// the copy-write target works without a vao bound, so staging can happen between frames.
+void uploadindices(const gpumesh& mesh, const watervolume& water, size_t offset, size_t bytes) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, mesh.ebo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, offset, bytes, reinterpret_cast<const char*>(water.indices.data()) + offset);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+// allocates one frame slot's vertex array, vertex buffer and readback buffer around the mesh's index buffer
+void createslot(frameslot& slot, const std::vector<vertex>& vertices, GLuint ebo) {
+    createvertexarray(vertices, ebo, slot.vao, slot.vbo);
+    glGenBuffers(1, &slot.pbo);
+}
+
+// allocates the gpu buffers for a surface; the index data is uploaded here only when fillindices is set
+std::shared_ptr<gpumesh> creategpumesh(const std::vector<vertex>& vertices, const std::vector<unsigned int>& indices, int slotcount, bool fillindices) {
+    auto mesh = std::make_shared<gpumesh>();
+    mesh->indexcount = static_cast<GLsizei>(indices.size());
+    glGenBuffers(1, &mesh->ebo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, mesh->ebo);
+    glBufferData(GL_COPY_WRITE_BUFFER,
+        indices.size() * sizeof(unsigned int),
+        fillindices ? indices.data() : nullptr,
+        GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    mesh->slots.resize(slotcount);
+    for (auto& slot : mesh->slots) createslot(slot, vertices, mesh->ebo);
+    return mesh;
+}
+
+// the original gl 3.3 path behind the renderer interface: one vertex buffer, uniforms set per frame
+class glrenderer : public renderer {
+public:
+    glrenderer(GLFWwindow* w, GLuint program) : window(w), shaderprogram(program) {}
+
+    const char* name() const override { return "gl"; }
+
+    void setmesh(const std::vector<vertex>& vertices, const std::vector<unsigned int>& indices) override {
+        mesh = creategpumesh(vertices, indices, 1, true);
+    }
+
+    void upload(const std::vector<vertex>& vertices) override {
+        auto start = std::chrono::steady_clock::now();
+        if (gpuwaves) {
+            gpuwaves->dispatch(mesh->slots[0].vbo);
+        }
+        else {
+            uploadvertices(mesh->slots[0].vbo, vertices);
+        }
+        submittime += secondssince(start);
+    }
+
+    void draw(const frameview& view, const std::vector<drawrange>& ranges) override {
+        auto start = std::chrono::steady_clock::now();
+        if (maps) maps->render(mesh->slots[0].vbo, view);
+        if (drawer) {
+            drawwater(*drawer, shaderprogram, mesh->slots[0].vao, ranges, view.model, view.view, view.projection,
+                view.camerapos, view.lightpos, ripples, maps);
+        }
+        else {
+            drawclipmap(shaderprogram, mesh->slots[0].vao, ranges, view.model, view.view, view.projection,
+                view.camerapos, view.lightpos, ripples);
+        }
+        submittime += secondssince(start);
+        glfwSwapBuffers(window);
+    }
+
+    const gpuripples* ripples = nullptr;
+    glresidentwaves* gpuwaves = nullptr;
+    surfacemaps* maps = nullptr;
+    volumedrawer* drawer = nullptr;  // draws the volume; the clipmap's levels are drawn as given
+
+private:
+    GLFWwindow* window;
+    GLuint shaderprogram;
+    std::shared_ptr<gpumesh> mesh;
+};
+
+#ifdef FLUIDSIM_VULKAN
+// the push constant block shared with shaders/water-vk.vert and .frag
+struct vkframeconstants {
+    glm::mat4 mvp;
+    glm::vec4 lightpos;
+    glm::vec4 darkcolor;
+    glm::vec4 lightcolor;
+};
+
+static std::vector<uint32_t> readspirv(const char* path) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) return {};
+    std::vector<uint32_t> words(size_t(in.tellg()) / sizeof(uint32_t));
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(words.data()), words.size() * sizeof(uint32_t));
+    return words;
+}
+
+// a vulkan 1.0 backend with explicit synchronization, aimed at comparing cpu submit cost with the gl path.
+// vertices are copied into a persistently mapped staging buffer and moved to a device-local buffer on the
+// transfer queue. the draw waits on that copy through a semaphore, and each frame in flight has its own pair
+// of buffers. the copy command buffers are recorded once per mesh. each (frame slot, swapchain image) has its
+// own draw command buffer, re-recorded only when the push constants, draw ranges or extent change.
+// runs on any vulkan 1.0 device, including mesa's lavapipe on the cpu.
+class vulkanrenderer : public renderer {
+public:
+    static constexpr int framesinflight = 2;
+
+    explicit vulkanrenderer(GLFWwindow* w) : window(w) {}
+
+    ~vulkanrenderer() override {
+        if (device) {
+            vkDeviceWaitIdle(device);
+            destroymesh();
+            destroyswapchain();
+            for (auto& slot : slots) {
+                vkDestroyFence(device, slot.fence, nullptr);
+                vkDestroySemaphore(device, slot.imageavailable, nullptr);
+                vkDestroySemaphore(device, slot.transferdone, nullptr);
+            }
+            vkDestroyPipeline(device, pipeline, nullptr);
+            vkDestroyPipelineLayout(device, pipelinelayout, nullptr);
+            vkDestroyRenderPass(device, renderpass, nullptr);
+            vkDestroyCommandPool(device, graphicspool, nullptr);
+            vkDestroyCommandPool(device, transferpool, nullptr);
+            vkDestroyDevice(device, nullptr);
+        }
+        if (surface) vkDestroySurfaceKHR(instance, surface, nullptr);
+        if (instance) vkDestroyInstance(instance, nullptr);
+    }
+
+    const char* name() const override { return "vulkan"; }
+    std::string devicename() const { return properties.deviceName; }
+
+    // creates everything except the mesh buffers; returns false with a reason when no usable device exists
+    bool init(std::string& error) {
+        VkApplicationInfo app{};
+        app.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+        app.pApplicationName = "fluid-sim";
+        app.apiVersion = VK_API_VERSION_1_0;
+        uint32_t extensioncount = 0;
+        const char** extensions = glfwGetRequiredInstanceExtensions(&extensioncount);
+        VkInstanceCreateInfo instanceinfo{};
+        instanceinfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        instanceinfo.pApplicationInfo = &app;
+        instanceinfo.enabledExtensionCount = extensioncount;
+        instanceinfo.ppEnabledExtensionNames = extensions;
+        if (!extensions || vkCreateInstance(&instanceinfo, nullptr, &instance) != VK_SUCCESS) return fail(error, "no vulkan instance");
+        if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) return fail(error, "no window surface");
+        if (!pickdevice()) return fail(error, "no device that can draw to the window");
+
+        // a dedicated transfer family gets its own queue; otherwise a second queue of the graphics family if there is one
+        float priorities[2] = { 1.0f, 1.0f };
+        std::vector<VkDeviceQueueCreateInfo> queueinfos;
+        VkDeviceQueueCreateInfo graphicsqueue{};
+        graphicsqueue.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        graphicsqueue.queueFamilyIndex = graphicsfamily;
+        graphicsqueue.queueCount = transferfamily == graphicsfamily ? transferqueueindex + 1 : 1;
+        graphicsqueue.pQueuePriorities = priorities;
+        queueinfos.push_back(graphicsqueue);
+        if (transferfamily != graphicsfamily) {
+            VkDeviceQueueCreateInfo transferqueueinfo = graphicsqueue;
+            transferqueueinfo.queueFamilyIndex = transferfamily;
+            transferqueueinfo.queueCount = 1;
+            queueinfos.push_back(transferqueueinfo);
+        }
+        const char* deviceextensions[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+        VkDeviceCreateInfo deviceinfo{};
+        deviceinfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        deviceinfo.queueCreateInfoCount = uint32_t(queueinfos.size());
+        deviceinfo.pQueueCreateInfos = queueinfos.data();
+        deviceinfo.enabledExtensionCount = 1;
+        deviceinfo.ppEnabledExtensionNames = deviceextensions;
+        if (vkCreateDevice(physicaldevice, &deviceinfo, nullptr, &device) != VK_SUCCESS) return fail(error, "device creation failed");
+        vkGetDeviceQueue(device, graphicsfamily, 0, &drawqueue);
+        vkGetDeviceQueue(device, transferfamily, transferfamily == graphicsfamily ? transferqueueindex : 0, &transferqueue);
+
+        VkCommandPoolCreateInfo poolinfo{};
+        poolinfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolinfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        poolinfo.queueFamilyIndex = graphicsfamily;
+        vkCreateCommandPool(device, &poolinfo, nullptr, &graphicspool);
+        poolinfo.queueFamilyIndex = transferfamily;
+        vkCreateCommandPool(device, &poolinfo, nullptr, &transferpool);
+
+        for (auto& slot : slots) {
+            VkFenceCreateInfo fenceinfo{};
+            fenceinfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            fenceinfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+            vkCreateFence(device, &fenceinfo, nullptr, &slot.fence);
+            VkSemaphoreCreateInfo semaphoreinfo{};
+            semaphoreinfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            vkCreateSemaphore(device, &semaphoreinfo, nullptr, &slot.imageavailable);
+            vkCreateSemaphore(device, &semaphoreinfo, nullptr, &slot.transferdone);
+        }
+        if (!createswapchain()) return fail(error, "swapchain creation failed");
+        if (!createpipeline()) return fail(error, "could not load shaders/water-vk.vert.spv and shaders/water-vk.frag.spv");
+        return true;
+    }
+
+    void setmesh(const std::vector<vertex>& vertices, const std::vector<unsigned int>& indices) override {
+        vkDeviceWaitIdle(device);
+        destroymesh();
+        vertexbytes = vertices.size() * sizeof(vertex);
+
+        // indices go through a temporary staging buffer once; the copy is waited on since it happens at startup or resize
+        VkDeviceSize indexbytes = indices.size() * sizeof(unsigned int);
+        buffer staging = createbuffer(indexbytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        memcpy(staging.mapped, indices.data(), indexbytes);
+        indexbuffer = createbuffer(indexbytes, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VkCommandBuffer copy = allocatecommands(transferpool, 1)[0];
+        VkCommandBufferBeginInfo begin{};
+        begin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(copy, &begin);
+        VkBufferCopy region{ 0, 0, indexbytes };
+        vkCmdCopyBuffer(copy, staging.handle, indexbuffer.handle, 1, &region);
+        vkEndCommandBuffer(copy);
+        VkSubmitInfo submit{};
+        submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit.commandBufferCount = 1;
+        submit.pCommandBuffers = &copy;
+        vkQueueSubmit(transferqueue, 1, &submit, VK_NULL_HANDLE);
+        vkQueueWaitIdle(transferqueue);
+        vkFreeCommandBuffers(device, transferpool, 1, &copy);
+        destroybuffer(staging);
+
+        for (auto& slot : slots) {
+            slot.staging = createbuffer(vertexbytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+            slot.vertices = createbuffer(vertexbytes, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            // the per-frame copy never changes, so it is recorded once here and resubmitted every frame
+            slot.transfer = allocatecommands(transferpool, 1)[0];
+            VkCommandBufferBeginInfo reusable{};
+            reusable.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            vkBeginCommandBuffer(slot.transfer, &reusable);
+            VkBufferCopy vertexregion{ 0, 0, vertexbytes };
+            vkCmdCopyBuffer(slot.transfer, slot.staging.handle, slot.vertices.handle, 1, &vertexregion);
+            vkEndCommandBuffer(slot.transfer);
+        }
+        invalidatedraws();
+    }
+
+    void upload(const std::vector<vertex>& vertices) override {
+        if (!beginframe()) return;
+        auto start = std::chrono::steady_clock::now();
+        frameslot& slot = slots[current];
+        memcpy(slot.staging.mapped, vertices.data(), std::min(vertexbytes, VkDeviceSize(vertices.size() * sizeof(vertex))));
+        VkSubmitInfo submit{};
+        submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit.commandBufferCount = 1;
+        submit.pCommandBuffers = &slot.transfer;
+        submit.signalSemaphoreCount = 1;
+        submit.pSignalSemaphores = &slot.transferdone;
+        vkQueueSubmit(transferqueue, 1, &submit, VK_NULL_HANDLE);
+        slot.uploaded = true;
+        submittime += secondssince(start);
+    }
+
+    void draw(const frameview& view, const std::vector<drawrange>& ranges) override {
+        if (!beginframe()) return;
+        auto start = std::chrono::steady_clock::now();
+        frameslot& slot = slots[current];
+
+        // glm builds gl clip space; vulkan's has y pointing down and depth in [0, 1]
+        glm::mat4 vkclip(1.0f);
+        vkclip[1][1] = -1.0f;
+        vkclip[2][2] = 0.5f;
+        vkclip[3][2] = 0.5f;
+        vkframeconstants constants;
+        constants.mvp = vkclip * view.projection * view.view * view.model;
+        constants.lightpos = glm::inverse(view.model) * glm::vec4(view.lightpos, 1.0f);
+        constants.darkcolor = glm::vec4(0.0f, 0.0f, 0.5f, 3.0f);
+        constants.lightcolor = glm::vec4(0.3f, 0.6f, 1.0f, 0.0f);
+
+        drawstate& state = slot.draws[imageindex];
+        if (!state.recorded || memcmp(&state.constants, &constants, sizeof(constants)) != 0 || state.ranges != ranges) {
+            record(slot, imageindex, constants, ranges);
+            ++rerecords;
+        }
+
+        VkSemaphore waits[2] = { slot.imageavailable, slot.transferdone };
+        VkPipelineStageFlags waitstages[2] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT };
+        VkSubmitInfo submit{};
+        submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit.waitSemaphoreCount = slot.uploaded ? 2 : 1;
+        submit.pWaitSemaphores = waits;
+        submit.pWaitDstStageMask = waitstages;
+        submit.commandBufferCount = 1;
+        submit.pCommandBuffers = &state.commands;
+        submit.signalSemaphoreCount = 1;
+        submit.pSignalSemaphores = &renderfinished[imageindex];
+        vkQueueSubmit(drawqueue, 1, &submit, slot.fence);
+
+        VkPresentInfoKHR present{};
+        present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        present.waitSemaphoreCount = 1;
+        present.pWaitSemaphores = &renderfinished[imageindex];
+        present.swapchainCount = 1;
+        present.pSwapchains = &swapchain;
+        present.pImageIndices = &imageindex;
+        VkResult result = vkQueuePresentKHR(drawqueue, &present);
+        slot.uploaded = false;
+        framebegun = false;
+        current = (current + 1) % framesinflight;
+        ++frames;
+        submittime += secondssince(start);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) recreateswapchain();
+    }
+
+    void report() const {
+        printf("  vulkan device %s: %ld draw command buffers re-recorded over %ld frames\n", properties.deviceName, rerecords, frames);
+    }
+
+private:
+    struct buffer {
+        VkBuffer handle = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        void* mapped = nullptr;
+    };
+    // a draw command buffer and the inputs it was recorded with
+    struct drawstate {
+        VkCommandBuffer commands = VK_NULL_HANDLE;
+        bool recorded = false;
+        vkframeconstants constants;
+        std::vector<drawrange> ranges;
+    };
+    struct frameslot {
+        buffer staging, vertices;
+        VkCommandBuffer transfer = VK_NULL_HANDLE;
+        std::vector<drawstate> draws;  // one per swapchain image
+        VkFence fence = VK_NULL_HANDLE;
+        VkSemaphore imageavailable = VK_NULL_HANDLE, transferdone = VK_NULL_HANDLE;
+        bool uploaded = false;
+    };
+
+    GLFWwindow* window;
+    VkInstance instance = VK_NULL_HANDLE;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
+    VkPhysicalDevice physicaldevice = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties properties{};
+    VkPhysicalDeviceMemoryProperties memoryproperties{};
+    VkDevice device = VK_NULL_HANDLE;
+    uint32_t graphicsfamily = 0, transferfamily = 0, transferqueueindex = 0;
+    VkQueue drawqueue = VK_NULL_HANDLE, transferqueue = VK_NULL_HANDLE;
+    VkCommandPool graphicspool = VK_NULL_HANDLE, transferpool = VK_NULL_HANDLE;
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+    VkFormat colorformat = VK_FORMAT_B8G8R8A8_UNORM;
+    VkExtent2D extent{};
+    std::vector<VkImageView> imageviews;
+    std::vector<VkFramebuffer> framebuffers;
+    std::vector<VkSemaphore> renderfinished;  // per swapchain image, since presentation holds it until the image returns
+    VkImage depthimage = VK_NULL_HANDLE;
+    VkDeviceMemory depthmemory = VK_NULL_HANDLE;
+    VkImageView depthview = VK_NULL_HANDLE;
+    VkRenderPass renderpass = VK_NULL_HANDLE;
+    VkPipelineLayout pipelinelayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    buffer indexbuffer;
+    VkDeviceSize vertexbytes = 0;
+    std::array<frameslot, framesinflight> slots;
+    int current = 0;
+    uint32_t imageindex = 0;
+    bool framebegun = false;
+    long rerecords = 0, frames = 0;
+
+    static bool fail(std::string& error, const char* reason) {
+        error = reason;
+        return false;
+    }
+
+    bool pickdevice() {
+        uint32_t count = 0;
+        vkEnumeratePhysicalDevices(instance, &count, nullptr);
+        std::vector<VkPhysicalDevice> devices(count);
+        vkEnumeratePhysicalDevices(instance, &count, devices.data());
+        for (VkPhysicalDevice candidate : devices) {
+            uint32_t familycount = 0;
+            vkGetPhysicalDeviceQueueFamilyProperties(candidate, &familycount, nullptr);
+            std::vector<VkQueueFamilyProperties> families(familycount);
+            vkGetPhysicalDeviceQueueFamilyProperties(candidate, &familycount, families.data());
+            int graphics = -1, transfer = -1;
+            for (uint32_t i = 0; i < familycount; ++i) {
+                VkBool32 present = VK_FALSE;
+                vkGetPhysicalDeviceSurfaceSupportKHR(candidate, i, surface, &present);
+                if (graphics < 0 && present && (families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) graphics = int(i);
+                if (transfer < 0 && (families[i].queueFlags & VK_QUEUE_TRANSFER_BIT) && !(families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) transfer = int(i);
+            }
+            if (graphics < 0) continue;
+            physicaldevice = candidate;
+            graphicsfamily = uint32_t(graphics);
+            transferfamily = transfer >= 0 ? uint32_t(transfer) : graphicsfamily;
+            transferqueueindex = transfer < 0 && families[graphics].queueCount > 1 ? 1 : 0;
+            vkGetPhysicalDeviceProperties(candidate, &properties);
+            vkGetPhysicalDeviceMemoryProperties(candidate, &memoryproperties);
+            // any real gpu beats a software rasterizer, but lavapipe is fine when it is all there is
+            if (properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_CPU) break;
+        }
+        return physicaldevice != VK_NULL_HANDLE;
+    }
+
+    uint32_t findmemory(uint32_t typebits, VkMemoryPropertyFlags flags) const {
+        for (uint32_t i = 0; i < memoryproperties.memoryTypeCount; ++i) {
+            if ((typebits & (1u << i)) && (memoryproperties.memoryTypes[i].propertyFlags & flags) == flags) return i;
+        }
+        return 0;
+    }
+
+    buffer createbuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags flags) {
+        buffer result;
+        uint32_t families[2] = { graphicsfamily, transferfamily };
+        VkBufferCreateInfo info{};
+        info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        info.size = std::max<VkDeviceSize>(size, 4);
+        info.usage = usage;
+        // shared between the graphics and transfer families without ownership transfers
+        info.sharingMode = transferfamily != graphicsfamily ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+        info.queueFamilyIndexCount = transferfamily != graphicsfamily ? 2 : 0;
+        info.pQueueFamilyIndices = families;
+        vkCreateBuffer(device, &info, nullptr, &result.handle);
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(device, result.handle, &requirements);
+        VkMemoryAllocateInfo allocation{};
+        allocation.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocation.allocationSize = requirements.size;
+        allocation.memoryTypeIndex = findmemory(requirements.memoryTypeBits, flags);
+        vkAllocateMemory(device, &allocation, nullptr, &result.memory);
+        vkBindBufferMemory(device, result.handle, result.memory, 0);
+        if (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) vkMapMemory(device, result.memory, 0, VK_WHOLE_SIZE, 0, &result.mapped);
+        return result;
+    }
+
+    void destroybuffer(buffer& b) {
+        if (b.mapped) vkUnmapMemory(device, b.memory);
+        vkDestroyBuffer(device, b.handle, nullptr);
+        vkFreeMemory(device, b.memory, nullptr);
+        b = buffer();
+    }
+
+    std::vector<VkCommandBuffer> allocatecommands(VkCommandPool pool, uint32_t count) {
+        std::vector<VkCommandBuffer> commands(count);
+        VkCommandBufferAllocateInfo info{};
+        info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        info.commandPool = pool;
+        info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        info.commandBufferCount = count;
+        vkAllocateCommandBuffers(device, &info, commands.data());
+        return commands;
+    }
+
+    void destroymesh() {
+        for (auto& slot : slots) {
+            if (slot.transfer) vkFreeCommandBuffers(device, transferpool, 1, &slot.transfer);
+            slot.transfer = VK_NULL_HANDLE;
+            if (slot.staging.handle) destroybuffer(slot.staging);
+            if (slot.vertices.handle) destroybuffer(slot.vertices);
+        }
+        if (indexbuffer.handle) destroybuffer(indexbuffer);
+    }
+
+    // waits until this slot's previous frame is off the gpu and acquires the image the frame will draw into
+    bool beginframe() {
+        if (framebegun) return true;
+        if (!swapchain && !recreateswapchain()) return false;
+        frameslot& slot = slots[current];
+        vkWaitForFences(device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            VkResult result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, slot.imageavailable, VK_NULL_HANDLE, &imageindex);
+            if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR) {
+                vkResetFences(device, 1, &slot.fence);
+                framebegun = true;
+                return true;
+            }
+            if (result != VK_ERROR_OUT_OF_DATE_KHR || !recreateswapchain()) break;
+        }
+        return false;
+    }
+
+    void record(frameslot& slot, uint32_t image, const vkframeconstants& constants, const std::vector<drawrange>& ranges) {
+        drawstate& state = slot.draws[image];
+        vkResetCommandBuffer(state.commands, 0);
+        VkCommandBufferBeginInfo begin{};
+        begin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        vkBeginCommandBuffer(state.commands, &begin);
+        VkClearValue clears[2];
+        clears[0].color = { { 0.3f, 0.5f, 1.0f, 1.0f } };
+        clears[1].depthStencil = { 1.0f, 0 };
+        VkRenderPassBeginInfo pass{};
+        pass.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        pass.renderPass = renderpass;
+        pass.framebuffer = framebuffers[image];
+        pass.renderArea.extent = extent;
+        pass.clearValueCount = 2;
+        pass.pClearValues = clears;
+        vkCmdBeginRenderPass(state.commands, &pass, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdBindPipeline(state.commands, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+        VkViewport viewport{ 0.0f, 0.0f, float(extent.width), float(extent.height), 0.0f, 1.0f };
+        VkRect2D scissor{ { 0, 0 }, extent };
+        vkCmdSetViewport(state.commands, 0, 1, &viewport);
+        vkCmdSetScissor(state.commands, 0, 1, &scissor);
+        VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(state.commands, 0, 1, &slot.vertices.handle, &offset);
+        vkCmdBindIndexBuffer(state.commands, indexbuffer.handle, 0, VK_INDEX_TYPE_UINT32);
+        vkCmdPushConstants(state.commands, pipelinelayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(constants), &constants);
+        for (const drawrange& range : ranges) {
+            vkCmdDrawIndexed(state.commands, uint32_t(range.count), 1, uint32_t(range.first), range.basevertex, 0);
+        }
+        vkCmdEndRenderPass(state.commands);
+        vkEndCommandBuffer(state.commands);
+        state.recorded = true;
+        state.constants = constants;
+        state.ranges = ranges;
+    }
+
+    void invalidatedraws() {
+        for (auto& slot : slots) {
+            for (auto& state : slot.draws) state.recorded = false;
+        }
+    }
+
+    bool createswapchain() {
+        VkSurfaceCapabilitiesKHR caps;
+        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicaldevice, surface, &caps);
+        extent = caps.currentExtent;
+        if (extent.width == UINT32_MAX) {
+            int width = 0, height = 0;
+            glfwGetFramebufferSize(window, &width, &height);
+            extent.width = std::clamp(uint32_t(width), caps.minImageExtent.width, caps.maxImageExtent.width);
+            extent.height = std::clamp(uint32_t(height), caps.minImageExtent.height, caps.maxImageExtent.height);
+        }
+        if (extent.width == 0 || extent.height == 0) return false;
+
+        uint32_t count = 0;
+        vkGetPhysicalDeviceSurfaceFormatsKHR(physicaldevice, surface, &count, nullptr);
+        std::vector<VkSurfaceFormatKHR> formats(count);
+        vkGetPhysicalDeviceSurfaceFormatsKHR(physicaldevice, surface, &count, formats.data());
+        // a unorm format matches the gl default framebuffer, which does no srgb conversion
+        VkSurfaceFormatKHR format = formats.empty() ? VkSurfaceFormatKHR{ VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR } : formats[0];
+        for (const auto& candidate : formats) {
+            if (candidate.format == VK_FORMAT_B8G8R8A8_UNORM || candidate.format == VK_FORMAT_R8G8B8A8_UNORM) format = candidate;
+        }
+        colorformat = format.format;
+        vkGetPhysicalDeviceSurfacePresentModesKHR(physicaldevice, surface, &count, nullptr);
+        std::vector<VkPresentModeKHR> modes(count);
+        vkGetPhysicalDeviceSurfacePresentModesKHR(physicaldevice, surface, &count, modes.data());
+        // unthrottled like the gl loop when the surface allows it, so the two measure the same thing
+        VkPresentModeKHR mode = VK_PRESENT_MODE_FIFO_KHR;
+        if (std::find(modes.begin(), modes.end(), VK_PRESENT_MODE_IMMEDIATE_KHR) != modes.end()) mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+        else if (std::find(modes.begin(), modes.end(), VK_PRESENT_MODE_MAILBOX_KHR) != modes.end()) mode = VK_PRESENT_MODE_MAILBOX_KHR;
+
+        VkSwapchainCreateInfoKHR info{};
+        info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+        info.surface = surface;
+        info.minImageCount = caps.maxImageCount ? std::min(caps.minImageCount + 1, caps.maxImageCount) : caps.minImageCount + 1;
+        info.imageFormat = format.format;
+        info.imageColorSpace = format.colorSpace;
+        info.imageExtent = extent;
+        info.imageArrayLayers = 1;
+        info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        info.preTransform = caps.currentTransform;
+        info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+        info.presentMode = mode;
+        info.clipped = VK_TRUE;
+        info.oldSwapchain = swapchain;
+        VkSwapchainKHR created = VK_NULL_HANDLE;
+        if (vkCreateSwapchainKHR(device, &info, nullptr, &created) != VK_SUCCESS) return false;
+        if (swapchain) vkDestroySwapchainKHR(device, swapchain, nullptr);
+        swapchain = created;
+
+        vkGetSwapchainImagesKHR(device, swapchain, &count, nullptr);
+        std::vector<VkImage> images(count);
+        vkGetSwapchainImagesKHR(device, swapchain, &count, images.data());
+        if (!renderpass) createrenderpass();
+
+        // depth buffer
+        VkImageCreateInfo depthinfo{};
+        depthinfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        depthinfo.imageType = VK_IMAGE_TYPE_2D;
+        depthinfo.format = VK_FORMAT_D32_SFLOAT;
+        depthinfo.extent = { extent.width, extent.height, 1 };
+        depthinfo.mipLevels = 1;
+        depthinfo.arrayLayers = 1;
+        depthinfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        depthinfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        depthinfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        vkCreateImage(device, &depthinfo, nullptr, &depthimage);
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(device, depthimage, &requirements);
+        VkMemoryAllocateInfo allocation{};
+        allocation.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocation.allocationSize = requirements.size;
+        allocation.memoryTypeIndex = findmemory(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        vkAllocateMemory(device, &allocation, nullptr, &depthmemory);
+        vkBindImageMemory(device, depthimage, depthmemory, 0);
+        depthview = createview(depthimage, VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT);
+
+        for (VkImage image : images) {
+            imageviews.push_back(createview(image, colorformat, VK_IMAGE_ASPECT_COLOR_BIT));
+            VkImageView attachments[2] = { imageviews.back(), depthview };
+            VkFramebufferCreateInfo framebufferinfo{};
+            framebufferinfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferinfo.renderPass = renderpass;
+            framebufferinfo.attachmentCount = 2;
+            framebufferinfo.pAttachments = attachments;
+            framebufferinfo.width = extent.width;
+            framebufferinfo.height = extent.height;
+            framebufferinfo.layers = 1;
+            VkFramebuffer framebuffer;
+            vkCreateFramebuffer(device, &framebufferinfo, nullptr, &framebuffer);
+            framebuffers.push_back(framebuffer);
+            VkSemaphoreCreateInfo semaphoreinfo{};
+            semaphoreinfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            VkSemaphore semaphore;
+            vkCreateSemaphore(device, &semaphoreinfo, nullptr, &semaphore);
+            renderfinished.push_back(semaphore);
+        }
+        for (auto& slot : slots) {
+            auto commands = allocatecommands(graphicspool, count);
+            slot.draws.resize(count);
+            for (uint32_t i = 0; i < count; ++i) slot.draws[i].commands = commands[i];
+        }
+        invalidatedraws();
+        return true;
+    }
+
+    // keeps the swapchain handle so the replacement can be created from it
+    void destroyswapchain(bool keephandle = false) {
+        for (auto& slot : slots) {
+            for (auto& state : slot.draws) vkFreeCommandBuffers(device, graphicspool, 1, &state.commands);
+            slot.draws.clear();
+        }
+        for (VkFramebuffer framebuffer : framebuffers) vkDestroyFramebuffer(device, framebuffer, nullptr);
+        for (VkImageView view : imageviews) vkDestroyImageView(device, view, nullptr);
+        for (VkSemaphore semaphore : renderfinished) vkDestroySemaphore(device, semaphore, nullptr);
+        framebuffers.clear();
+        imageviews.clear();
+        renderfinished.clear();
+        vkDestroyImageView(device, depthview, nullptr);
+        vkDestroyImage(device, depthimage, nullptr);
+        vkFreeMemory(device, depthmemory, nullptr);
+        depthview = VK_NULL_HANDLE;
+        depthimage = VK_NULL_HANDLE;
+        depthmemory = VK_NULL_HANDLE;
+        if (!keephandle && swapchain) {
+            vkDestroySwapchainKHR(device, swapchain, nullptr);
+            swapchain = VK_NULL_HANDLE;
+        }
+    }
+
+    // a minimised window has no extent to build a swapchain for. the old one goes too then, so no frame acquires an
+    // image that has no framebuffer or draw command buffer, and beginframe skips frames until a new one can be built.
+    bool recreateswapchain() {
+        vkDeviceWaitIdle(device);
+        destroyswapchain(true);
+        if (createswapchain()) return true;
+        destroyswapchain();
+        return false;
+    }
+
+    VkImageView createview(VkImage image, VkFormat format, VkImageAspectFlags aspect) {
+        VkImageViewCreateInfo info{};
+        info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        info.image = image;
+        info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        info.format = format;
+        info.subresourceRange = { aspect, 0, 1, 0, 1 };
+        VkImageView view;
+        vkCreateImageView(device, &info, nullptr, &view);
+        return view;
+    }
+
+    void createrenderpass() {
+        VkAttachmentDescription attachments[2]{};
+        attachments[0].format = colorformat;
+        attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        attachments[1] = attachments[0];
+        attachments[1].format = VK_FORMAT_D32_SFLOAT;
+        attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        VkAttachmentReference color{ 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+        VkAttachmentReference depth{ 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+        VkSubpassDescription subpass{};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &color;
+        subpass.pDepthStencilAttachment = &depth;
+        // the acquire semaphore is waited at colour output, and the depth buffer is shared by the frames in flight
+        VkSubpassDependency dependency{};
+        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependency.dstSubpass = 0;
+        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        VkRenderPassCreateInfo info{};
+        info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        info.attachmentCount = 2;
+        info.pAttachments = attachments;
+        info.subpassCount = 1;
+        info.pSubpasses = &subpass;
+        info.dependencyCount = 1;
+        info.pDependencies = &dependency;
+        vkCreateRenderPass(device, &info, nullptr, &renderpass);
+    }
+
+    bool createpipeline() {
+        std::vector<uint32_t> vertexcode = readspirv("shaders/water-vk.vert.spv");
+        std::vector<uint32_t> fragmentcode = readspirv("shaders/water-vk.frag.spv");
+        if (vertexcode.empty() || fragmentcode.empty()) return false;
+        auto createmodule = [&](const std::vector<uint32_t>& code) {
+            VkShaderModuleCreateInfo info{};
+            info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+            info.codeSize = code.size() * sizeof(uint32_t);
+            info.pCode = code.data();
+            VkShaderModule module = VK_NULL_HANDLE;
+            vkCreateShaderModule(device, &info, nullptr, &module);
+            return module;
+        };
+        VkShaderModule vertexmodule = createmodule(vertexcode), fragmentmodule = createmodule(fragmentcode);
+        VkPipelineShaderStageCreateInfo stages[2]{};
+        stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+        stages[0].module = vertexmodule;
+        stages[0].pName = "main";
+        stages[1] = stages[0];
+        stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        stages[1].module = fragmentmodule;
+
+        VkVertexInputBindingDescription binding{ 0, sizeof(vertex), VK_VERTEX_INPUT_RATE_VERTEX };
+        VkVertexInputAttributeDescription attributes[2] = {
+            { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 },
+            { 1, 0, VK_FORMAT_R32G32B32_SFLOAT, 3 * sizeof(float) },
+        };
+        VkPipelineVertexInputStateCreateInfo vertexinput{};
+        vertexinput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertexinput.vertexBindingDescriptionCount = 1;
+        vertexinput.pVertexBindingDescriptions = &binding;
+        vertexinput.vertexAttributeDescriptionCount = 2;
+        vertexinput.pVertexAttributeDescriptions = attributes;
+        VkPipelineInputAssemblyStateCreateInfo assembly{};
+        assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        VkPipelineViewportStateCreateInfo viewport{};
+        viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewport.viewportCount = 1;
+        viewport.scissorCount = 1;
+        VkPipelineRasterizationStateCreateInfo raster{};
+        raster.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        raster.polygonMode = VK_POLYGON_MODE_FILL;
+        // back faces of the volume are culled as on the gl path; the clipmap shares this pipeline and, as on gl,
+        // keeps both faces. vkclip's y flip and vulkan's downward framebuffer y cancel in the facing test, so the
+        // mesh's clockwise winding is still clockwise here, as glFrontFace(GL_CW) has it.
+        raster.cullMode = g_cullfaces && g_clipmaplevels == 0 ? VK_CULL_MODE_BACK_BIT : VK_CULL_MODE_NONE;
+        raster.frontFace = VK_FRONT_FACE_CLOCKWISE;
+        raster.lineWidth = 1.0f;
+        VkPipelineMultisampleStateCreateInfo multisample{};
+        multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        VkPipelineDepthStencilStateCreateInfo depth{};
+        depth.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depth.depthTestEnable = VK_TRUE;
+        depth.depthWriteEnable = VK_TRUE;
+        depth.depthCompareOp = VK_COMPARE_OP_LESS;
+        VkPipelineColorBlendAttachmentState blendattachment{};
+        blendattachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        VkPipelineColorBlendStateCreateInfo blend{};
+        blend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        blend.attachmentCount = 1;
+        blend.pAttachments = &blendattachment;
+        VkDynamicState dynamicstates[2] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        VkPipelineDynamicStateCreateInfo dynamic{};
+        dynamic.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamic.dynamicStateCount = 2;
+        dynamic.pDynamicStates = dynamicstates;
+
+        VkPushConstantRange pushrange{ VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(vkframeconstants) };
+        VkPipelineLayoutCreateInfo layoutinfo{};
+        layoutinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layoutinfo.pushConstantRangeCount = 1;
+        layoutinfo.pPushConstantRanges = &pushrange;
+        vkCreatePipelineLayout(device, &layoutinfo, nullptr, &pipelinelayout);
+
+        VkGraphicsPipelineCreateInfo info{};
+        info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        info.stageCount = 2;
+        info.pStages = stages;
+        info.pVertexInputState = &vertexinput;
+        info.pInputAssemblyState = &assembly;
+        info.pViewportState = &viewport;
+        info.pRasterizationState = &raster;
+        info.pMultisampleState = &multisample;
+        info.pDepthStencilState = &depth;
+        info.pColorBlendState = &blend;
+        info.pDynamicState = &dynamic;
+        info.layout = pipelinelayout;
+        info.renderPass = renderpass;
+        VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &info, nullptr, &pipeline);
+        vkDestroyShaderModule(device, vertexmodule, nullptr);
+        vkDestroyShaderModule(device, fragmentmodule, nullptr);
+        return result == VK_SUCCESS;
+    }
+};
+#endif
+
+// rebuilds the volume at a new resolution without stalling the frames being rendered meanwhile:
+// the mesh is built on the background thread, then its index data and vertex buffers are staged a budget per frame.
+// the old resolution keeps rendering until the next step boundary after this finishes.
+frametask resizegrid(framecontext& ctx, int size) {
+    ctx.resizing = true;
+    while (size > 0) {
+        std::shared_ptr<watervolume> built;
+        // the simulation step writes the wave parameters, so the job gets a copy taken here between steps
+        auto source = ctx.water;
+        waveparams waves = ctx.water->waves;
+        auto buildtask = ctx.background.submit([&built, source, waves, size] { built = source->resized(size, size, waves); });
+        co_await taskawaiter{ ctx.scheduler, *buildtask };
+
+        auto mesh = creategpumesh(built->vertices, built->indices, 0, false);
+        size_t total = built->indices.size() * sizeof(unsigned int), spent = 0;
+        for (size_t offset = 0; offset < total; offset += g_uploadbudget) {
+            co_await nextframeawaiter{ ctx.scheduler };
+            spent = std::min(g_uploadbudget, total - offset);
+            uploadindices(*mesh, *built, offset, spent);
+        }
+        // each slot's vertex buffer counts against the same budget as an upload of its size; one larger than the
+        // budget gets a frame of its own
+        size_t vertexbytes = built->vertices.size() * sizeof(vertex);
+        mesh->slots.resize(ctx.mesh->slots.size());
+        for (frameslot& slot : mesh->slots) {
+            if (spent > 0 && spent + vertexbytes > g_uploadbudget) {
+                co_await nextframeawaiter{ ctx.scheduler };
+                spent = 0;
+            }
+            createslot(slot, built->vertices, mesh->ebo);
+            spent += vertexbytes;
+        }
+        ctx.pendingwater = built;
+        ctx.pendingmesh = mesh;
+        size = std::exchange(ctx.queuedgrid, 0);
+    }
+    ctx.resizing = false;
+}
+
+// writes a bottom-up rgb8 framebuffer readback as a binary ppm
+void writeppm(const std::string& path, int width, int height, const std::vector<unsigned char>& pixels) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "error could not write " << path << "\n";
+        return;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for (int row = height - 1; row >= 0; --row) {
+        fwrite(pixels.data() + size_t(row) * width * 3, 1, size_t(width) * 3, file);
+    }
+    fclose(file);
+}
+
+// counts a presented frame and tracks the worst frame time, separately while a grid resize is in progress
+void recordframetime(framecontext& ctx) {
+    auto now = std::chrono::steady_clock::now();
+    double frametime = std::chrono::duration<double>(now - ctx.lastpresent).count();
+    ctx.lastpresent = now;
+    if (ctx.timings.frames++ == 0) return;  // the first interval includes startup
+    ctx.timings.worstframe = std::max(ctx.timings.worstframe, frametime);
+    if (ctx.resizing || ctx.pendingwater || ctx.resizeframe) {
+        ctx.timings.worstresizeframe = std::max(ctx.timings.worstresizeframe, frametime);
+    }
+}
+
+// one frame of the pipeline: simulate -> cull -> upload -> draw -> export.
+// cpu stages run on the task system, so simulating frame n + 1 overlaps with the gpu drawing frame n.
+frametask runframe(framecontext& ctx, long frameindex, std::shared_ptr<framerecord> previous, std::shared_ptr<framerecord> current) {
+    stagetimings& timings = ctx.timings;
+
+    // simulate: the vertex array is shared, so wait until the previous frame has copied it out
+    if (previous) co_await previous->uploaded;
+    // this is a step boundary with no simulation running, so a finished resize can be swapped in
+    if (ctx.pendingwater) {
+        ctx.pendingwater->waves = ctx.water->waves;
+        ctx.water = std::move(ctx.pendingwater);
+        ctx.mesh = std::move(ctx.pendingmesh);
+        ++timings.resizes;
+    }
+    std::shared_ptr<watervolume> water = ctx.water;
+    std::shared_ptr<gpumesh> mesh = ctx.mesh;
+    frameslot& slot = mesh->slots[frameindex % mesh->slots.size()];
+    float aspectratio = 1.0f;
+    glm::vec3 travel(0.0f);
+    long ripplesteps = 0;
+    std::vector<rippledrop> drops;
+    auto simulatetask = ctx.tasks.submit([&] {
+        auto start = std::chrono::steady_clock::now();
+        stepsimulation(ctx.sim, *water, ctx.ocean.get());
+        if (ctx.checkpoints) ctx.checkpoints->afterstep(ctx.sim, *water, ctx.ripples.get());
+        aspectratio = ctx.sim.aspectratio;
+        travel = glm::vec3(ctx.sim.cameraoffset.x, 0.0f, ctx.sim.cameraoffset.y);
+        // the next frame may be simulating by the time this one draws, so the gpu ripple work is taken now
+        ripplesteps = ctx.sim.ripplesteps;
+        if (ctx.ripplepasses) drops = std::exchange(ctx.sim.rippledrops, {});
+        timings.simulate += secondssince(start);
+    });
+    co_await taskawaiter{ ctx.scheduler, *simulatetask };
+    if (ctx.sim.replayfinished) glfwSetWindowShouldClose(ctx.window, true);
+
+    // the clipmap has a fixed resolution, so grid resizes only apply to the volume
+    if (int size = std::exchange(ctx.sim.requestedgrid, 0); size > 0 && !ctx.ocean) {
+        if (g_deterministic) {
+            // a replay must swap at a fixed frame, so the rebuild completes before the next step instead
+            auto built = water->resized(size, size, water->waves);
+            ctx.pendingmesh = creategpumesh(built->vertices, built->indices, int(mesh->slots.size()), true);
+            ctx.pendingwater = built;
+        }
+        else if (ctx.resizing) {
+            ctx.queuedgrid = size;
+        }
+        else {
+            ctx.resizes.push_back(resizegrid(ctx, size));
+        }
+    }
+
+    // cull: the clipmap surrounds the camera, so only the volume can leave the view
+    glm::vec3 camerapos = ctx.camerapos + travel;
+    glm::mat4 view = viewmatrix(camerapos, travel);
+    glm::mat4 projection = projectionmatrix(aspectratio, ctx.farplane);
+    bool visible = true;
+    if (!ctx.ocean) {
+        auto culltask = ctx.tasks.submit([&] {
+            auto start = std::chrono::steady_clock::now();
+            visible = water->intersectsfrustum(projection * view * ctx.model);
+            timings.cull += secondssince(start);
+        });
+        co_await taskawaiter{ ctx.scheduler, *culltask };
+    }
+
+    // upload: the slot's buffer may still be read by the draw from frames-in-flight frames ago
+    co_await fenceawaiter{ ctx.scheduler, slot.fence };
+    auto uploadstart = std::chrono::steady_clock::now();
+    if (ctx.ocean) {
+        ctx.ocean->upload(slot.vbo);
+    }
+    else if (visible && ctx.gpuwaves) {
+        ctx.gpuwaves->dispatch(slot.vbo);
+    }
+    else if (visible) {
+        water->upload(slot.vbo);
+    }
+    else if (ctx.gpuwaves) {
+        ctx.gpuwaves->skip();
+    }
+    timings.upload += secondssince(uploadstart);
+    current->uploaded.signal(ctx.scheduler);
+
+    // draw
+    if (previous) co_await previous->presented;
+    auto drawstart = std::chrono::steady_clock::now();
+    if (ctx.ripplepasses) ctx.ripplepasses->advance(ripplesteps, drops);
+    if (ctx.maps && visible && !ctx.ocean) {
+        ctx.maps->setgrid(water->columns(), water->rows());
+        ctx.maps->render(slot.vbo, { ctx.model, view, projection, camerapos, ctx.lightpos + travel });
+    }
+    // the draws clear the frame themselves, so only a culled frame is cleared here
+    if (ctx.ocean) {
+        drawclipmap(ctx.shaderprogram, slot.vao, ctx.ocean->ranges(), ctx.model, view, projection, camerapos, ctx.lightpos + travel);
+    }
+    else if (visible) {
+        drawwater(*ctx.drawer, ctx.shaderprogram, slot.vao, ctx.drawer->ranges(*water, ctx.model, camerapos), ctx.model,
+            view, projection, camerapos, ctx.lightpos + travel, ctx.ripplepasses.get(), ctx.maps.get());
+    }
+    else {
+        glClearColor(0.3f, 0.5f, 1.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        ++timings.culled;
+    }
+
+    // export: start an asynchronous readback of the back buffer before it is swapped away
+    int fbwidth = 0, fbheight = 0;
+    GLsync readfence = nullptr;
+    if (!g_exportprefix.empty()) {
+        glfwGetFramebufferSize(ctx.window, &fbwidth, &fbheight);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size_t(fbwidth) * fbheight * 3, nullptr, GL_STREAM_READ);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, fbwidth, fbheight, GL_RGB, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readfence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glfwSwapBuffers(ctx.window);
+    timings.draw += secondssince(drawstart);
+    recordframetime(ctx);
+    current->presented.signal(ctx.scheduler);
+
+    if (readfence) {
+        co_await fenceawaiter{ ctx.scheduler, readfence };
+        auto exportstart = std::chrono::steady_clock::now();
+        auto pixels = std::make_shared<std::vector<unsigned char>>(size_t(fbwidth) * fbheight * 3);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        if (void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixels->size(), GL_MAP_READ_BIT)) {
+            memcpy(pixels->data(), mapped, pixels->size());
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), "%05ld.ppm", frameindex);
+        std::string path = g_exportprefix + suffix;
+        auto writetask = ctx.tasks.submit([=] { writeppm(path, fbwidth, fbheight, *pixels); });
+        co_await taskawaiter{ ctx.scheduler, *writetask };
+        timings.exportframe += secondssince(exportstart);
+        ++timings.exported;
+    }
+}
+
+// the cost of keeping the clipmap's trig cache current, against refreshing every level each frame
+void reportclipmap(const clipmap* ocean) {
+    if (!ocean || ocean->updates == 0) return;
+    if (ocean->terrain) ocean->terrain->report();
+    size_t perlevel = size_t(ocean->size()) * ocean->size();
+    printf("  clipmap: %d levels of %dx%d, %zu vertices, %.0f units across\n",
+        ocean->levelcount(), ocean->size(), ocean->size(), ocean->vertices.size(), ocean->extent());
+    printf("  trig cache entries refreshed per frame %.1f (full refresh %zu)\n",
+        double(ocean->recomputed) / ocean->updates, perlevel * ocean->levelcount());
+}
+
+void reportthroughput(const char* mode, const stagetimings& timings, double seconds) {
+    double frames = double(std::max(timings.frames, 1L));
+    printf("%s: %ld frames in %.2f s (%.1f fps)\n", mode, timings.frames, seconds, timings.frames / seconds);
+    printf("  per frame ms: simulate %.3f  cull %.3f  upload %.3f  draw %.3f", 1000.0 * timings.simulate / frames,
+        1000.0 * timings.cull / frames, 1000.0 * timings.upload / frames, 1000.0 * timings.draw / frames);
+    if (timings.exported > 0) printf("  export %.3f", 1000.0 * timings.exportframe / timings.exported);
+    printf("  (%ld culled)\n", timings.culled);
+    if (timings.submit > 0) printf("  cpu submit %.3f ms per frame\n", 1000.0 * timings.submit / frames);
+    printf("  worst frame %.1f ms", 1000.0 * timings.worstframe);
+    if (timings.resizes > 0) printf(", worst frame during %ld grid resizes %.1f ms", timings.resizes, 1000.0 * timings.worstresizeframe);
+    printf("\n");
+}
+
+// resident gpu results never reach the cpu mirror on their own, so a finished replay reads the last frame back
+void mirrorreplay(framecontext& ctx) {
+    if (!ctx.gpuwaves || !ctx.sim.replayfinished) return;
+    // the last frame was culled: every frame has finished, so a slot can take its surface now
+    if (!ctx.gpuwaves->current() && ctx.mesh) ctx.gpuwaves->dispatch(ctx.mesh->slots[0].vbo);
+    ctx.gpuwaves->mirror(*ctx.water);
+    ctx.sim.replaychecksum = ctx.water->checksum();
+}
+
+// the original fixed call list, kept as the baseline the pipelined loop is compared against
+void runsequential(framecontext& ctx) {
+    stagetimings& timings = ctx.timings;
+    auto runstart = std::chrono::steady_clock::now();
+
+    // the simulation loop updates the water waves and redraws the scene continuously.
+    while (!glfwWindowShouldClose(ctx.window)) {
+        glfwPollEvents();
+        auto start = std::chrono::steady_clock::now();
+        stepsimulation(ctx.sim, *ctx.water, ctx.ocean.get());
+        if (ctx.checkpoints) ctx.checkpoints->afterstep(ctx.sim, *ctx.water, ctx.ripples.get());
+        timings.simulate += secondssince(start);
+        if (ctx.sim.replayfinished) glfwSetWindowShouldClose(ctx.window, true);
+
+        // resizes happen in place here, hitch included, as the reference for the pipelined loop
+        if (int size = std::exchange(ctx.sim.requestedgrid, 0); size > 0 && !ctx.ocean) {
+            ctx.water = ctx.water->resized(size, size, ctx.water->waves);
+            ctx.backend->setmesh(ctx.water->vertices, ctx.water->indices);
+            ctx.resizeframe = true;
+            ++timings.resizes;
+        }
+
+        start = std::chrono::steady_clock::now();
+        ctx.backend->upload(ctx.ocean ? ctx.ocean->vertices : ctx.water->vertices);
+        timings.upload += secondssince(start);
+
+        start = std::chrono::steady_clock::now();
+        if (ctx.ripplepasses) ctx.ripplepasses->advance(ctx.sim.ripplesteps, std::exchange(ctx.sim.rippledrops, {}));
+        glm::vec3 travel(ctx.sim.cameraoffset.x, 0.0f, ctx.sim.cameraoffset.y);
+        frameview view;
+        view.model = ctx.model;
+        view.camerapos = ctx.camerapos + travel;
+        view.lightpos = ctx.lightpos + travel;
+        view.view = viewmatrix(view.camerapos, travel);
+        view.projection = projectionmatrix(ctx.sim.aspectratio, ctx.farplane);
+        if (ctx.maps) ctx.maps->setgrid(ctx.water->columns(), ctx.water->rows());
+        if (ctx.ocean) {
+            ctx.backend->draw(view, ctx.ocean->ranges());
+        }
+        else if (ctx.drawer) {
+            ctx.backend->draw(view, ctx.drawer->ranges(*ctx.water, ctx.model, view.camerapos));
+        }
+        else {
+            ctx.backend->draw(view, { { GLsizei(ctx.water->indices.size()), 0, 0 } });
+        }
+        timings.draw += secondssince(start);
+        recordframetime(ctx);
+        ctx.resizeframe = false;
+    }
+    timings.submit = ctx.backend->submittime;
+    std::string mode = std::string("sequential (") + ctx.backend->name() + ")";
+    reportthroughput(mode.c_str(), timings, secondssince(runstart));
+    reportclipmap(ctx.ocean.get());
+    mirrorreplay(ctx);
+    reportcommandlatency(ctx.sim);
+}
+
+void runpipelined(framecontext& ctx) {
+    auto runstart = std::chrono::steady_clock::now();
+    std::deque<frametask> inflight;
+    std::shared_ptr<framerecord> previous;
+    long frameindex = 0;
+
+    while (!glfwWindowShouldClose(ctx.window) || !inflight.empty() || !ctx.resizes.empty()) {
+        glfwPollEvents();
+        bool progressed = false;
+        bool closing = glfwWindowShouldClose(ctx.window);
+        if (!closing && int(inflight.size()) < g_framesinflight) {
+            ctx.scheduler.startframe();
+            auto current = std::make_shared<framerecord>();
+            inflight.push_back(runframe(ctx, frameindex++, previous, current));
+            previous = current;
+            progressed = true;
+        }
+        if (closing) ctx.scheduler.startframe();  // lets a staged resize run to completion so it can be torn down
+        progressed |= ctx.scheduler.runready();
+        while (!inflight.empty() && inflight.front().done()) {
+            inflight.pop_front();
+        }
+        std::erase_if(ctx.resizes, [](const frametask& resize) { return resize.done(); });
+        if (!progressed) ctx.scheduler.idle();
+    }
+    glFinish();
+    char mode[64];
+    snprintf(mode, sizeof(mode), "pipelined (%d in flight)", g_framesinflight);
+    reportthroughput(mode, ctx.timings, secondssince(runstart));
+    reportclipmap(ctx.ocean.get());
+    mirrorreplay(ctx);
+    reportcommandlatency(ctx.sim);
+}
+
+// the cpu brand string identifies the machine a tuning profile was measured on
+std::string cpumodel() {
+    char brand[49] = {};
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int regs[4];
+    for (int leaf = 0; leaf < 3; ++leaf) {
+        __cpuid(regs, 0x80000002 + leaf);
+        memcpy(brand + leaf * 16, regs, 16);
+    }
+#elif defined(__x86_64__) || defined(__i386__)
+    unsigned int regs[4];
+    for (int leaf = 0; leaf < 3; ++leaf) {
+        if (!__get_cpuid(0x80000002 + leaf, &regs[0], &regs[1], &regs[2], &regs[3])) return "unknown cpu";
+        memcpy(brand + leaf * 16, regs, 16);
+    }
+#else
+    return "unknown cpu";
+#endif
+    std::string model(brand);
+    model.erase(0, model.find_first_not_of(' '));
+    return model;
+}
+
+std::string describekernel(const kernelconfig& config) {
+    static const char* uploads[] = { "subdata", "orphan", "map" };
+    char text[128];
+    snprintf(text, sizeof(text), "tile %d rows, %d thread%s, %s, sine tier %d, upload %s", config.tilerows, config.threads,
+        config.threads == 1 ? "" : "s", config.simd ? "sse2" : "scalar", config.sinetier, uploads[config.upload]);
+    return text;
+}
+
+// best-of-n wall time of a callable
+template <typename fn>
+double besttime(int repeats, fn&& body) {
+    double best = 1e30;
+    for (int i = 0; i < repeats; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        best = std::min(best, secondssince(start));
+    }
+    return best;
+}
+
+// stream-style triad a = b + s * c, scale a = s * b and copy a = b over three arrays of bytes in total; the default
+// 384 MB is beyond even large last-level caches. the fastest is the roof, as stream reports its best kernel: a kernel
+// with fewer streams, like the bottom copy, runs closer to it than the triad does. counts 16 and 12 bytes per
+// element, including the read-for-ownership of a, to match how the kernels below are counted.
+double measurebandwidth(tasksystem& tasks, size_t bytes = size_t(384) << 20) {
+    const int count = int(bytes / (3 * sizeof(float)));
+    std::vector<float> a(count, 0.0f), b(count, 1.0f), c(count, 2.0f);
+    const int repeats = 21;
+    // best of three times the repeats the kernels get, as a pass over a cached volume is short enough for one scheduler
+    // hiccup to spoil it, and vectorized by hand: the plain loops need alias checks that -O2
+    // does not vectorize through, and a scalar loop runs out of instructions before bandwidth in cache
+    double triad = besttime(repeats, [&] {
+        tasks.parallelfor(count, 1 << 16, [&](int begin, int end) {
+            int i = begin;
+#ifdef FLUIDSIM_SSE2
+            __m128 half = _mm_set1_ps(0.5f);
+            for (; i + 4 <= end; i += 4) {
+                _mm_storeu_ps(&a[i], _mm_add_ps(_mm_loadu_ps(&b[i]), _mm_mul_ps(half, _mm_loadu_ps(&c[i]))));
+            }
+#endif
+            for (; i < end; ++i) a[i] = b[i] + 0.5f * c[i];
+        });
+    });
+    double scale = besttime(repeats, [&] {
+        tasks.parallelfor(count, 1 << 16, [&](int begin, int end) {
+            int i = begin;
+#ifdef FLUIDSIM_SSE2
+            __m128 half = _mm_set1_ps(0.5f);
+            for (; i + 4 <= end; i += 4) _mm_storeu_ps(&a[i], _mm_mul_ps(half, _mm_loadu_ps(&b[i])));
+#endif
+            for (; i < end; ++i) a[i] = 0.5f * b[i];
+        });
+    });
+    double copy = besttime(repeats, [&] {
+        tasks.parallelfor(count, 1 << 16, [&](int begin, int end) {
+            int i = begin;
+#ifdef FLUIDSIM_SSE2
+            for (; i + 4 <= end; i += 4) _mm_storeu_ps(&a[i], _mm_loadu_ps(&b[i]));
+#endif
+            for (; i < end; ++i) a[i] = b[i];
+        });
+    });
+    return std::max({ 16.0 * count / triad, 12.0 * count / scale, 12.0 * count / copy });
+}
+
+// independent multiply-add chains that never leave registers, one batch per thread. twelve vector chains hide the
+// multiply and add latencies and still fit the sixteen sse registers next to the two constants; the inner loop is
+// unrolled so the chains are not kept in a stack array, which ran at half speed and put the wave kernel past the peak.
+double measureflops(tasksystem& tasks) {
+    const long iterations = 2000000;
+    int threads = int(tasks.threadcount()) + 1;
+    std::vector<float> sinks(threads);
+#ifdef FLUIDSIM_SSE2
+    const int lanes = 12 * 4;
+#else
+    const int lanes = 32;
+#endif
+    double seconds = besttime(7, [&] {
+        tasks.parallelfor(threads, 1, [&](int begin, int) {
+#ifdef FLUIDSIM_SSE2
+            __m128 acc[12];
+            for (int k = 0; k < 12; ++k) acc[k] = _mm_set1_ps(float(k + begin));
+            __m128 m = _mm_set1_ps(0.999999f), add = _mm_set1_ps(1e-7f);
+            for (long i = 0; i < iterations; ++i) {
+#pragma GCC unroll 12
+                for (int k = 0; k < 12; ++k) acc[k] = _mm_add_ps(_mm_mul_ps(acc[k], m), add);
+            }
+            for (int k = 1; k < 12; ++k) acc[0] = _mm_add_ps(acc[0], acc[k]);
+            sinks[begin] = _mm_cvtss_f32(acc[0]);
+#else
+            float acc[32];
+            for (int k = 0; k < 32; ++k) acc[k] = float(k + begin);
+            for (long i = 0; i < iterations; ++i) {
+#pragma GCC unroll 32
+                for (int k = 0; k < 32; ++k) acc[k] = acc[k] * 0.999999f + 1e-7f;
+            }
+            float sum = 0.0f;
+            for (int k = 0; k < 32; ++k) sum += acc[k];
+            sinks[begin] = sum;
+#endif
+        });
+    });
+    // a multiply and an add per lane and iteration
+    double flops = double(threads) * iterations * lanes * 2;
+    volatile float sink = sinks[0];
+    (void)sink;
+    return flops / seconds;
+}
+
+struct kernelpoint {
+    std::string name;
+    double flops, bytes, seconds;
+};
+
+// the backend named by --compute, or null for the cpu kernels
+std::unique_ptr<computebackend> createcompute() {
+#ifdef FLUIDSIM_OPENCL
+    if (g_compute == "opencl") {
+        auto opencl = std::make_unique<openclcompute>();
+        std::string error;
+        if (!opencl->init(error)) {
+            std::cerr << "failed to initialize opencl: " << error << "\n";
+            return nullptr;
+        }
+        printf("wave update on opencl device %s\n", opencl->devicename.c_str());
+        return opencl;
+    }
+#endif
+    return nullptr;
+}
+
+// places each wave kernel on a roofline built from measured machine peaks; writes json and prints a table.
+// byte counts are the vertex data each kernel streams through memory (a touched 24-byte vertex is read and written
+// back in full), flop counts are per grid point from the kernel source.
+// the kernels run with the tuned configuration. the repeats keep the volume wherever it fits in the cache hierarchy,
+// so the bandwidth roof is measured on a working set of the same size; a roof from main memory would put kernels on
+// a volume that fits in the last-level cache above 100%.
+void runroofline(const std::string& jsonpath, int gridsize, computebackend* compute, tasksystem& tasks) {
+    watervolume water(gridsize, gridsize, 300.0f, 200.0f, 2.0f);
+    water.tasks = &tasks;
+    double points = double(gridsize) * gridsize;
+    size_t footprint = water.vertices.size() * sizeof(vertex);
+    printf("measuring machine peaks with %u threads...\n", tasks.threadcount() + 1);
+    double memorybandwidth = measurebandwidth(tasks);
+    double peakbandwidth = measurebandwidth(tasks, footprint);
+    double peakflops = measureflops(tasks);
+    // the peaks are taken again after every kernel and the highest kept, so a clock or a neighbour that changes
+    // during the run cannot leave a kernel above its roof
+    auto refreshpeaks = [&] {
+        peakbandwidth = std::max(peakbandwidth, measurebandwidth(tasks, footprint));
+        peakflops = std::max(peakflops, measureflops(tasks));
+    };
+
+    const int repeats = 7;
+    auto sweep = [&](const std::function<void(int, int)>& body) {
+        double seconds = besttime(repeats, [&] { tasks.parallelfor(water.rows(), g_kernel.tilerows, body, g_kernel.threads); });
+        refreshpeaks();
+        return seconds;
+    };
+
+    // sinf is counted as ~20 flops, the polynomial tiers by their operation count: five for the reduction, one for r^2,
+    // a multiply-add per coefficient after the first and a final multiply by r. around the sine each wave takes a
+    // dot product (three flops, or two on the sse2 path, which hoists the z term out of the row), the phase
+    // multiply-subtract and the amplitude multiply, and the two waves are added
+    const double sineflops[] = { 20.0, 13.0, 11.0 };
+    bool simd = g_kernel.simd == 1 && g_kernel.sinetier > 0;
+    double waveflops = 2.0 * ((simd ? 5.0 : 6.0) + sineflops[g_kernel.sinetier]) + 1.0;
+    std::vector<kernelpoint> kernels;
+    float time = 1.0f;
+    wavephases phase = phasesat(water.waves, time);
+    kernels.push_back({ "wave eval", waveflops * points, 48.0 * points,
+        sweep([&](int z0, int z1) { water.evaluatetop(phase, z0, z1); }) });
+    kernels.push_back({ "bottom copy", 1.0 * points, 72.0 * points,
+        sweep([&](int z0, int z1) { water.offsetbottom(z0, z1); }) });
+    kernels.push_back({ "normal stencil", 28.0 * points, 96.0 * points,
+        sweep([&](int z0, int z1) { water.normalrows(z0, z1); }) });
+    // the whole update, so a compute backend can be compared with the cpu kernels it replaces
+    double updateflops = (waveflops + 1.0 + 28.0) * points, updatebytes = (48.0 + 72.0 + 96.0) * points;
+    kernels.push_back({ "full update", updateflops, updatebytes, besttime(repeats, [&] {
+        tasks.parallelfor(water.rows(), g_kernel.tilerows, [&](int z0, int z1) {
+            water.evaluatetop(phase, z0, z1);
+            water.offsetbottom(z0, z1);
+        }, g_kernel.threads);
+        tasks.parallelfor(water.rows(), g_kernel.tilerows, [&](int z0, int z1) { water.normalrows(z0, z1); }, g_kernel.threads);
+    }) });
+    refreshpeaks();
+    if (compute) {
+        water.compute = compute;
+        water.updatewaves(time);  // binds buffers and warms up outside the timing
+        kernels.push_back({ std::string("full update (") + compute->name() + ")", updateflops, updatebytes, besttime(repeats, [&] { water.updatewaves(time); }) });
+        water.compute = nullptr;
+        refreshpeaks();
+    }
+    std::vector<vertex> staging(water.vertices.size());
+    size_t rowbytes = size_t(gridsize) * 2 * sizeof(vertex);
+    // both surfaces read, then written to a staging copy that is read for ownership first
+    kernels.push_back({ "upload staging", 0.0, 2.0 * 72.0 * points,
+        sweep([&](int z0, int z1) {
+            // the copy a mapped upload makes into driver memory, both surfaces
+            memcpy(reinterpret_cast<char*>(staging.data()) + z0 * rowbytes,
+                reinterpret_cast<const char*>(water.vertices.data()) + z0 * rowbytes, (z1 - z0) * rowbytes);
+        }) });
+    double ridge = peakflops / peakbandwidth;
+    printf("peak bandwidth %.2f GB/s over the volume's %.1f MB (%.2f GB/s from main memory), peak %.2f GFLOP/s, "
+        "ridge point %.2f flop/byte (%dx%d grid, %s)\n", peakbandwidth * 1e-9, footprint / 1048576.0,
+        memorybandwidth * 1e-9, peakflops * 1e-9, ridge, gridsize, gridsize, describekernel(g_kernel).c_str());
+    printf("%-22s %10s %10s %10s %10s %12s  %s\n", "kernel", "ms", "flop/byte", "GB/s", "GFLOP/s", "of roof", "verdict");
+
+    FILE* json = fopen(jsonpath.c_str(), "w");
+    if (json) {
+        fprintf(json, "{\n  \"grid\": %d,\n  \"threads\": %u,\n  \"peak_bandwidth_gbs\": %.3f,\n"
+            "  \"memory_bandwidth_gbs\": %.3f,\n  \"peak_gflops\": %.3f,\n  \"ridge_flop_per_byte\": %.4f,\n"
+            "  \"kernels\": [\n", gridsize, tasks.threadcount() + 1, peakbandwidth * 1e-9, memorybandwidth * 1e-9,
+            peakflops * 1e-9, ridge);
+    }
+    for (size_t i = 0; i < kernels.size(); ++i) {
+        const kernelpoint& k = kernels[i];
+        double intensity = k.flops / k.bytes;
+        double bandwidth = k.bytes / k.seconds;
+        double flops = k.flops / k.seconds;
+        bool memorybound = intensity < ridge;
+        // the fraction of the roof under this kernel's intensity that it actually reaches
+        double attained = memorybound ? bandwidth / peakbandwidth : flops / peakflops;
+        const char* verdict = attained >= 0.7
+            ? (memorybound ? "at memory limit" : "at compute limit")
+            : (memorybound ? "memory bound, headroom" : "compute bound, headroom");
+        printf("%-22s %10.3f %10.3f %10.2f %10.2f %11.0f%%  %s\n", k.name.c_str(), 1000.0 * k.seconds, intensity,
+            bandwidth * 1e-9, flops * 1e-9, 100.0 * attained, verdict);
+        if (json) {
+            fprintf(json, "    { \"name\": \"%s\", \"ms\": %.4f, \"flop_per_byte\": %.4f, \"gbs\": %.3f, \"gflops\": %.3f, "
+                "\"bound\": \"%s\", \"fraction_of_roof\": %.3f, \"at_limit\": %s }%s\n", k.name.c_str(), 1000.0 * k.seconds,
+                intensity, bandwidth * 1e-9, flops * 1e-9, memorybound ? "memory" : "compute", attained,
+                attained >= 0.7 ? "true" : "false", i + 1 < kernels.size() ? "," : "");
+        }
+    }
+    if (json) {
+        fprintf(json, "  ]\n}\n");
+        fclose(json);
+        printf("wrote %s\n", jsonpath.c_str());
+    }
+}
+
+// the profile file holds one line per machine: "<cpu> | <gl renderer>\t<tilerows> <threads> <simd> <sinetier> <upload>"
+bool loadtuning(const std::string& key, kernelconfig& config) {
+    std::ifstream file(tuneprofile_path);
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos || line.compare(0, tab, key) != 0) continue;
+        kernelconfig loaded;
+        if (sscanf(line.c_str() + tab + 1, "%d %d %d %d %d", &loaded.tilerows, &loaded.threads, &loaded.simd,
+            &loaded.sinetier, &loaded.upload) == 5) {
+            config = loaded;
+            return true;
+        }
+    }
+    return false;
+}
+
+void savetuning(const std::string& key, const kernelconfig& config) {
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(tuneprofile_path);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.compare(0, key.size() + 1, key + "\t") != 0) lines.push_back(line);
+        }
+    }
+    char values[64];
+    snprintf(values, sizeof(values), "\t%d %d %d %d %d", config.tilerows, config.threads, config.simd, config.sinetier, config.upload);
+    lines.push_back(key + values);
+    std::ofstream file(tuneprofile_path, std::ios::trunc);
+    for (auto& line : lines) file << line << "\n";
+}
+
+// median wall time of one wave update under a candidate config
+double timewaves(watervolume& water, const kernelconfig& config, int repeats) {
+    g_kernel = config;
+    std::vector<double> samples;
+    for (int i = 0; i < repeats; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        water.updatewaves(1.0f + 0.05f * i);
+        samples.push_back(secondssince(start));
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+// largest height difference from the exact kernels, over a few frames spread across a long run
+float kernelerror(watervolume& water, const kernelconfig& config) {
+    float worst = 0.0f;
+    for (float time : { 0.0f, 37.5f, 512.25f }) {
+        g_kernel = kernelconfig();
+        water.updatewaves(time);
+        std::vector<vertex> reference = water.vertices;
+        g_kernel = config;
+        water.updatewaves(time);
+        for (size_t i = 0; i < reference.size(); ++i) {
+            worst = std::max(worst, std::fabs(reference[i].y - water.vertices[i].y));
+        }
+    }
+    return worst;
+}
+
+// benchmarks the wave kernels and upload paths on a copy of the volume and returns the fastest accurate config.
+// each stage is searched with the winners of the previous ones held fixed, which keeps the sweep under a second or two.
+kernelconfig autotune(const watervolume& source, tasksystem& tasks) {
+    watervolume water = source;
+    water.tasks = &tasks;
+    kernelconfig best;
+    best.threads = 1;
+    best.tilerows = 1 << 30;
+    const int repeats = 15;
+
+    // sine tier and simd variant, single threaded
+    double besttime = timewaves(water, best, repeats);
+    for (int simd = 0; simd <= 1; ++simd) {
+#ifndef FLUIDSIM_SSE2
+        if (simd == 1) continue;
+#endif
+        for (int sinetier = 0; sinetier <= 2; ++sinetier) {
+            kernelconfig candidate = best;
+            candidate.simd = simd;
+            candidate.sinetier = sinetier;
+            if (simd == 1 && sinetier == 0) continue;
+            if (kernelerror(water, candidate) > g_tunetolerance) continue;
+            double t = timewaves(water, candidate, repeats);
+            if (t < besttime) {
+                besttime = t;
+                best.simd = simd;
+                best.sinetier = sinetier;
+            }
+        }
+    }
+
+    // thread count and tile size
+    kernelconfig kernel = best;
+    std::vector<int> threadcounts;
+    int maxthreads = int(tasks.threadcount()) + 1;
+    for (int threads = 1; threads < maxthreads; threads *= 2) threadcounts.push_back(threads);
+    threadcounts.push_back(maxthreads);
+    for (int threads : threadcounts) {
+        for (int tilerows : { 4, 8, 16, 32, 64 }) {
+            kernelconfig candidate = kernel;
+            candidate.threads = threads;
+            candidate.tilerows = tilerows;
+            double t = timewaves(water, candidate, repeats);
+            if (t < besttime) {
+                besttime = t;
+                best = candidate;
+            }
+        }
+    }
+    if (best.tilerows > 64) best.tilerows = 16;
+
+    // upload strategy, timed with the gpu drained so each path pays for its own synchronization.
+    // only the gl path has a choice to make
+    if (!glfwGetCurrentContext()) return best;
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, water.vertices.size() * sizeof(vertex), nullptr, GL_DYNAMIC_DRAW);
+    double bestupload = 0.0;
+    for (int upload = 0; upload <= 2; ++upload) {
+        g_kernel.upload = upload;
+        glFinish();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeats; ++i) water.upload(vbo);
+        glFinish();
+        double t = secondssince(start);
+        if (upload == 0 || t < bestupload) {
+            bestupload = t;
+            best.upload = upload;
+        }
+    }
+    glDeleteBuffers(1, &vbo);
+    return best;
+}
+
+// steps per second of the dense and block-adaptive cpu solvers and the gpu one on the same grid, and how far
+// apart their results end up
+void runripplebench(int n, int steps, tasksystem& tasks) {
+    ripplegrid dense(n), cpu(n);
+    dense.tasks = &tasks;
+    dense.adaptive = false;
+    cpu.tasks = &tasks;
+    gpuripples gpu(n, 1.0f, 1.0f);
+    rippledrop drop{ 0.5f, 0.5f, 0.05f, 1.0f };
+    dense.setsponge(g_ripplesponge);
+    cpu.setsponge(g_ripplesponge);
+    gpu.spongewidth = std::clamp(g_ripplesponge, 0, n / 2 - 1);
+
+    dense.drop(drop);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; ++i) dense.step();
+    double densetime = secondssince(start);
+
+    cpu.drop(drop);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; ++i) cpu.step();
+    double cputime = secondssince(start);
+
+    glFinish();
+    start = std::chrono::steady_clock::now();
+    gpu.advance(steps, { drop });
+    glFinish();
+    double gputime = secondssince(start);
+
+    std::vector<float> heights = gpu.readback();
+    float gpudifference = 0.0f, adaptivedifference = 0.0f, maxheight = 0.0f;
+    for (size_t i = 0; i < heights.size(); ++i) {
+        gpudifference = std::max(gpudifference, std::abs(heights[i] - dense.current[i]));
+        adaptivedifference = std::max(adaptivedifference, std::abs(cpu.current[i] - dense.current[i]));
+        maxheight = std::max(maxheight, std::abs(dense.current[i]));
+    }
+    const char* renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+    printf("ripple solver on a %dx%d grid, %d steps\n", n, n, steps);
+    printf("  cpu dense (%u threads): %.0f steps/s\n", tasks.threadcount() + 1, steps / densetime);
+    printf("  cpu adaptive (%u threads): %.0f steps/s, %.1f%% of the blocks stepped on average\n",
+        tasks.threadcount() + 1, steps / cputime, 100.0 * cpu.steppedfraction());
+    printf("  gpu (%s): %.0f steps/s\n", renderer ? renderer : "unknown renderer", steps / gputime);
+    printf("  largest difference from dense: adaptive %.3g, gpu %.3g, against heights up to %.3g\n",
+        adaptivedifference, gpudifference, maxheight);
+}
+
+// implicit line solves per second at grid size n: the textbook thomas sweep one line at a time, then the
+// lane-parallel sweeps with the transpose on one thread and on all of them. all three must agree exactly.
+void runadibench(int n) {
+    tasksystem tasks(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    const float r = 4.0f;  // sixteen times the explicit limit
+    const int repeats = 5;
+    std::vector<float> input(size_t(n) * n, 0.0f);
+    for (int z = 1; z < n - 1; ++z) {
+        for (int x = 1; x < n - 1; ++x) {
+            uint32_t h = uint32_t(x) * 374761393u + uint32_t(z) * 668265263u;
+            h = (h ^ (h >> 13)) * 1274126177u;
+            input[x + size_t(z) * n] = float((h ^ (h >> 16)) & 0xffff) / 65535.0f - 0.5f;
+        }
+    }
+    adisolver solver(n, r);
+    std::vector<float> scalar = input, serial = input, threaded = input;
+    solver.solvescalar(scalar);
+    solver.solve(serial, nullptr);
+    solver.solve(threaded, &tasks);
+    float difference = 0.0f;
+    for (size_t i = 0; i < input.size(); ++i) {
+        difference = std::max(difference, std::max(std::abs(serial[i] - scalar[i]), std::abs(threaded[i] - scalar[i])));
+    }
+
+    // each timed solve starts from the same field, since a field diffused over and over sinks into denormals
+    std::vector<float> field;
+    auto timesolve = [&](const std::function<void()>& solve) {
+        double best = 1e30;
+        for (int i = 0; i < repeats; ++i) {
+            field = input;
+            auto start = std::chrono::steady_clock::now();
+            solve();
+            best = std::min(best, secondssince(start));
+        }
+        return best;
+    };
+    double scalartime = timesolve([&] { solver.solvescalar(field); });
+    double serialtime = timesolve([&] { solver.solve(field, nullptr); });
+    double threadedtime = timesolve([&] { solver.solve(field, &tasks); });
+    double lines = 2.0 * (n - 2);
+    printf("adi diffusion on a %dx%d grid, r=%g, both directions per step\n", n, n, r);
+    printf("  %-28s %8.3f ms per step, %10.0f line solves/s\n", "scalar, line by line", 1000.0 * scalartime, lines / scalartime);
+    printf("  %-28s %8.3f ms per step, %10.0f line solves/s\n", "lanes + transpose, 1 thread", 1000.0 * serialtime, lines / serialtime);
+    char label[64];
+    snprintf(label, sizeof(label), "lanes + transpose, %u threads", tasks.threadcount() + 1);
+    printf("  %-28s %8.3f ms per step, %10.0f line solves/s\n", label, 1000.0 * threadedtime, lines / threadedtime);
+    printf("  largest difference from the scalar sweep %.3g\n", difference);
+}
+
+// cells advected per second at grid size n around the ripple layer's eddy: a plain scalar semi-lagrangian step that
+// traces every cell as it goes, then the advector's three schemes on one thread and maccormack on all of them.
+// after a run of steps the share of a bump's peak each scheme still holds shows what the extra passes buy.
+void runadvectbench(int n) {
+    tasksystem tasks(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    const float speed = 0.8f;
+    const int repeats = 5, turns = 100;
+    std::vector<glm::vec2> velocity(size_t(n) * n);
+    for (int z = 0; z < n; ++z) {
+        for (int x = 0; x < n; ++x) velocity[x + size_t(z) * n] = swirlflow(n, speed, x, z);
+    }
+    // a ring of smooth bumps halfway out, where the eddy is fastest
+    std::vector<float> input(size_t(n) * n, 0.0f);
+    float half = 0.5f * (n - 1), radius = std::max(3.0f, n / 24.0f);
+    for (int k = 0; k < 8; ++k) {
+        float cx = half + 0.5f * half * std::cos(k * 0.785398f), cz = half + 0.5f * half * std::sin(k * 0.785398f);
+        for (int z = 1; z < n - 1; ++z) {
+            for (int x = 1; x < n - 1; ++x) {
+                float d = std::sqrt((x - cx) * (x - cx) + (z - cz) * (z - cz)) / radius;
+                if (d < 1.0f) input[x + size_t(z) * n] += 0.5f + 0.5f * std::cos(3.14159265f * d);
+            }
+        }
+    }
+
+    auto naive = [&](const std::vector<float>& in, std::vector<float>& out) {
+        for (int z = 1; z < n - 1; ++z) {
+            for (int x = 1; x < n - 1; ++x) {
+                glm::vec2 v = velocity[x + size_t(z) * n];
+                float fx = std::clamp(x - v.x, 0.0f, float(n - 1)), fz = std::clamp(z - v.y, 0.0f, float(n - 1));
+                int sx = std::min(int(fx), n - 2), sz = std::min(int(fz), n - 2);
+                float wx = fx - sx, wz = fz - sz;
+                const float* s = &in[sx + size_t(sz) * n];
+                float top = s[0] + wx * (s[1] - s[0]);
+                float bottom = s[n] + wx * (s[n + 1] - s[n]);
+                out[x + size_t(z) * n] = top + wz * (bottom - top);
+            }
+        }
+    };
+    advector flow(n, ripplegrid::blocksize, [&](int x, int z) { return velocity[x + size_t(z) * n]; });
+    int blocks = (n + ripplegrid::blocksize - 1) / ripplegrid::blocksize;
+    std::vector<int> everyblock(size_t(blocks) * blocks);
+    for (int b = 0; b < blocks * blocks; ++b) everyblock[b] = b;
+
+    std::vector<float> reference(input.size(), 0.0f), field = input;
+    naive(input, reference);
+    flow.advect(field, advectscheme::firstorder, everyblock, nullptr);
+    float difference = 0.0f;
+    for (size_t i = 0; i < input.size(); ++i) difference = std::max(difference, std::abs(field[i] - reference[i]));
+
+    std::vector<float> out(input.size(), 0.0f);
+    auto timestep = [&](const std::function<void()>& step) {
+        double best = 1e30;
+        for (int i = 0; i < repeats; ++i) {
+            field = input;
+            auto start = std::chrono::steady_clock::now();
+            step();
+            best = std::min(best, secondssince(start));
+        }
+        return best;
+    };
+    auto peakafter = [&](advectscheme scheme) {
+        field = input;
+        for (int i = 0; i < turns; ++i) flow.advect(field, scheme, everyblock, &tasks);
+        return *std::max_element(field.begin(), field.end()) / *std::max_element(input.begin(), input.end());
+    };
+    double cells = double(n - 2) * (n - 2);
+    auto row = [&](const char* label, double seconds, float peak) {
+        printf("  %-32s %7.2f ns/cell, %8.1f Mcells/s", label, 1e9 * seconds / cells, cells / seconds / 1e6);
+        if (peak >= 0.0f) printf(", %5.1f%% of the peak left", 100.0f * peak);
+        printf("\n");
+    };
+    printf("advection on a %dx%d grid around an eddy of up to %g cells/step, peaks after %d steps\n", n, n, speed, turns);
+    row("naive scalar, first order", timestep([&] { naive(field, out); }), -1.0f);
+    row("first order, 1 thread", timestep([&] { flow.advect(field, advectscheme::firstorder, everyblock, nullptr); }),
+        peakafter(advectscheme::firstorder));
+    row("maccormack, 1 thread", timestep([&] { flow.advect(field, advectscheme::maccormack, everyblock, nullptr); }),
+        peakafter(advectscheme::maccormack));
+    row("bfecc, 1 thread", timestep([&] { flow.advect(field, advectscheme::bfecc, everyblock, nullptr); }),
+        peakafter(advectscheme::bfecc));
+    char label[64];
+    snprintf(label, sizeof(label), "maccormack, %u threads", tasks.threadcount() + 1);
+    row(label, timestep([&] { flow.advect(field, advectscheme::maccormack, everyblock, &tasks); }), -1.0f);
+    printf("  largest difference between first order and the naive step %.3g\n", difference);
+}
+
+// the iwave convolution at grid size n: the direct 13x13 kernel, then its separable split at each rank on one
+// thread, and the direct and rank-3 versions on every core, with the largest error of each split against the direct
+// result. the heights are hash noise, which holds every wavelength and so is the hardest case for a truncated split.
+void runiwavebench(int n) {
+    tasksystem tasks(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    const int repeats = 5;
+    std::vector<float> heights(size_t(n) * n, 0.0f);
+    for (int z = 1; z < n - 1; ++z) {
+        for (int x = 1; x < n - 1; ++x) {
+            uint32_t h = uint32_t(x) * 374761393u + uint32_t(z) * 668265263u;
+            h = (h ^ (h >> 13)) * 1274126177u;
+            heights[x + size_t(z) * n] = float((h ^ (h >> 16)) & 0xffff) / 65535.0f - 0.5f;
+        }
+    }
+    iwavekernel kernel(n, 0);
+    std::vector<float> reference(heights.size()), out(heights.size());
+    kernel.direct(heights, reference, nullptr);
+    float largest = 0.0f;
+    for (float v : reference) largest = std::max(largest, std::abs(v));
+
+    double cells = double(n) * n;
+    auto row = [&](const char* label, const std::function<void()>& convolve, bool compare) {
+        double seconds = besttime(repeats, convolve);
+        printf("  %-34s %8.3f ms per step, %7.2f ns/cell", label, 1000.0 * seconds, 1e9 * seconds / cells);
+        if (compare) {
+            float difference = 0.0f;
+            for (size_t i = 0; i < out.size(); ++i) difference = std::max(difference, std::abs(out[i] - reference[i]));
+            printf(", largest error %.2e of the peak", difference / largest);
+        }
+        printf("\n");
+    };
+    unsigned threads = tasks.threadcount() + 1;
+    char label[64];
+    printf("iwave vertical derivative on a %dx%d grid, 13x13 kernel\n", n, n);
+    printf("  kernel eigenvalues");
+    for (int k = 0; k < iwavekernel::maxrank; ++k) printf(" %.3g", kernel.eigenvalue(k));
+    printf(", the rest below 1e-4\n");
+    row("direct, 1 thread", [&] { kernel.direct(heights, out, nullptr); }, false);
+    for (int k = 1; k <= iwavekernel::maxrank; ++k) {
+        snprintf(label, sizeof(label), "%d-term split (%.4f%%), 1 thread", k, 100.0 * kernel.share(k - 1));
+        row(label, [&] { kernel.separable(heights, out, nullptr, k); }, true);
+    }
+    snprintf(label, sizeof(label), "direct, %u threads", threads);
+    row(label, [&] { kernel.direct(heights, out, &tasks); }, false);
+    snprintf(label, sizeof(label), "3-term split, %u threads", threads);
+    row(label, [&] { kernel.separable(heights, out, &tasks, 3); }, true);
+}
+
+// how much water a sponge saves. the region of interest is the middle 129x129 cells of the ripple layer, with a
+// drop in its centre; its heights over a run of steps are compared with those of a domain so large that nothing
+// reflected off its edge gets back in time. a hard-edged domain has to grow until its reflections arrive late and
+// weak enough; a sponged one only needs room for the band. sizes are odd so every domain's centre is a cell.
+void runspongebench() {
+    const int roi = 129, steps = 600, reference = roi + steps;  // 729, far enough that no echo returns
+    // the first run records the reference heights, the others return their rms error against them
+    std::vector<float> truth;
+    auto run = [&](int n, int width) {
+        bool recording = truth.empty();
+        ripplegrid grid(n);
+        grid.setsponge(width);
+        grid.drop({ 0.5f, 0.5f, 4.0f / (n - 1), 1.0f });
+        int offset = (n - roi) / 2;
+        double error = 0.0, energy = 0.0;
+        for (int s = 0; s < steps; ++s) {
+            grid.step();
+            for (int z = 0; z < roi; ++z) {
+                for (int x = 0; x < roi; ++x) {
+                    float h = grid.current[(x + offset) + size_t(z + offset) * n];
+                    if (recording) {
+                        truth.push_back(h);
+                        continue;
+                    }
+                    float t = truth[x + size_t(z) * roi + size_t(s) * roi * roi];
+                    error += double(h - t) * (h - t);
+                    energy += double(t) * t;
+                }
+            }
+        }
+        return energy > 0.0 ? std::sqrt(error / energy) : 0.0;
+    };
+    run(reference, 0);
+
+    printf("reflections into the middle %dx%d cells over %d steps, against a %dx%d domain\n", roi, roi, steps, reference, reference);
+    std::vector<std::pair<int, double>> hard;
+    for (int n = roi + 16; n < reference; n += 32) hard.push_back({ n, run(n, 0) });
+    for (int width : { 8, 16, 24, 32 }) {
+        int n = roi + 2 * width;
+        double error = run(n, width);
+        int match = 0;
+        for (auto& [size, e] : hard) {
+            if (e <= error) {
+                match = size;
+                break;
+            }
+        }
+        printf("  sponge %2d cells: %3dx%-3d domain, error %.4f;", width, n, n, error);
+        if (match) {
+            printf(" hard edges need %dx%d for that, %.1fx the cells\n", match, match, double(match) * match / (double(n) * n));
+        }
+        else {
+            printf(" no hard-edged domain below %dx%d gets that low\n", reference, reference);
+        }
+    }
+    for (auto& [size, e] : hard) printf("  hard edges %3dx%-3d error %.4f\n", size, size, e);
+}
+
+// what running the ripple solver coarse saves. a fine grid the size of the render grid and a coarse one are stepped
+// every cell from the same drop, so the comparison is of the grids and not of how much of them the drop stirs; then
+// the coarse heights are drawn onto the render grid bilinear, bicubic and bicubic with detail. a smooth drop drawn
+// from the coarse grid is checked against the same drop placed on the fine one, which shows what bicubic buys.
+void runupsamplebench(int fine, int coarse) {
+    tasksystem tasks(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    const int steps = 20, repeats = 5;
+    const rippledrop drop{ 0.5f, 0.5f, 0.1f, 1.0f };
+    std::vector<float> out(size_t(fine) * fine);
+    auto bilinear = [&](const ripplegrid& grid) {
+        tasks.parallelfor(fine, 16, [&](int z0, int z1) {
+            for (int z = z0; z < z1; ++z) {
+                for (int x = 0; x < fine; ++x) out[x + size_t(z) * fine] = grid.sample(float(x) / (fine - 1), float(z) / (fine - 1));
+            }
+        });
+    };
+    rippleupsampler cubic(0.0f), detailed(0.25f);
+    auto error = [&](const rippleupsampler* drawn) {
+        float largest = 0.0f;
+        for (int z = 0; z < fine; ++z) {
+            const float* h = drawn ? drawn->row(z) : &out[size_t(z) * fine];
+            for (int x = 0; x < fine; ++x) largest = std::max(largest, std::abs((h ? h[x] : 0.0f) - dropheight(drop, fine, x, z)));
+        }
+        return largest / drop.strength;
+    };
+
+    ripplegrid shape(coarse);
+    shape.drop(drop);
+    bilinear(shape);
+    float bilinearerror = error(nullptr);
+    cubic.upsample(shape, fine, fine, &tasks);
+    float cubicerror = error(&cubic);
+
+    auto simulate = [&](ripplegrid& grid, int iwaveterms) {
+        grid.tasks = &tasks;
+        grid.adaptive = false;
+        grid.setdispersion(iwaveterms);
+        grid.drop(drop);
+        // the first step sizes the scratch buffers, so it is left out
+        grid.step();
+        grid.steptime = 0;
+        for (int i = 0; i < steps; ++i) grid.step();
+        return grid.steptime / steps;
+    };
+    ripplegrid reference(fine), grid(coarse), finewave(fine), coarsewave(coarse);
+    double finestep = simulate(reference, -1), coarsestep = simulate(grid, -1);
+    double fineiwave = simulate(finewave, 2), coarseiwave = simulate(coarsewave, 2);
+    double linear = besttime(repeats, [&] { bilinear(grid); });
+    // laid out before the timing starts, so the split below is of the draws alone
+    detailed.upsample(grid, fine, fine, &tasks);
+    cubic.seconds = cubic.widenseconds = detailed.seconds = detailed.widenseconds = 0;
+    double bicubic = besttime(repeats, [&] { cubic.upsample(grid, fine, fine, &tasks); });
+    double withdetail = besttime(repeats, [&] { detailed.upsample(grid, fine, fine, &tasks); });
+
+    printf("ripple layer under a %dx%d render grid, %u threads, every cell stepped\n", fine, fine, tasks.threadcount() + 1);
+    char label[64];
+    auto row = [&](const char* text, double seconds, const char* unit) {
+        printf("  %-34s %8.3f ms per %s", text, 1000.0 * seconds, unit);
+    };
+    for (int iwave : { 0, 1 }) {
+        double finetime = iwave ? fineiwave : finestep, coarsetime = iwave ? coarseiwave : coarsestep;
+        snprintf(label, sizeof(label), "simulating %dx%d%s", fine, fine, iwave ? ", iwave 2 terms" : "");
+        row(label, finetime, "step\n");
+        snprintf(label, sizeof(label), "simulating %dx%d%s", coarse, coarse, iwave ? ", iwave 2 terms" : "");
+        row(label, coarsetime, "step");
+        printf(", %.1fx less\n", finetime / coarsetime);
+    }
+    row("drawing it bilinear", linear, "frame\n");
+    row("drawing it bicubic", bicubic, "frame\n");
+    snprintf(label, sizeof(label), "bicubic with detail %g", detailed.detail);
+    row(label, withdetail, "frame\n");
+    // the blend writes every render height, so no draw gets far below the time it takes to fill that many floats
+    std::vector<float> filled(size_t(fine) * fine);
+    double fill = besttime(repeats, [&] { std::fill(filled.begin(), filled.end(), filled[0] + 1.0f); });
+    printf("  of the draws, widening takes %.0f%% bicubic and %.0f%% with detail; filling a %dx%d float grid takes %.3f ms\n",
+        100.0 * cubic.widenseconds / cubic.seconds, 100.0 * detailed.widenseconds / detailed.seconds, fine, fine, 1000.0 * fill);
+    printf("  coarse step and detailed draw against the fine step: %.1fx less, %.1fx with iwave\n",
+        finestep / (coarsestep + withdetail), fineiwave / (coarseiwave + withdetail));
+    printf("  a drop drawn from the coarse grid is off by at most %.2e of its height bilinear, %.2e bicubic\n",
+        bilinearerror, cubicerror);
+}
+
+// surface vertices per second for count small volumes at 8x8, 16x16 and 32x32, each with its own extent, thickness
+// and waves: updated one at a time, serially and with each body's rows split over the threads, then through a
+// volumebatch on one thread and on all of them. both kernel choices are timed, the exact sine and the sse2 degree-7
+// polynomial, and every batched vertex must match the one-at-a-time result bit for bit.
+void runbodiesbench(int count) {
+    tasksystem tasks(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    const int repeats = 10;
+    const float time = 12.5f;
+    kernelconfig saved = g_kernel;
+    unsigned threads = tasks.threadcount() + 1;
+    printf("%d water bodies, %u threads\n", count, threads);
+    for (int size : { 8, 16, 32 }) {
+        std::vector<std::shared_ptr<watervolume>> volumes;
+        std::vector<watervolume*> members;
+        for (int k = 0; k < count; ++k) {
+            auto body = std::make_shared<watervolume>(size, size, 8.0f + float(k % 5), 6.0f + float(k % 3), 1.0f + 0.1f * float(k % 4));
+            body->waves.amplitude1 *= 0.5f + float(k % 7) / 7.0f;
+            body->waves.frequency1 *= 0.8f + 0.1f * float(k % 5);
+            body->waves.speed2 *= 1.0f + 0.25f * float(k % 3);
+            volumes.push_back(body);
+            members.push_back(body.get());
+        }
+        volumebatch batch(members, &tasks);
+        volumebatch serialbatch(members, nullptr);
+        double vertices = double(batch.vertexcount());
+        printf("  %dx%d bodies: %d lane groups in %d tiles\n", size, size, batch.groupcount(), batch.tilecount());
+
+        for (int simd : { 0, 1 }) {
+            g_kernel = kernelconfig{};
+            g_kernel.simd = simd;
+            g_kernel.sinetier = simd;
+            auto oneatatime = [&](tasksystem* pool) {
+                g_kernel.threads = pool ? int(threads) : 1;
+                for (watervolume* body : members) {
+                    body->tasks = pool;
+                    body->updatewaves(time);
+                }
+            };
+            double serial = besttime(repeats, [&] { oneatatime(nullptr); });
+            double split = besttime(repeats, [&] { oneatatime(&tasks); });
+            std::vector<std::vector<vertex>> expected;
+            for (watervolume* body : members) expected.push_back(body->vertices);
+            // the batch writes into the same vertices, so they are poisoned first or a body it skipped would still match
+            auto differing = [&](volumebatch& run) {
+                for (watervolume* body : members)
+                    for (vertex& v : body->vertices) v.y = std::numeric_limits<float>::quiet_NaN();
+                run.updatewaves(time);
+                int mismatched = 0;
+                for (int k = 0; k < count; ++k) {
+                    const std::vector<vertex>& got = members[k]->vertices;
+                    mismatched += memcmp(got.data(), expected[k].data(), got.size() * sizeof(vertex)) != 0;
+                }
+                return mismatched;
+            };
+            int serialmismatched = differing(serialbatch), mismatched = differing(batch);
+            double batchedserial = besttime(repeats, [&] { serialbatch.updatewaves(time); });
+            double batched = besttime(repeats, [&] { batch.updatewaves(time); });
+            printf("    %s\n", simd ? "sse2, degree-7 sine" : "scalar, exact sine");
+            printf("      one at a time, 1 thread      %8.1f M vertices/s\n", vertices / serial / 1e6);
+            printf("      one at a time, %u threads     %8.1f M vertices/s\n", threads, vertices / split / 1e6);
+            printf("      batched, 1 thread            %8.1f M vertices/s, %.1fx\n", vertices / batchedserial / 1e6, serial / batchedserial);
+            printf("      batched, %u threads           %8.1f M vertices/s, %.1fx\n", threads, vertices / batched / 1e6, serial / batched);
+            printf("      %d and %d of %d bodies differ from one at a time, batched on 1 and %u threads\n", serialmismatched, mismatched, count, threads);
+        }
+    }
+    g_kernel = saved;
+}
+
+// the top-surface heights the update computed before the double time base: the float clock multiplied by each wave's
+// speed inside the phase, as watervolume::evaluaterow used to do. kept for the uptime benchmark to compare against.
+template <int sinetier>
+void floatclockheights(const watervolume& water, float time, bool simd, std::vector<float>& out) {
+    const waveparams& w = water.waves;
+    glm::vec2 dir1 = glm::normalize(glm::vec2(1.0f, 0.2f));
+    glm::vec2 dir2 = glm::normalize(glm::vec2(0.2f, 1.0f));
+    int columns = water.columns();
+    for (int z = 0; z < water.rows(); ++z) {
+        const vertex* v = &water.vertices[size_t(z) * columns];
+        float* y = &out[size_t(z) * columns];
+        int x = 0;
+#ifdef FLUIDSIM_SSE2
+        if (simd) {
+            __m128 b1 = _mm_set1_ps(dir1.y * (v[0].z - w.speed1 * time));
+            __m128 b2 = _mm_set1_ps(dir2.y * (v[0].z - w.speed2 * time));
+            __m128 s1 = _mm_set1_ps(w.speed1 * time), s2 = _mm_set1_ps(w.speed2 * time);
+            __m128 d1 = _mm_set1_ps(dir1.x), d2 = _mm_set1_ps(dir2.x);
+            __m128 f1 = _mm_set1_ps(w.frequency1), f2 = _mm_set1_ps(w.frequency2);
+            __m128 a1 = _mm_set1_ps(w.amplitude1), a2 = _mm_set1_ps(w.amplitude2);
+            for (; x + 4 <= columns; x += 4) {
+                __m128 px = _mm_set_ps(v[x + 3].x, v[x + 2].x, v[x + 1].x, v[x].x);
+                __m128 dot1 = _mm_add_ps(_mm_mul_ps(d1, _mm_sub_ps(px, s1)), b1);
+                __m128 dot2 = _mm_add_ps(_mm_mul_ps(d2, _mm_sub_ps(px, s2)), b2);
+                _mm_storeu_ps(y + x, _mm_add_ps(_mm_mul_ps(a1, fastsin4<sinetier>(_mm_mul_ps(f1, dot1))),
+                    _mm_mul_ps(a2, fastsin4<sinetier>(_mm_mul_ps(f2, dot2)))));
+            }
+        }
+#endif
+        for (; x < columns; ++x) {
+            float dot1 = glm::dot(dir1, glm::vec2(v[x].x - w.speed1 * time, v[x].z - w.speed1 * time));
+            float dot2 = glm::dot(dir2, glm::vec2(v[x].x - w.speed2 * time, v[x].z - w.speed2 * time));
+            y[x] = w.amplitude1 * fastsin<sinetier>(w.frequency1 * dot1) + w.amplitude2 * fastsin<sinetier>(w.frequency2 * dot2);
+        }
+    }
 }
-)";
-// this vertex shader transforms vertices from model space to clip space and passes world position and normals to the fragment shader.
 
-static const char* fragment_shader_source = R"(
-#version 330 core
-in vec3 vWorldPos;
-in vec3 vNormal;
-out vec4 fragColor;
-uniform vec3 uCamPos;
-uniform vec3 uLightPos;
-uniform int uSteps;
-uniform vec3 uDarkColor;
-uniform vec3 uLightColor;
-void main() {
-    vec3 normal = normalize(vNormal);
-    vec3 lightDir = normalize(uLightPos - vWorldPos);
-    float lambert = max(dot(normal, lightDir), 0.0);
-    float toonLevel = floor(lambert * float(uSteps)) / float(uSteps);
-    vec3 color = mix(uDarkColor, uLightColor, toonLevel);
-    fragColor = vec4(color, 1.0);
+// wave heights after long uptimes of 0.05 s frames, from start-up to a year. each kernel choice is timed and checked
+// against a double-precision evaluation at the true time twice: as updated now, from the double clock through the
+// wrapped phase offsets, and as it was before, from a float clock through speed * time. the first should keep the
+// same error and time per update at every uptime.
+void runuptimebench(int n) {
+    watervolume water(n, n, 300.0f, 200.0f, 2.0f);
+    const int repeats = 5;
+    const float dt = 0.05f;
+    kernelconfig saved = g_kernel;
+    const waveparams& w = water.waves;
+    glm::vec2 dir1 = glm::normalize(glm::vec2(1.0f, 0.2f));
+    glm::vec2 dir2 = glm::normalize(glm::vec2(0.2f, 1.0f));
+    size_t points = size_t(n) * n;
+    std::vector<float> reference(points), legacy(points);
+    const std::pair<const char*, double> uptimes[] = {
+        { "start-up", 0.0 }, { "1 hour", 3600.0 }, { "1 day", 86400.0 }, { "1 week", 7 * 86400.0 },
+        { "30 days", 30 * 86400.0 }, { "1 year", 365 * 86400.0 },
+    };
+    const std::pair<int, int> kernels[] = { { 0, 0 }, { 0, 1 }, { 1, 1 }, { 1, 2 } };  // simd, sine tier
+    printf("uptime benchmark: %dx%d volume, %.2f s frames, height errors against double precision, one thread\n", n, n, dt);
+
+    // both clocks step frame by frame, as simstate's does, so the float one stalls where it would. they are all run
+    // first, since a second of spinning just before a measurement throttles it on some machines.
+    const int count = int(std::size(uptimes));
+    std::vector<long long> frames(count);
+    std::vector<float> floatclocks(count);
+    std::vector<double> doubleclocks(count);
+    long long frame = 0;
+    float floatclock = 0.0f;
+    double doubleclock = 0.0;
+    for (int u = 0; u < count; ++u) {
+        for (; double(frame) * dt < uptimes[u].second; ++frame) {
+            floatclock += dt;
+            doubleclock += dt;
+        }
+        frames[u] = frame;
+        floatclocks[u] = floatclock;
+        doubleclocks[u] = doubleclock;
+    }
+
+    for (int u = 0; u < count; ++u) {
+        double exact = double(frames[u]) * dt;
+        double offset1 = wrapphase(double(w.frequency1) * w.speed1 * (double(dir1.x) + dir1.y) * exact);
+        double offset2 = wrapphase(double(w.frequency2) * w.speed2 * (double(dir2.x) + dir2.y) * exact);
+        for (size_t i = 0; i < points; ++i) {
+            double px = water.vertices[i].x, pz = water.vertices[i].z;
+            reference[i] = float(w.amplitude1 * std::sin(w.frequency1 * (dir1.x * px + dir1.y * pz) - offset1) +
+                w.amplitude2 * std::sin(w.frequency2 * (dir2.x * px + dir2.y * pz) - offset2));
+        }
+        printf("  %s, %lld frames: double clock off by %.3g s, float clock by %.3g s\n", uptimes[u].first, frames[u],
+            doubleclocks[u] - exact, double(floatclocks[u]) - exact);
+
+        for (auto [simd, tier] : kernels) {
+            g_kernel = kernelconfig{};
+            g_kernel.simd = simd;
+            g_kernel.sinetier = tier;
+            auto floatclockpass = [&] {
+                switch (tier) {
+                case 1:  floatclockheights<1>(water, floatclocks[u], simd, legacy); break;
+                case 2:  floatclockheights<2>(water, floatclocks[u], simd, legacy); break;
+                default: floatclockheights<0>(water, floatclocks[u], simd, legacy); break;
+                }
+            };
+            wavephases phase = phasesat(w, doubleclocks[u]);
+            double wrapped = besttime(repeats, [&] { water.evaluatetop(phase, 0, n); });
+            double before = besttime(repeats, floatclockpass);
+            float wrappederror = 0.0f, beforeerror = 0.0f;
+            for (size_t i = 0; i < points; ++i) {
+                wrappederror = std::max(wrappederror, std::abs(water.vertices[i].y - reference[i]));
+                beforeerror = std::max(beforeerror, std::abs(legacy[i] - reference[i]));
+            }
+            char label[64];
+            snprintf(label, sizeof(label), "%s, %s sine", simd ? "sse2" : "scalar",
+                tier == 0 ? "exact" : tier == 1 ? "degree-7" : "degree-5");
+            printf("    %-24s wrapped %.2e in %7.3f ms, float clock %.2e in %7.3f ms\n", label, wrappederror,
+                1000.0 * wrapped, beforeerror, 1000.0 * before);
+        }
+    }
+    g_kernel = saved;
 }
-)";
-// the fragment shader implements toon shading by quantizing the light intensity into discrete steps.
 
-GLuint compileshader(GLenum shadertype, const char* shadersource) {
-    GLuint shader = glCreateShader(shadertype);
-    glShaderSource(shader, 1, &shadersource, nullptr);
-    glCompileShader(shader);
-    GLint success;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        char infolog[512];
-        glGetShaderInfoLog(shader, 512, nullptr, infolog);
-        std::cerr << "error shader compilation failed\n" << infolog << "\n";
+// one axis of an ensemble parameter grid, "name=from:to:count" or "name=value" on the command line
+struct sweepaxis {
+    std::string name;
+    float waveparams::* field = nullptr;
+    float from = 0.0f, to = 0.0f;
+    int count = 1;
+};
+
+bool parsesweep(const std::string& spec, sweepaxis& axis, std::string& error) {
+    static const std::pair<const char*, float waveparams::*> fields[] = {
+        { "amplitude1", &waveparams::amplitude1 }, { "amplitude2", &waveparams::amplitude2 },
+        { "frequency1", &waveparams::frequency1 }, { "frequency2", &waveparams::frequency2 },
+        { "speed1", &waveparams::speed1 }, { "speed2", &waveparams::speed2 },
+    };
+    size_t equals = spec.find('=');
+    if (equals == std::string::npos) {
+        error = "missing '='";
+        return false;
     }
-    // proper error checking ensures shader compilation issues are caught early.
-    return shader;
+    axis.name = spec.substr(0, equals);
+    axis.field = nullptr;
+    for (auto& [name, field] : fields) {
+        if (axis.name == name) axis.field = field;
+    }
+    if (!axis.field) {
+        error = "no wave parameter called '" + axis.name + "'";
+        return false;
+    }
+
+    // every field must parse in full, so "1:2" or "1:2:x" is an error rather than the value 1
+    std::vector<std::string> values;
+    for (size_t start = equals + 1;;) {
+        size_t colon = spec.find(':', start);
+        values.push_back(spec.substr(start, colon - start));
+        if (colon == std::string::npos) break;
+        start = colon + 1;
+    }
+    if (values.size() != 1 && values.size() != 3) {
+        error = "expected 1 or 3 ':'-separated fields, got " + std::to_string(values.size());
+        return false;
+    }
+    float* bounds[] = { &axis.from, &axis.to };
+    for (size_t i = 0; i < std::min<size_t>(values.size(), 2); ++i) {
+        char* end = nullptr;
+        *bounds[i] = strtof(values[i].c_str(), &end);
+        if (values[i].empty() || *end || !std::isfinite(*bounds[i])) {
+            error = "'" + values[i] + "' is not a number";
+            return false;
+        }
+    }
+    if (values.size() == 1) {
+        axis.to = axis.from;
+        axis.count = 1;
+        return true;
+    }
+    char* end = nullptr;
+    long count = strtol(values[2].c_str(), &end, 10);
+    if (values[2].empty() || *end || count < 1 || count > 1000000) {
+        error = "step count '" + values[2] + "' is not a whole number from 1 to 1000000";
+        return false;
+    }
+    axis.count = int(count);
+    return true;
 }
 
-GLuint createshaderprogram(const char* vertexsource, const char* fragmentsource) {
-    GLuint vertexshader = compileshader(GL_VERTEX_SHADER, vertexsource);
-    GLuint fragmentshader = compileshader(GL_FRAGMENT_SHADER, fragmentsource);
-    GLuint program = glCreateProgram();
-    glAttachShader(program, vertexshader);
-    glAttachShader(program, fragmentshader);
-    glLinkProgram(program);
-    GLint success;
-    glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if (!success) {
-        char infolog[512];
-        glGetProgramInfoLog(program, 512, nullptr, infolog);
-        std::cerr << "error program linking failed\n" << infolog << "\n";
+struct ensemblerun {
+    waveparams waves;
+    float maxheight = 0.0f, rmsheight = 0.0f;
+    float peakhz = 0.0f, peakamplitude = 0.0f;  // strongest line in the height spectrum at the centre of the volume
+    double seconds = 0.0;
+};
+
+// simulates one parameter set on its own volume, single threaded, and keeps only the statistics.
+// the volume lives for the duration of the run, so memory follows the number of runs in flight.
+void simulateensemblerun(ensemblerun& run, int grid, int steps) {
+    auto start = std::chrono::steady_clock::now();
+    watervolume water(grid, grid, 300.0f, 200.0f, 2.0f);
+    water.waves = run.waves;
+    const float dt = 1.0f / 60.0f;
+    int surface = grid * grid;
+    int centre = grid / 2 + (grid / 2) * grid;
+    std::vector<float> probe(steps);
+    float maxheight = 0.0f;
+    double sumsquares = 0.0;
+    for (int i = 0; i < steps; ++i) {
+        water.updatewaves(dt * i);
+        for (int k = 0; k < surface; ++k) {
+            float y = water.vertices[k].y;
+            maxheight = std::max(maxheight, std::abs(y));
+            sumsquares += double(y) * y;
+        }
+        probe[i] = water.vertices[centre].y;
     }
-    glDeleteShader(vertexshader);
-    glDeleteShader(fragmentshader);
-    // linking combines the shaders into a complete shader program for the gpu.
-    return program;
+
+    // goertzel over every bin up to nyquist, with the mean removed so the peak is never the dc term
+    double mean = 0.0;
+    for (float y : probe) mean += y;
+    mean /= steps;
+    double peakpower = 0.0;
+    int peakbin = 0;
+    for (int k = 1; k <= steps / 2; ++k) {
+        double coefficient = 2.0 * std::cos(2.0 * 3.14159265358979 * k / steps);
+        double s1 = 0.0, s2 = 0.0;
+        for (float y : probe) {
+            double s0 = (y - mean) + coefficient * s1 - s2;
+            s2 = s1;
+            s1 = s0;
+        }
+        double power = s1 * s1 + s2 * s2 - coefficient * s1 * s2;
+        if (power > peakpower) {
+            peakpower = power;
+            peakbin = k;
+        }
+    }
+    run.maxheight = maxheight;
+    run.rmsheight = float(std::sqrt(sumsquares / (double(steps) * surface)));
+    run.peakhz = float(peakbin / (steps * dt));
+    run.peakamplitude = float(2.0 * std::sqrt(peakpower) / steps);
+    run.seconds = secondssince(start);
+}
+
+// runs every point of the parameter grid as a headless volume, jobs at a time, and writes one csv row per run
+void runensemble(const std::string& csvpath, const std::vector<sweepaxis>& axes, int grid, int steps, int jobs) {
+    size_t runcount = 1;
+    for (const sweepaxis& axis : axes) runcount *= size_t(axis.count);
+    std::vector<ensemblerun> runs(runcount);
+    for (size_t r = 0; r < runcount; ++r) {
+        // the last axis varies fastest
+        size_t index = r;
+        for (size_t a = axes.size(); a-- > 0;) {
+            const sweepaxis& axis = axes[a];
+            int i = int(index % size_t(axis.count));
+            index /= size_t(axis.count);
+            float t = axis.count > 1 ? float(i) / float(axis.count - 1) : 0.0f;
+            runs[r].waves.*axis.field = axis.from + t * (axis.to - axis.from);
+        }
+    }
+
+    // both surfaces' vertices, two triangles per cell on each, and the probe series
+    size_t volumebytes = size_t(grid) * grid * (2 * sizeof(vertex) + 12 * sizeof(unsigned int)) + size_t(steps) * sizeof(float);
+    printf("ensemble: %zu runs of %d steps on a %dx%d grid, %d at a time (about %.1f MB of volumes at most)\n",
+        runcount, steps, grid, grid, jobs, jobs * volumebytes / double(1 << 20));
+    tasksystem tasks(unsigned(std::max(jobs - 1, 1)));
+    auto start = std::chrono::steady_clock::now();
+    // one run per chunk; maxthreads counts the calling thread, so exactly jobs volumes exist at once
+    tasks.parallelfor(int(runcount), 1, [&](int r0, int r1) {
+        for (int r = r0; r < r1; ++r) simulateensemblerun(runs[r], grid, steps);
+    }, jobs);
+    double wall = secondssince(start);
+
+    double busy = 0.0;
+    for (const ensemblerun& run : runs) busy += run.seconds;
+    // runs/s is the number to compare across --ensemble-jobs; per-run time grows once jobs exceed the cores
+    printf("  %.2f s wall, %.2f runs/s, %.3f s per run, %.2f runs in flight on average\n",
+        wall, runcount / wall, busy / runcount, busy / wall);
+
+    FILE* csv = fopen(csvpath.c_str(), "w");
+    if (!csv) {
+        std::cerr << "failed to open " << csvpath << "\n";
+        return;
+    }
+    fprintf(csv, "run,amplitude1,amplitude2,frequency1,frequency2,speed1,speed2,"
+        "max_height,rms_height,peak_hz,peak_amplitude,ms_per_step,seconds\n");
+    for (size_t r = 0; r < runcount; ++r) {
+        const ensemblerun& run = runs[r];
+        fprintf(csv, "%zu,%g,%g,%g,%g,%g,%g,%.6f,%.6f,%.6f,%.6f,%.4f,%.4f\n", r,
+            run.waves.amplitude1, run.waves.amplitude2, run.waves.frequency1, run.waves.frequency2,
+            run.waves.speed1, run.waves.speed2, run.maxheight, run.rmsheight, run.peakhz, run.peakamplitude,
+            1000.0 * run.seconds / steps, run.seconds);
+    }
+    fclose(csv);
+    printf("wrote %s\n", csvpath.c_str());
+}
+
+// applies the stored profile for this machine, or measures one on first launch or when asked to
+// the renderer string is part of the key since the upload strategy depends on the driver
+void applykerneltuning(const watervolume& water, tasksystem& tasks, const std::string& renderer) {
+    std::string key = cpumodel() + " | " + renderer;
+    kernelconfig config;
+    const char* source = "defaults";
+    if (g_skipautotune) {
+        source = "defaults (autotune disabled)";
+    }
+    else if (!g_forceautotune && loadtuning(key, config)) {
+        source = "profile";
+    }
+    else if (g_deterministic) {
+        source = "defaults (no profile, and autotuning is timing dependent)";
+    }
+    else {
+        auto start = std::chrono::steady_clock::now();
+        config = autotune(water, tasks);
+        savetuning(key, config);
+        printf("autotuned in %.2f s for %s\n", secondssince(start), key.c_str());
+        source = "autotuned";
+    }
+    if (g_deterministic) {
+        // tiling, threads and uploads cannot change results, but approximate kernels would
+        config.simd = 0;
+        config.sinetier = 0;
+    }
+    g_kernel = config;
+    printf("kernel config (%s): %s\n", source, describekernel(config).c_str());
 }
 
-int main() {
+int main(int argc, char** argv) {
+    std::vector<sweepaxis> sweeps;  // the ensemble's parameter grid
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--sequential") {
+            g_sequential = true;
+        }
+        else if (arg == "--backend" && i + 1 < argc) {
+            g_backend = argv[++i];
+            if (g_backend != "gl" && g_backend != "vulkan") {
+                std::cerr << "unknown backend " << g_backend << "\n";
+                return -1;
+            }
+#ifndef FLUIDSIM_VULKAN
+            if (g_backend == "vulkan") {
+                std::cerr << "this build has no vulkan backend, rebuild with -DFLUIDSIM_VULKAN\n";
+                return -1;
+            }
+#endif
+            // the pipelined loop drives gl directly
+            if (g_backend != "gl") g_sequential = true;
+        }
+        else if (arg == "--compute" && i + 1 < argc) {
+            g_compute = argv[++i];
+            if (g_compute != "cpu" && g_compute != "opencl" && g_compute != "gl" && g_compute != "feedback") {
+                std::cerr << "unknown compute backend " << g_compute << "\n";
+                return -1;
+            }
+#ifndef FLUIDSIM_OPENCL
+            if (g_compute == "opencl") {
+                std::cerr << "this build has no opencl backend, rebuild with -DFLUIDSIM_OPENCL\n";
+                return -1;
+            }
+#endif
+        }
+        else if (arg == "--frames-in-flight" && i + 1 < argc) {
+            g_framesinflight = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--export" && i + 1 < argc) {
+            g_exportprefix = argv[++i];
+        }
+        else if (arg == "--clipmap" && i + 1 < argc) {
+            g_clipmaplevels = std::clamp(atoi(argv[++i]), 1, 12);
+        }
+        else if (arg == "--clipmap-size" && i + 1 < argc) {
+            g_clipmapsize = std::max(9, atoi(argv[++i]));
+        }
+        else if (arg == "--bathymetry" && i + 1 < argc) {
+            g_bathymetrypath = argv[++i];
+            if (g_clipmaplevels == 0) g_clipmaplevels = 6;
+        }
+        else if (arg == "--tile-cache" && i + 1 < argc) {
+            g_tilecachebudget = size_t(std::max(1, atoi(argv[++i]))) << 20;
+        }
+        else if (arg == "--make-bathymetry" && i + 2 < argc) {
+            std::string path = argv[++i];
+            int samples = std::max(256, atoi(argv[++i]));
+            if (!writebathymetry(path, samples, 1.0f)) {
+                std::cerr << "failed to write " << path << "\n";
+                return -1;
+            }
+            printf("wrote %s: %d x %d samples\n", path.c_str(), samples, samples);
+            return 0;
+        }
+        else if (arg == "--upload-budget" && i + 1 < argc) {
+            g_uploadbudget = size_t(std::max(1, atoi(argv[++i]))) << 10;
+        }
+        else if (arg == "--record" && i + 1 < argc) {
+            if (!g_inputlog.record(argv[++i])) {
+                std::cerr << "error could not create input log " << argv[i] << "\n";
+                return -1;
+            }
+        }
+        else if (arg == "--replay" && i + 1 < argc) {
+            std::string error;
+            if (!g_inputlog.load(argv[++i], error)) {
+                std::cerr << "error could not read input log " << argv[i] << ": " << error << "\n";
+                return -1;
+            }
+            g_deterministic = true;
+        }
+        else if (arg == "--checkpoint" && i + 1 < argc) {
+            g_checkpointpath = argv[++i];
+        }
+        else if (arg == "--checkpoint-every" && i + 1 < argc) {
+            g_checkpointevery = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--restart" && i + 1 < argc) {
+            g_restartpath = argv[++i];
+        }
+        else if (arg == "--autotune") {
+            g_forceautotune = true;
+        }
+        else if (arg == "--no-autotune") {
+            g_skipautotune = true;
+        }
+        else if (arg == "--tune-tolerance" && i + 1 < argc) {
+            g_tunetolerance = float(atof(argv[++i]));
+        }
+        else if (arg == "--roofline" && i + 1 < argc) {
+            g_rooflinepath = argv[++i];
+        }
+        else if (arg == "--bench-grid" && i + 1 < argc) {
+            g_benchgrid = std::max(3, atoi(argv[++i]));
+        }
+        else if (arg == "--ripples" && i + 1 < argc) {
+            g_ripples = argv[++i];
+            if (g_ripples != "off" && g_ripples != "cpu" && g_ripples != "gpu") {
+                std::cerr << "unknown ripple solver " << g_ripples << "\n";
+                return -1;
+            }
+        }
+        else if (arg == "--ripple-grid" && i + 1 < argc) {
+            g_ripplegrid = std::clamp(atoi(argv[++i]), 8, 4096);
+        }
+        else if (arg == "--bench-ripples" && i + 1 < argc) {
+            g_benchripples = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--ripple-viscosity" && i + 1 < argc) {
+            g_rippleviscosity = std::max(0.0f, float(atof(argv[++i])));
+        }
+        else if (arg == "--bench-adi") {
+            g_benchadi = true;
+        }
+        else if (arg == "--ripple-current" && i + 1 < argc) {
+            g_ripplecurrent = std::clamp(float(atof(argv[++i])), -1.0f, 1.0f);
+        }
+        else if (arg == "--advection" && i + 1 < argc) {
+            g_advection = argv[++i];
+            advectscheme scheme;
+            if (!parseadvectscheme(g_advection, scheme)) {
+                std::cerr << "unknown advection scheme " << g_advection << "\n";
+                return -1;
+            }
+        }
+        else if (arg == "--bench-advect") {
+            g_benchadvect = true;
+        }
+        else if (arg == "--iwave" && i + 1 < argc) {
+            g_iwaverank = std::clamp(atoi(argv[++i]), 0, iwavekernel::maxrank);
+        }
+        else if (arg == "--ripple-obstacle" && i + 1 < argc) {
+            g_rippleobstacle = std::clamp(float(atof(argv[++i])), 0.0f, 0.5f);
+        }
+        else if (arg == "--bench-iwave") {
+            g_benchiwave = true;
+        }
+        else if (arg == "--ripple-sponge" && i + 1 < argc) {
+            g_ripplesponge = std::max(0, atoi(argv[++i]));
+        }
+        else if (arg == "--bench-sponge") {
+            g_benchsponge = true;
+        }
+        else if (arg == "--ripple-upsample" && i + 1 < argc) {
+            g_rippleupsample = argv[++i];
+            if (g_rippleupsample != "linear" && g_rippleupsample != "cubic") {
+                std::cerr << "unknown ripple upsampling " << g_rippleupsample << "\n";
+                return -1;
+            }
+        }
+        else if (arg == "--ripple-detail" && i + 1 < argc) {
+            g_rippledetail = std::max(0.0f, float(atof(argv[++i])));
+        }
+        else if (arg == "--reflections" && i + 1 < argc) {
+            g_reflectionscale = std::clamp(float(atof(argv[++i])), 0.0f, 1.0f);
+        }
+        else if (arg == "--reflection-interval" && i + 1 < argc) {
+            g_reflectioninterval = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--no-cull") {
+            g_cullfaces = false;
+        }
+        else if (arg == "--depth-prepass") {
+            g_depthprepass = true;
+        }
+        else if (arg == "--overdraw") {
+            g_overdraw = true;
+        }
+        else if (arg == "--bench-upsample") {
+            g_benchupsample = true;
+        }
+        else if (arg == "--bench-bodies" && i + 1 < argc) {
+            g_benchbodies = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--bench-uptime") {
+            g_benchuptime = true;
+        }
+        else if (arg == "--ensemble" && i + 1 < argc) {
+            g_ensemblepath = argv[++i];
+        }
+        else if (arg == "--sweep" && i + 1 < argc) {
+            sweepaxis axis;
+            std::string error;
+            if (!parsesweep(argv[++i], axis, error)) {
+                std::cerr << "bad sweep " << argv[i] << ": " << error << "; expected name=from:to:count or name=value with a wave parameter name\n";
+                return -1;
+            }
+            sweeps.push_back(axis);
+        }
+        else if (arg == "--ensemble-steps" && i + 1 < argc) {
+            g_ensemblesteps = std::max(2, atoi(argv[++i]));
+        }
+        else if (arg == "--ensemble-grid" && i + 1 < argc) {
+            g_ensemblegrid = std::max(3, atoi(argv[++i]));
+        }
+        else if (arg == "--ensemble-jobs" && i + 1 < argc) {
+            g_ensemblejobs = std::max(1, atoi(argv[++i]));
+        }
+        else {
+            std::cerr << "usage: fluid-sim [--sequential] [--backend gl|vulkan] [--compute cpu|opencl|gl|feedback] [--frames-in-flight n] [--export prefix] [--upload-budget kb]\n"
+                "                 [--clipmap levels] [--clipmap-size n] [--bathymetry tiles] [--tile-cache mb]\n"
+                "       fluid-sim --make-bathymetry tiles samples\n"
+                "                 [--record log | --replay log] [--checkpoint file] [--checkpoint-every frames] [--restart file]\n"
+                "                 [--autotune | --no-autotune] [--tune-tolerance height]\n"
+                "                 [--ripples off|cpu|gpu] [--ripple-grid n] [--ripple-viscosity r] [--bench-ripples steps]\n"
+                "                 [--ripple-current speed] [--advection first|maccormack|bfecc] [--iwave terms] [--ripple-obstacle radius]\n"
+                "                 [--ripple-sponge cells] [--ripple-upsample linear|cubic] [--ripple-detail gain]\n"
+                "                 [--reflections fraction] [--reflection-interval frames]\n"
+                "                 [--no-cull] [--depth-prepass] [--overdraw]\n"
+                "                 [--roofline report.json | --bench-adi | --bench-advect | --bench-iwave | --bench-sponge | --bench-upsample]\n"
+                "                 [--bench-bodies count | --bench-uptime]\n"
+                "                 [--bench-grid n]\n"
+                "       fluid-sim --ensemble results.csv [--sweep name=from:to:count ...] [--ensemble-steps n] [--ensemble-grid n] [--ensemble-jobs n]\n";
+            return -1;
+        }
+    }
+
+    // a restarted run takes its configuration from the checkpoint, so the checks below see what will actually run
+    checkpoint restart;
+    if (!g_restartpath.empty()) {
+        std::string error;
+        if (!loadcheckpoint(g_restartpath, restart, error)) {
+            std::cerr << "failed to load checkpoint " << g_restartpath << ": " << error << "\n";
+            return -1;
+        }
+        g_ripples = restart.header.ripples ? "cpu" : "off";
+        g_ripplegrid = restart.header.ripplegrid;
+        g_rippleviscosity = restart.header.rippleviscosity;
+        g_ripplecurrent = restart.header.ripplecurrent;
+        g_advection = advectschemenames[std::clamp(restart.header.rippleadvection, 0, 2)];
+        g_iwaverank = restart.header.iwaverank;
+        g_rippleobstacle = restart.header.rippleobstacle;
+        g_ripplesponge = restart.header.ripplesponge;
+        g_rippleupsample = restart.header.rippleupsample ? "cubic" : "linear";
+        g_rippledetail = restart.header.rippledetail;
+        g_clipmaplevels = restart.header.clipmaplevels;
+        g_clipmapsize = restart.header.clipmapsize;
+    }
+    if (g_checkpointpath.empty() != (g_checkpointevery == 0)) {
+        std::cerr << "--checkpoint and --checkpoint-every go together\n";
+        return -1;
+    }
+    if (g_rippleviscosity > 0.0f && g_ripples == "gpu") {
+        std::cerr << "--ripple-viscosity needs the cpu ripple solver\n";
+        return -1;
+    }
+    if (g_ripplecurrent != 0.0f && g_ripples == "gpu") {
+        std::cerr << "--ripple-current needs the cpu ripple solver\n";
+        return -1;
+    }
+    if ((g_iwaverank >= 0 || g_rippleobstacle > 0.0f) && g_ripples == "gpu") {
+        std::cerr << "--iwave and --ripple-obstacle need the cpu ripple solver\n";
+        return -1;
+    }
+    if (g_rippleupsample == "cubic" && g_ripples == "gpu") {
+        std::cerr << "the gpu ripples are sampled in the vertex shader; --ripple-upsample cubic needs the cpu ripple solver\n";
+        return -1;
+    }
+    if (g_rippledetail > 0.0f && g_rippleupsample != "cubic") {
+        std::cerr << "--ripple-detail needs --ripple-upsample cubic\n";
+        return -1;
+    }
+    if ((!g_checkpointpath.empty() || !g_restartpath.empty()) && g_ripples == "gpu") {
+        std::cerr << "the gpu ripple state lives in textures and is not checkpointed; use --ripples cpu\n";
+        return -1;
+    }
+
+    // benchmark modes run headless and exit
+    if (g_ripples != "off" && g_clipmaplevels > 0) {
+        std::cerr << "ripples are laid over the water volume and cannot be combined with --clipmap\n";
+        return -1;
+    }
+    bool residentwaves = g_compute == "gl" || g_compute == "feedback";
+    if ((g_ripples == "gpu" || g_benchripples > 0 || residentwaves) && g_backend != "gl") {
+        std::cerr << "the gpu ripple solver and gpu wave updates need the gl backend\n";
+        return -1;
+    }
+    if (g_reflectionscale > 0.0f && (g_clipmaplevels > 0 || g_backend != "gl")) {
+        std::cerr << "--reflections draws the water volume on the gl backend; it cannot be combined with --clipmap\n";
+        return -1;
+    }
+    if ((g_depthprepass || g_overdraw) && (g_clipmaplevels > 0 || g_backend != "gl")) {
+        std::cerr << "--depth-prepass and --overdraw draw the water volume on the gl backend; they cannot be combined with --clipmap\n";
+        return -1;
+    }
+    if (residentwaves && g_ripples == "cpu") {
+        std::cerr << "--compute " << g_compute << " keeps the surface on the gpu, so it cannot take cpu ripples; use --ripples gpu\n";
+        return -1;
+    }
+
+    std::unique_ptr<computebackend> compute = createcompute();
+    if (g_compute == "opencl" && !compute) return -1;
+    if (g_benchadi) {
+        runadibench(g_benchgrid);
+        return 0;
+    }
+    if (g_benchadvect) {
+        runadvectbench(g_benchgrid);
+        return 0;
+    }
+    if (g_benchiwave) {
+        runiwavebench(g_benchgrid);
+        return 0;
+    }
+    if (g_benchsponge) {
+        runspongebench();
+        return 0;
+    }
+    if (g_benchupsample) {
+        runupsamplebench(g_benchgrid, g_ripplegrid);
+        return 0;
+    }
+    if (g_benchbodies > 0) {
+        runbodiesbench(g_benchbodies);
+        return 0;
+    }
+    if (g_benchuptime) {
+        runuptimebench(g_benchgrid);
+        return 0;
+    }
+    if (!g_ensemblepath.empty()) {
+        int jobs = g_ensemblejobs > 0 ? g_ensemblejobs : int(std::max(1u, std::thread::hardware_concurrency()));
+        runensemble(g_ensemblepath, sweeps, g_ensemblegrid, g_ensemblesteps, jobs);
+        return 0;
+    }
+
     if (!glfwInit()) {
         std::cerr << "failed to initialize glfw\n";
         return -1;
     }
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    bool usegl = g_backend == "gl";
+    if (usegl) {
+        // compute shaders need 4.3; everything else runs on 3.3
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, g_compute == "gl" ? 4 : 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    }
+    else {
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    }
 
     GLFWwindow* window = glfwCreateWindow(window_width, window_height, "fluid sim :)", nullptr, nullptr);
+    if (!window && g_compute == "gl") {
+        std::cerr << "no gl 4.3 context, so the wave update stays on the cpu\n";
+        g_compute = "cpu";
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        window = glfwCreateWindow(window_width, window_height, "fluid sim :)", nullptr, nullptr);
+    }
     if (!window) {
         std::cerr << "failed to create glfw window\n";
         glfwTerminate();
         return -1;
     }
 
-    glfwMakeContextCurrent(window);
     glfwSetKeyCallback(window, key_callback);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
-    glewExperimental = GL_TRUE;
-    if (glewInit() != GLEW_OK) {
-        std::cerr << "failed to initialize glew\n";
-        glfwTerminate();
-        return -1;
+    GLuint shaderprogram = 0;
+    std::string renderername = g_backend;
+    if (usegl) {
+        glfwMakeContextCurrent(window);
+        glewExperimental = GL_TRUE;
+        if (glewInit() != GLEW_OK) {
+            std::cerr << "failed to initialize glew\n";
+            glfwTerminate();
+            return -1;
+        }
+        glEnable(GL_DEPTH_TEST);
+        if (g_compute == "gl" && !GLEW_VERSION_4_3) {
+            std::cerr << "no gl 4.3 context, so the wave update stays on the cpu\n";
+            g_compute = "cpu";
+        }
+        shaderprogram = createshaderprogram(vertex_shader_source, fragment_shader_source);
+        const char* name = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+        renderername = name ? name : "unknown renderer";
     }
-    glEnable(GL_DEPTH_TEST);
-
-    GLuint shaderprogram = createshaderprogram(vertex_shader_source, fragment_shader_source);
+#ifdef FLUIDSIM_VULKAN
+    std::unique_ptr<vulkanrenderer> vulkan;
+    if (g_backend == "vulkan") {
+        vulkan = std::make_unique<vulkanrenderer>(window);
+        std::string error;
+        if (!vulkan->init(error)) {
+            std::cerr << "failed to initialize vulkan: " << error << "\n";
+            vulkan.reset();
+            glfwTerminate();
+            return -1;
+        }
+        renderername = "vulkan " + vulkan->devicename();
+    }
+#endif
 
     int   gw = 200;
     int   gd = 200;
     float ww = 300.0f;
     float wd = 200.0f;
     float wt = 2.0f;
-    watervolume water(gw, gd, ww, wd, wt);
-
-    GLuint vao, vbo, ebo;
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ebo);
-
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    // GL_DYNAMIC_DRAW is used since the vertex data is updated every frame.
-    glBufferData(GL_ARRAY_BUFFER,
-        water.vertices.size() * sizeof(vertex),
-        water.vertices.data(),
-        GL_DYNAMIC_DRAW);
-
-    // setup vertex attribute pointers
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)0);
-    glEnableVertexAttribArray(0);
-    // the normal attribute is located after the position in the vertex structure.
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-        water.indices.size() * sizeof(unsigned int),
-        water.indices.data(),
-        GL_STATIC_DRAW);
-    glBindVertexArray(0);
 
-    glm::vec3 camerapos(0, 50, 100);
-    glm::vec3 lightpos(80, 80, 80);
-    glm::mat4 model = glm::mat4(1.0f);
-
-    float timeaccumulator = 0.0f;
-    // the simulation loop updates the water waves and redraws the scene continuously.
-    while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
-        timeaccumulator += 0.05f;
-        g_globalSimTime = timeaccumulator;
-
-        water.updatewaves(timeaccumulator);
-        water.upload(vbo);
-
-        glClearColor(0.3f, 0.5f, 1.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        glUseProgram(shaderprogram);
-        glm::mat4 view = glm::lookAt(
-            camerapos,
-            glm::vec3(0, 0, 0),
-            glm::vec3(0, 1, 0)
-        );
-        // the perspective matrix creates a realistic depth effect using field-of-view.
-        glm::mat4 projection = glm::perspective(
-            glm::radians(45.0f),
-            g_aspect_ratio,
-            0.1f,
-            500.0f
-        );
-
-        glUniformMatrix4fv(glGetUniformLocation(shaderprogram, "uModel"), 1, GL_FALSE, glm::value_ptr(model));
-        glUniformMatrix4fv(glGetUniformLocation(shaderprogram, "uView"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(shaderprogram, "uProj"), 1, GL_FALSE, glm::value_ptr(projection));
-
-        glUniform3fv(glGetUniformLocation(shaderprogram, "uCamPos"), 1, glm::value_ptr(camerapos));
-        glUniform3fv(glGetUniformLocation(shaderprogram, "uLightPos"), 1, glm::value_ptr(lightpos));
-        glUniform1i(glGetUniformLocation(shaderprogram, "uSteps"), 3);
-
-        glm::vec3 darkcolor(0.0f, 0.0f, 0.5f);
-        glm::vec3 lightcolor(0.3f, 0.6f, 1.0f);
-        glUniform3fv(glGetUniformLocation(shaderprogram, "uDarkColor"), 1, glm::value_ptr(darkcolor));
-        glUniform3fv(glGetUniformLocation(shaderprogram, "uLightColor"), 1, glm::value_ptr(lightcolor));
-
-        glBindVertexArray(vao);
-        glDrawElements(GL_TRIANGLES,
-            static_cast<GLsizei>(water.indices.size()),
-            GL_UNSIGNED_INT,
-            0);
+    // the main thread owns the gl context, so the simulation gets the remaining cores
+    tasksystem tasks(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    tasksystem background(1);
+    framescheduler scheduler;
+    if (g_benchripples > 0) {
+        runripplebench(g_ripplegrid, g_benchripples, tasks);
+        glDeleteProgram(shaderprogram);
+        glfwTerminate();
+        return 0;
+    }
+    framecontext ctx(tasks, background, scheduler, window, shaderprogram);
+    if (!g_restartpath.empty()) {
+        gw = restart.header.columns;
+        gd = restart.header.rows;
+        ww = restart.header.width;
+        wd = restart.header.depth;
+        wt = restart.header.thickness;
+    }
+    ctx.water = std::make_shared<watervolume>(gw, gd, ww, wd, wt);
+    ctx.water->tasks = &tasks;
+    applykerneltuning(*ctx.water, tasks, renderername);
+    if (!g_rooflinepath.empty()) {
+        // after tuning, so the table shows the kernels this machine actually runs
+        runroofline(g_rooflinepath, g_benchgrid, compute.get(), tasks);
+        if (usegl) glDeleteProgram(shaderprogram);
+        glfwTerminate();
+        return 0;
+    }
+    if (!g_restartpath.empty()) {
+        // tiling and threads cannot change results, but the kernels must be the ones the run started with
+        g_kernel.simd = restart.header.simd;
+        g_kernel.sinetier = restart.header.sinetier;
+        ctx.water->waves = restart.header.waves;
+    }
+    // attached after tuning, which measures the cpu kernels. the gpu updates only drive the volume
+    if (g_clipmaplevels == 0 && (g_compute == "gl" || g_compute == "feedback")) {
+        std::unique_ptr<glresidentwaves> gpuwaves;
+        if (g_compute == "gl") gpuwaves = std::make_unique<glcomputewaves>();
+        else gpuwaves = std::make_unique<glfeedbackwaves>();
+        ctx.gpuwaves = gpuwaves.get();
+        compute = std::move(gpuwaves);
+    }
+    ctx.water->compute = compute.get();
+    if (g_ripples == "cpu") {
+        ctx.ripples = std::make_unique<ripplegrid>(g_ripplegrid);
+        ctx.ripples->tasks = &tasks;
+        ctx.ripples->setviscosity(g_rippleviscosity);
+        advectscheme scheme = advectscheme::maccormack;
+        parseadvectscheme(g_advection, scheme);
+        ctx.ripples->setcurrent(g_ripplecurrent, scheme);
+        ctx.ripples->setdispersion(g_iwaverank);
+        ctx.ripples->setobstacle(g_rippleobstacle);
+        ctx.ripples->setsponge(g_ripplesponge);
+        ctx.water->ripples = ctx.ripples.get();
+        if (g_rippleupsample == "cubic") {
+            ctx.upsampler = std::make_unique<rippleupsampler>(g_rippledetail);
+            ctx.water->upsampler = ctx.upsampler.get();
+        }
+    }
+    else if (g_ripples == "gpu") {
+        ctx.ripplepasses = std::make_unique<gpuripples>(g_ripplegrid, ww, wd);
+        ctx.ripplepasses->spongewidth = std::clamp(g_ripplesponge, 0, g_ripplegrid / 2 - 1);
+    }
+    if (!g_restartpath.empty()) {
+        restorecheckpoint(restart, ctx.sim, ctx.ripples.get());
+        g_inputlog.seek(ctx.sim.frame);
+        printf("restarted from %s at frame %ld\n", g_restartpath.c_str(), ctx.sim.frame);
+    }
+    if (!g_checkpointpath.empty()) {
+        ctx.checkpoints = std::make_unique<checkpointwriter>(background, g_checkpointpath, g_checkpointevery);
+    }
+    if (g_reflectionscale > 0.0f) {
+        ctx.maps = std::make_unique<surfacemaps>(g_reflectionscale, g_reflectioninterval, shaderprogram);
+    }
+    ctx.camerapos = glm::vec3(0, 50, 100);
+    ctx.lightpos = glm::vec3(80, 80, 80);
+    ctx.model = glm::mat4(1.0f);
+    if (g_clipmaplevels > 0) {
+        ctx.ocean = std::make_unique<clipmap>(g_clipmaplevels, g_clipmapsize, 0.5f);
+        ctx.ocean->tasks = &tasks;
+        ctx.ocean->eye = glm::vec2(ctx.camerapos.x, ctx.camerapos.z);
+        if (!g_bathymetrypath.empty()) {
+            ctx.bathymetry = std::make_unique<tilecache>();
+            std::string error;
+            if (!ctx.bathymetry->open(g_bathymetrypath, g_tilecachebudget, error)) {
+                std::cerr << "failed to open bathymetry " << g_bathymetrypath << ": " << error << "\n";
+                glfwTerminate();
+                return -1;
+            }
+            ctx.ocean->terrain = ctx.bathymetry.get();
+        }
+        ctx.farplane = 0.5f * ctx.ocean->extent();
+    }
+    else if (usegl) {
+        ctx.drawer = std::make_unique<volumedrawer>(shaderprogram, g_cullfaces, g_depthprepass, g_overdraw);
+    }
+    const std::vector<vertex>& meshvertices = ctx.ocean ? ctx.ocean->vertices : ctx.water->vertices;
+    const std::vector<unsigned int>& meshindices = ctx.ocean ? ctx.ocean->indices : ctx.water->indices;
 
-        glfwSwapBuffers(window);
+    if (g_sequential) {
+#ifdef FLUIDSIM_VULKAN
+        if (vulkan) ctx.backend = std::move(vulkan);
+#endif
+        if (!ctx.backend) {
+            auto gl = std::make_unique<glrenderer>(window, shaderprogram);
+            gl->ripples = ctx.ripplepasses.get();
+            gl->gpuwaves = ctx.gpuwaves;
+            gl->maps = ctx.maps.get();
+            gl->drawer = ctx.drawer.get();
+            ctx.backend = std::move(gl);
+        }
+        ctx.backend->setmesh(meshvertices, meshindices);
+        runsequential(ctx);
+#ifdef FLUIDSIM_VULKAN
+        if (auto* backend = dynamic_cast<vulkanrenderer*>(ctx.backend.get())) backend->report();
+#endif
+    }
+    else {
+        ctx.mesh = creategpumesh(meshvertices, meshindices, g_framesinflight, true);
+        runpipelined(ctx);
+    }
+    g_inputlog.close();
+    if (compute) compute->report();
+    if (ctx.ripples) ctx.ripples->report();
+    if (ctx.upsampler) ctx.upsampler->report();
+    if (ctx.maps) ctx.maps->report();
+    if (ctx.drawer) ctx.drawer->report();
+    if (ctx.checkpoints) {
+        ctx.checkpoints->finish();
+        ctx.checkpoints->report();
     }
 
-    glDeleteProgram(shaderprogram);
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &ebo);
-    glDeleteVertexArrays(1, &vao);
+    ctx.backend.reset();
+    ctx.ripplepasses.reset();
+    ctx.maps.reset();
+    ctx.drawer.reset();
+    ctx.gpuwaves = nullptr;
+    compute.reset();  // gl compute owns gl objects
+    if (usegl) glDeleteProgram(shaderprogram);
+    ctx.mesh.reset();
+    ctx.pendingmesh.reset();
     glfwTerminate();
     return 0;
 }
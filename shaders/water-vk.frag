@@ -0,0 +1,19 @@
+#version 450
+// the water fragment shader for the vulkan backend; build with: glslc water-vk.frag -o water-vk.frag.spv
+layout(push_constant) uniform frameconstants {
+    mat4 mvp;
+    vec4 lightpos;    // model space
+    vec4 darkcolor;   // w: toon steps
+    vec4 lightcolor;
+} pc;
+layout(location = 0) in vec3 vPos;
+layout(location = 1) in vec3 vNormal;
+layout(location = 0) out vec4 fragColor;
+void main() {
+    vec3 normal = normalize(vNormal);
+    vec3 lightDir = normalize(pc.lightpos.xyz - vPos);
+    float lambert = max(dot(normal, lightDir), 0.0);
+    float toonLevel = floor(lambert * pc.darkcolor.w) / pc.darkcolor.w;
+    vec3 color = mix(pc.darkcolor.rgb, pc.lightcolor.rgb, toonLevel);
+    fragColor = vec4(color, 1.0);
+}
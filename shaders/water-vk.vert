@@ -0,0 +1,18 @@
+#version 450
+// the water vertex shader for the vulkan backend; build with: glslc water-vk.vert -o water-vk.vert.spv
+// per-frame values arrive as push constants. lighting is done in model space, so one matrix is enough.
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(push_constant) uniform frameconstants {
+    mat4 mvp;
+    vec4 lightpos;    // model space
+    vec4 darkcolor;   // w: toon steps
+    vec4 lightcolor;
+} pc;
+layout(location = 0) out vec3 vPos;
+layout(location = 1) out vec3 vNormal;
+void main() {
+    vPos = aPos;
+    vNormal = aNormal;
+    gl_Position = pc.mvp * vec4(aPos, 1.0);
+}